@@ -0,0 +1,22 @@
+#include "Adjacency.h"
+
+using namespace std;
+
+namespace ST
+{
+    void Adjacency::Build(size_t numRows, const vector<int>& rows,
+                          const vector<int>& values)
+    {
+        // Counting sort by row keeps the order of items inside the rows.
+        offset.assign(numRows + 1, 0);
+        for (size_t k = 0; k < rows.size(); k++)
+            offset[rows[k] + 1]++;
+        for (size_t i = 0; i < numRows; i++)
+            offset[i + 1] += offset[i];
+
+        items.resize(values.size());
+        vector<int> next(offset.begin(), offset.end() - 1);
+        for (size_t k = 0; k < rows.size(); k++)
+            items[next[rows[k]]++] = values[k];
+    }
+}
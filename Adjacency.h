@@ -0,0 +1,35 @@
+#ifndef ADJACENCY_H_INCLUDED
+#define ADJACENCY_H_INCLUDED
+
+#include <vector>
+#include <cstddef>
+
+namespace ST
+{
+    /** One-to-many relation stored as compressed sparse rows:
+        items of row 'i' are items[offset[i]; offset[i + 1]).
+        Used for lookups like joint -> vertices or vertex -> triangles
+        that are built once and read many times.
+    */
+    struct Adjacency
+    {
+        /** Builds the relation from pairs (rows[k], values[k]).
+            Items keep their order inside a row.
+        */
+        void Build(size_t numRows, const std::vector<int>& rows,
+                   const std::vector<int>& values);
+        void Clear() { offset.clear(); items.clear(); }
+
+        size_t NumRows() const
+        {
+            return offset.empty() ? 0 : offset.size() - 1;
+        }
+        const int* Begin(size_t row) const { return items.data() + offset[row]; }
+        const int* End(size_t row) const { return items.data() + offset[row + 1]; }
+
+        std::vector<int> offset; //!< First item of each row + end.
+        std::vector<int> items;
+    };
+}
+
+#endif // ADJACENCY_H_INCLUDED
@@ -0,0 +1,384 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "AnimGraph.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        Quaternion loadOrient(const float* pose, size_t stride, int i)
+        {
+            return Quaternion(pose[3 * stride + i], pose[4 * stride + i],
+                              pose[5 * stride + i], pose[6 * stride + i]);
+        }
+
+        Vector3D loadPos(const float* pose, size_t stride, int i)
+        {
+            return Vector3D(pose[i], pose[stride + i], pose[2 * stride + i]);
+        }
+
+        bool samePose(const MD5Animation::SkeletonJoint& joint,
+                      const Vector3D& pos, const Quaternion& orient)
+        {
+            return joint.pos[0] == pos[0] && joint.pos[1] == pos[1] &&
+                   joint.pos[2] == pos[2] &&
+                   joint.orient.w == orient.w && joint.orient.x == orient.x &&
+                   joint.orient.y == orient.y && joint.orient.z == orient.z;
+        }
+    }
+
+    AnimGraph::AnimGraph()
+        : numJoints(0), poseChanged(false), extractRoot(false)
+    {
+    }
+
+    AnimGraph::NodeID AnimGraph::AddClip(const MD5Animation& clip)
+    {
+        if (clip.GetNumJoints() < 1)
+            throw runtime_error("Graph cannot play an empty clip");
+
+        if (clips.empty())
+        {
+            numJoints = clip.GetNumJoints();
+            parents.resize(numJoints);
+            for (int i = 0; i < numJoints; i++)
+                parents[i] = clip.GetJointInfo(i).parentID;
+
+            objectPose.resize(PoseSize(numJoints));
+            skeleton.assign(numJoints, MD5Animation::SkeletonJoint());
+            changedJoints.assign(numJoints, true);
+            poseChanged = true;
+        }
+        else if (!sameSkeleton(clip))
+            throw runtime_error("Clip doesn't match the skeleton of the graph");
+
+        Node node = { NODE_CLIP, { -1, -1, -1 }, int(clips.size()),
+                      0, 1.0f, 1.0f, -1 };
+        NodeID id = addNode(node);
+        clips.push_back(clip);
+
+        // The copy samples the clip in place if the graph does.
+        if (clip.IsRootMotion() != extractRoot)
+            clips.back().SetRootMotion(extractRoot);
+        return id;
+    }
+
+    AnimGraph::NodeID AnimGraph::AddBlend(NodeID a, NodeID b)
+    {
+        Node node = { NODE_BLEND, { a, b, -1 }, -1, 0, 0.0f, 0.0f, -1 };
+        return addNode(node);
+    }
+
+    AnimGraph::NodeID AnimGraph::AddAdditive(NodeID base, NodeID additive,
+                                             NodeID reference)
+    {
+        Node node = { NODE_ADDITIVE, { base, additive, reference }, -1,
+                      0, 0.0f, 1.0f, -1 };
+        return addNode(node);
+    }
+
+    AnimGraph::NodeID AnimGraph::addNode(const Node& node)
+    {
+        // Inputs come first, so the graph can't have cycles.
+        NodeID id = nodes.size();
+        int numInputs = node.type == NODE_CLIP ? 0 :
+                        node.type == NODE_BLEND ? 2 : 3;
+        for (int i = 0; i < numInputs; i++)
+        {
+            if (node.input[i] < 0 || node.input[i] >= id)
+                throw runtime_error("Input of the node isn't in the graph");
+        }
+        nodes.push_back(node);
+
+        // Joints that are never written keep the identity, like padding.
+        size_t size = PoseSize(numJoints);
+        size_t stride = PoseStride(numJoints);
+        poses.resize(nodes.size() * size, 0.0f);
+        fill_n(&poses[id * size + 3 * stride], stride, 1.0f);
+        return id;
+    }
+
+    AnimGraph::Node& AnimGraph::getNode(NodeID node)
+    {
+        const AnimGraph* graph = this;
+        return const_cast<Node&>(graph->getNode(node));
+    }
+
+    const AnimGraph::Node& AnimGraph::getNode(NodeID node) const
+    {
+        if (node < 0 || node >= (NodeID)nodes.size())
+            throw runtime_error("Node isn't in the graph");
+        return nodes[node];
+    }
+
+    bool AnimGraph::sameSkeleton(const MD5Animation& clip) const
+    {
+        if (clip.GetNumJoints() != numJoints)
+            return false;
+
+        for (int i = 0; i < numJoints; i++)
+        {
+            const MD5Animation::JointInfo& joint = clip.GetJointInfo(i);
+            const MD5Animation::JointInfo& own = clips[0].GetJointInfo(i);
+
+            if (joint.name != own.name || joint.parentID != own.parentID)
+                return false;
+        }
+
+        return true;
+    }
+
+    void AnimGraph::SetWeight(NodeID node, float weight)
+    {
+        getNode(node).weight = weight;
+    }
+
+    void AnimGraph::SetMask(NodeID id, const JointMask& mask)
+    {
+        Node& node = getNode(id);
+        if (!mask.empty() && mask.size() != (size_t)numJoints)
+            throw runtime_error("Mask doesn't match the skeleton of the graph");
+
+        if (mask.empty()) node.mask = -1;
+        else if (node.mask >= 0) masks[node.mask] = mask;
+        else
+        {
+            node.mask = masks.size();
+            masks.push_back(mask);
+        }
+    }
+
+    void AnimGraph::SetSpeed(NodeID id, float speed)
+    {
+        Node& node = getNode(id);
+        if (node.type != NODE_CLIP)
+            throw runtime_error("Only clips have the speed");
+        node.speed = speed;
+    }
+
+    long long AnimGraph::GetTicks(NodeID id) const
+    {
+        const Node& node = getNode(id);
+        if (node.type != NODE_CLIP)
+            throw runtime_error("Only clips have the clock");
+        return node.ticks;
+    }
+
+    void AnimGraph::SetTicks(NodeID id, long long ticks)
+    {
+        Node& node = getNode(id);
+        if (node.type != NODE_CLIP)
+            throw runtime_error("Only clips have the clock");
+        node.ticks = ticks;
+        node.motion = MD5Animation::Transform();
+    }
+
+    void AnimGraph::SetRootMotion(bool extract)
+    {
+        extractRoot = extract;
+        rootMotion = MD5Animation::Transform();
+        for (size_t i = 0; i < clips.size(); i++)
+            clips[i].SetRootMotion(extract);
+        for (size_t i = 0; i < nodes.size(); i++)
+            nodes[i].motion = MD5Animation::Transform();
+    }
+
+    void AnimGraph::SetBlendTolerance(float tolerance)
+    {
+        if (tolerance > 0.0f) blender.SetNlerp(tolerance);
+        else blender.SetSlerp();
+    }
+
+    void AnimGraph::MaskSubtree(const string& joint, JointMask& mask) const
+    {
+        int root = -1;
+        for (int i = 0; i < numJoints && root < 0; i++)
+        {
+            if (clips[0].GetJointInfo(i).name == joint)
+                root = i;
+        }
+        if (root < 0)
+            throw runtime_error("Graph has no joint: " + joint);
+
+        // Parents go before their children.
+        mask.resize(numJoints, false);
+        vector<bool> subtree(numJoints, false);
+        for (int i = root; i < numJoints; i++)
+        {
+            if (i == root || (parents[i] >= 0 && subtree[parents[i]]))
+                subtree[i] = mask[i] = true;
+        }
+    }
+
+    void AnimGraph::Update(float deltaTimeSec)
+    {
+        Advance(llround(double(deltaTimeSec) * MD5Animation::TicksPerSecond));
+    }
+
+    void AnimGraph::Advance(long long ticks)
+    {
+        if (nodes.empty()) return;
+
+        // Clips that are blended out keep playing, so they are
+        // in step with the others when they are blended in again.
+        // The clips wrap their clocks into themselves when sampled.
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            Node& node = nodes[i];
+            if (node.type != NODE_CLIP) continue;
+
+            long long prevTicks = node.ticks;
+            node.ticks += llround(double(ticks) * node.speed);
+            if (extractRoot)
+            {
+                node.motion = clips[node.clip].SampleRootMotion(prevTicks,
+                                                                node.ticks);
+            }
+        }
+
+        storeSkeleton(evaluate(nodes.size() - 1));
+        if (extractRoot) rootMotion = nodes.back().motion;
+    }
+
+    MD5Animation::Bound AnimGraph::GetBound() const
+    {
+        MD5Animation::Bound bound;
+        bool first = true;
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            const Node& node = nodes[i];
+            if (node.type != NODE_CLIP) continue;
+
+            MD5Animation::Bound clip = clips[node.clip].SampleBound(node.ticks);
+            if (first) bound = clip;
+            first = false;
+            for (int c = 0; c < 3; c++)
+            {
+                bound.min[c] = min(bound.min[c], clip.min[c]);
+                bound.max[c] = max(bound.max[c], clip.max[c]);
+            }
+        }
+        return bound;
+    }
+
+    const float* AnimGraph::evaluate(NodeID id)
+    {
+        Node& node = nodes[id];
+        float* pose = &poses[id * PoseSize(numJoints)];
+
+        switch (node.type)
+        {
+        case NODE_CLIP:
+            sampleClip(node, pose);
+            return pose;
+
+        case NODE_BLEND:
+            if (node.weight <= 0.0f)
+                return pass(node, node.input[0]);
+            if (node.weight >= 1.0f && node.mask < 0)
+                return pass(node, node.input[1]);
+
+            blend(node, evaluate(node.input[0]), evaluate(node.input[1]),
+                  pose);
+            if (extractRoot) blendMotion(node);
+            return pose;
+
+        case NODE_ADDITIVE:
+            if (node.weight <= 0.0f)
+                return pass(node, node.input[0]);
+
+            addPose(node, evaluate(node.input[0]), evaluate(node.input[1]),
+                    evaluate(node.input[2]), pose);
+            node.motion = nodes[node.input[0]].motion;
+            return pose;
+        }
+        return pose;
+    }
+
+    const float* AnimGraph::pass(Node& node, NodeID input)
+    {
+        const float* pose = evaluate(input);
+        node.motion = nodes[input].motion;
+        return pose;
+    }
+
+    void AnimGraph::blendMotion(Node& node) const
+    {
+        const MD5Animation::Transform& a = nodes[node.input[0]].motion;
+        const MD5Animation::Transform& b = nodes[node.input[1]].motion;
+
+        // The root moves with the pose of its joint.
+        int root = clips[0].GetRootJoint();
+        if (node.mask >= 0 && !masks[node.mask][root])
+        {
+            node.motion = a;
+            return;
+        }
+
+        node.motion.pos = Vector3D::Lerp(a.pos, b.pos, node.weight);
+        node.motion.orient = Quaternion::Slerp(a.orient, b.orient,
+                                               node.weight);
+    }
+
+    void AnimGraph::sampleClip(Node& node, float* pose)
+    {
+        clips[node.clip].SampleLocalPose(node.ticks, pose);
+    }
+
+    void AnimGraph::blend(const Node& node, const float* a, const float* b,
+                          float* pose) const
+    {
+        blender.Blend(a, b, node.weight, numJoints, pose);
+        keepUnmasked(node, a, pose);
+    }
+
+    void AnimGraph::addPose(const Node& node, const float* base,
+                            const float* additive, const float* reference,
+                            float* pose) const
+    {
+        blender.Add(base, additive, reference, node.weight, numJoints, pose);
+        keepUnmasked(node, base, pose);
+    }
+
+    void AnimGraph::keepUnmasked(const Node& node, const float* input,
+                                 float* pose) const
+    {
+        if (node.mask < 0) return;
+
+        const JointMask& mask = masks[node.mask];
+        size_t stride = PoseStride(numJoints);
+        for (int i = 0; i < numJoints; i++)
+        {
+            if (mask[i]) continue;
+            for (int r = 0; r < 7; r++)
+                pose[r * stride + i] = input[r * stride + i];
+        }
+    }
+
+    void AnimGraph::storeSkeleton(const float* pose)
+    {
+        PoseToObject(pose, parents.data(), numJoints, objectPose.data());
+        pose = objectPose.data();
+        size_t stride = PoseStride(numJoints);
+
+        poseChanged = false;
+        for (int i = 0; i < numJoints; i++)
+        {
+            Vector3D pos = loadPos(pose, stride, i);
+            Quaternion orient = loadOrient(pose, stride, i);
+
+            MD5Animation::SkeletonJoint& joint = skeleton[i];
+            bool changed = !samePose(joint, pos, orient);
+            changedJoints[i] = changed;
+            poseChanged = poseChanged || changed;
+
+            joint.parent = parents[i];
+            joint.pos = pos;
+            joint.orient = orient;
+        }
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef ANIMGRAPH_H_INCLUDED
+#define ANIMGRAPH_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include "MD5Animation.h"
+#include "PoseBlend.h"
+
+namespace ST
+{
+    /** Tree of nodes that mixes animation clips into one skeleton.
+        Clip nodes play clips, blend nodes crossfade two inputs and
+        additive nodes add the difference of a pose from a reference
+        pose to a base pose. Blend and additive nodes can be limited
+        to some joints by a mask, e.g. to layer an upper-body clip.
+
+        Nodes are added after their inputs and the last one is the root.
+        Poses are mixed in the space of the parent joints, each node
+        has its pose in one buffer allocated while nodes are added,
+        so Update() doesn't allocate. Inputs that don't contribute to
+        the result, like the other side of a finished crossfade,
+        aren't evaluated. Clip nodes play their own copies of the clips,
+        which share the frames with the original, so graphs of different
+        characters can be updated on different threads. Every clip node
+        has its own clock in the ticks of MD5Animation, stepped by
+        the ticks of the graph scaled by the speed of the node.
+    */
+    class AnimGraph
+    {
+    public:
+        typedef int NodeID;
+        /** Joints a node changes, all of them if the mask is empty. */
+        typedef std::vector<bool> JointMask;
+
+        AnimGraph();
+
+        /** The first clip defines the skeleton of the graph, the other
+            ones must have the same joints and throw otherwise.
+        */
+        NodeID AddClip(const MD5Animation& clip);
+        /** Pose of 'a' blended towards 'b' by the weight of the node. */
+        NodeID AddBlend(NodeID a, NodeID b);
+        /** Pose of 'base' with the rotation of 'additive' relative to
+            'reference' applied by the weight of the node.
+        */
+        NodeID AddAdditive(NodeID base, NodeID additive, NodeID reference);
+
+        void SetWeight(NodeID node, float weight);
+        void SetMask(NodeID node, const JointMask& mask);
+        void SetSpeed(NodeID clip, float speed);
+        /** Clock of the clip since the start, it isn't wrapped. */
+        long long GetTicks(NodeID clip) const;
+        /** Jumps the clip to 'ticks' without any root motion. */
+        void SetTicks(NodeID clip, long long ticks);
+        /** Joints are blended by slerp when 'tolerance' is zero,
+            otherwise by nlerp within 'tolerance' radians of slerp.
+        */
+        void SetBlendTolerance(float tolerance);
+
+        /** Marks the joint and all its descendants in 'mask'. */
+        void MaskSubtree(const std::string& joint, JointMask& mask) const;
+
+        /** Advances the clips by 'deltaTimeSec' rounded to ticks
+            and evaluates the root.
+        */
+        void Update(float deltaTimeSec);
+        /** Advances the clips by 'ticks', which may be negative,
+            and evaluates the root.
+        */
+        void Advance(long long ticks);
+
+        /** Plays the clips in place, see MD5Animation::SetRootMotion().
+            Their root motion is mixed like the poses: blend nodes
+            blend it, unless their mask leaves out the root joint,
+            and additive nodes keep the motion of the base.
+        */
+        void SetRootMotion(bool extract);
+        bool IsRootMotion() const
+        {
+            return extractRoot;
+        }
+        /** Motion of the origin made by the last Update() or Advance(). */
+        const MD5Animation::Transform& GetRootMotion() const
+        {
+            return rootMotion;
+        }
+
+        const MD5Animation::Skeleton& GetSkeleton() const
+        {
+            return skeleton;
+        }
+
+        int GetNumJoints() const
+        {
+            return numJoints;
+        }
+
+        const MD5Animation::JointInfo& GetJointInfo(size_t index) const
+        {
+            return clips[0].GetJointInfo(index);
+        }
+
+        /** Box around the bounds of all the clips at their time, so it
+            holds the mesh whatever the clips are mixed with.
+        */
+        MD5Animation::Bound GetBound() const;
+
+        /** Whether the last Update() changed the skeleton at all
+            and which joints it changed.
+        */
+        bool HasPoseChanged() const
+        {
+            return poseChanged;
+        }
+
+        bool IsJointChanged(size_t index) const
+        {
+            return changedJoints[index];
+        }
+
+    private:
+        enum NodeType
+        {
+            NODE_CLIP,
+            NODE_BLEND,
+            NODE_ADDITIVE
+        };
+
+        struct Node
+        {
+            NodeType      type;
+            NodeID        input[3];
+            int           clip;   //!< Index in clips.
+            long long     ticks;  //!< Clock of the clip.
+            float         speed;
+            float         weight;
+            int           mask;   //!< Index in masks, -1 for all joints.
+            MD5Animation::Transform motion; //!< Root motion of the update.
+        };
+
+        NodeID addNode(const Node& node);
+        Node& getNode(NodeID node);
+        const Node& getNode(NodeID node) const;
+        bool sameSkeleton(const MD5Animation& clip) const;
+        const float* evaluate(NodeID node);
+        /** Evaluates 'input' in place of 'node', which takes its motion. */
+        const float* pass(Node& node, NodeID input);
+        void blendMotion(Node& node) const;
+        void sampleClip(Node& node, float* pose);
+        void blend(const Node& node, const float* a, const float* b,
+                   float* pose) const;
+        void addPose(const Node& node, const float* base,
+                     const float* additive, const float* reference,
+                     float* pose) const;
+        /** Joints out of the mask of the node keep the input pose. */
+        void keepUnmasked(const Node& node, const float* input,
+                          float* pose) const;
+        void storeSkeleton(const float* pose);
+
+        std::vector<Node>         nodes;
+        std::vector<MD5Animation> clips;   //!< The first has the skeleton.
+        std::vector<JointMask>    masks;
+        std::vector<float>        poses;   //!< Node after node.
+        std::vector<int>          parents;
+        int                       numJoints;
+
+        PoseBlender               blender;
+        std::vector<float>        objectPose;    //!< Pose of the root.
+        MD5Animation::Skeleton    skeleton;      //!< Same as objectPose.
+        std::vector<bool>         changedJoints; //!< Joints moved by Update().
+        bool                      poseChanged;
+        bool                      extractRoot;
+        MD5Animation::Transform   rootMotion;
+    };
+}
+
+#endif // ANIMGRAPH_H_INCLUDED
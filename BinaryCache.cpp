@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <fstream>
+#include "BinaryCache.h"
+
+using namespace std;
+
+namespace ST
+{
+    namespace
+    {
+        struct CacheHeader
+        {
+            char magic[4];
+            unsigned version;
+            FileStamp source;
+        };
+
+        // Arrays start at this boundary, so the data of a mapped
+        // cache is aligned the same way as the data in memory.
+        const size_t array_alignment = 16;
+
+        inline size_t align(size_t offset)
+        {
+            return (offset + array_alignment - 1) & ~(array_alignment - 1);
+        }
+    }
+
+    bool GetFileStamp(const string& fileName, FileStamp& stamp)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!::GetFileAttributesExA(fileName.c_str(),
+                                    GetFileExInfoStandard, &data))
+            return false;
+
+        stamp.size = (unsigned long long)data.nFileSizeHigh << 32 |
+                     data.nFileSizeLow;
+        stamp.time = (unsigned long long)
+                     data.ftLastWriteTime.dwHighDateTime << 32 |
+                     data.ftLastWriteTime.dwLowDateTime;
+        return true;
+    }
+
+    string GetCacheName(const string& sourceName)
+    {
+        return sourceName + ".cache";
+    }
+
+    //-------------- CacheWriter --------------//
+    CacheWriter::CacheWriter(const char* magic, unsigned version,
+                             const FileStamp& source)
+    {
+        CacheHeader header;
+        memcpy(header.magic, magic, sizeof(header.magic));
+        header.version = version;
+        header.source = source;
+        Write(header);
+    }
+
+    void CacheWriter::WriteString(const string& str)
+    {
+        Write<unsigned>(str.size());
+        write(str.data(), str.size());
+    }
+
+    bool CacheWriter::Save(const string& fileName) const
+    {
+        ofstream file(fileName, ios::out | ios::binary | ios::trunc);
+        if (!file) return false;
+
+        file.write(&buffer[0], buffer.size());
+        file.close();
+
+        // Don't leave half written cache behind.
+        if (!file)
+        {
+            remove(fileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void CacheWriter::write(const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    void CacheWriter::writeArray(const void* data, size_t elementSize,
+                                 size_t count)
+    {
+        Write<unsigned>(elementSize);
+        Write<unsigned>(count);
+        buffer.resize(align(buffer.size()), 0);
+        write(data, elementSize * count);
+    }
+
+    //-------------- CacheReader --------------//
+    CacheReader::CacheReader() : cur(0)
+    {
+    }
+
+    bool CacheReader::Open(const string& fileName, const char* magic,
+                           unsigned version, const FileStamp& source)
+    {
+        if (!file.Open(fileName)) return false;
+        cur = file.Begin();
+
+        CacheHeader header;
+        return Read(header) &&
+               memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+               header.version == version &&
+               header.source.size == source.size &&
+               header.source.time == source.time;
+    }
+
+    bool CacheReader::ReadString(string& str)
+    {
+        unsigned size;
+        if (!Read(size)) return false;
+
+        const char* data = read(size);
+        if (!data) return false;
+
+        str.assign(data, size);
+        return true;
+    }
+
+    const char* CacheReader::read(size_t size)
+    {
+        if (size_t(file.End() - cur) < size) return 0;
+
+        const char* data = cur;
+        cur += size;
+        return data;
+    }
+
+    const char* CacheReader::readArray(size_t elementSize, size_t& count)
+    {
+        unsigned storedSize, storedCount;
+        if (!Read(storedSize) || !Read(storedCount)) return 0;
+
+        // Layout of the structure has changed since the cache was written.
+        if (storedSize != elementSize) return 0;
+
+        size_t offset = align(cur - file.Begin());
+        if (offset > file.Size()) return 0;
+        cur = file.Begin() + offset;
+
+        count = storedCount;
+        return read(elementSize * count);
+    }
+}
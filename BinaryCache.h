@@ -0,0 +1,108 @@
+#ifndef BINARYCACHE_H_INCLUDED
+#define BINARYCACHE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include "MappedFile.h"
+
+namespace ST
+{
+    /** Size and modification time of the file a cache was built from.
+        When either of them changes the cache is stale.
+    */
+    struct FileStamp
+    {
+        unsigned long long size;
+        unsigned long long time;
+    };
+
+    bool GetFileStamp(const std::string& fileName, FileStamp& stamp);
+
+    /** Returns the name of the cache file kept next to 'sourceName'. */
+    std::string GetCacheName(const std::string& sourceName);
+
+    /** Collects a binary cache in memory and saves it to disk at once.
+        Arrays are stored as raw memory, so only plain structures
+        (no pointers, no std::string inside) can be written with
+        WriteArray(). Cache is valid only for the build that wrote it.
+    */
+    class CacheWriter
+    {
+    public:
+        CacheWriter(const char* magic, unsigned version,
+                    const FileStamp& source);
+
+        template <typename T>
+        void Write(const T& value)
+        {
+            write(&value, sizeof(T));
+        }
+
+        template <typename T>
+        void WriteArray(const std::vector<T>& values)
+        {
+            writeArray(values.empty() ? 0 : &values[0],
+                       sizeof(T), values.size());
+        }
+
+        void WriteString(const std::string& str);
+
+        /** Returns false if the file cannot be written. */
+        bool Save(const std::string& fileName) const;
+
+    private:
+        void write(const void* data, size_t size);
+        void writeArray(const void* data, size_t elementSize, size_t count);
+
+        std::vector<char> buffer; //!< Contents of the cache file.
+    };
+
+    /** Reads a cache written by CacheWriter straight from the mapped file.
+        Every array is copied with a single allocation.
+        Every Read*() returns false if the cache is truncated or
+        its layout doesn't match, then the cache must be rebuilt.
+    */
+    class CacheReader
+    {
+    public:
+        CacheReader();
+
+        /** Returns false if there is no cache or it was built
+            for another version or another state of the source file.
+        */
+        bool Open(const std::string& fileName, const char* magic,
+                  unsigned version, const FileStamp& source);
+
+        template <typename T>
+        bool Read(T& value)
+        {
+            const char* data = read(sizeof(T));
+            if (!data) return false;
+            std::memcpy(&value, data, sizeof(T));
+            return true;
+        }
+
+        template <typename T>
+        bool ReadArray(std::vector<T>& values)
+        {
+            size_t count;
+            const char* data = readArray(sizeof(T), count);
+            if (!data) return false;
+            values.resize(count);
+            if (count) std::memcpy(&values[0], data, count * sizeof(T));
+            return true;
+        }
+
+        bool ReadString(std::string& str);
+
+    private:
+        const char* read(size_t size);
+        const char* readArray(size_t elementSize, size_t& count);
+
+        MappedFile  file; //!< Mapped cache file.
+        const char* cur;  //!< Current read position.
+    };
+}
+
+#endif // BINARYCACHE_H_INCLUDED
@@ -10,6 +10,37 @@ namespace ST
         view.MakeIdentity();
         projection = Matrix4D::ProjectionMatrix(
             45.0f, float(width) / float(height), 1, 1000);
+        updateFrustum();
+    }
+
+    void Camera::updateFrustum()
+    {
+        // Points in the view satisfy -w <= x, y, z <= w in clip space,
+        // so the planes are sums and differences of the rows.
+        Matrix4D clip = projection * view;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                planes[2 * i][c] = clip[4 * c + 3] + clip[4 * c + i];
+                planes[2 * i + 1][c] = clip[4 * c + 3] - clip[4 * c + i];
+            }
+        }
+    }
+
+    bool Camera::IsBoxVisible(const Vector3D& min, const Vector3D& max) const
+    {
+        // The box is out if its corner farthest along
+        // the normal of some plane is behind it.
+        for (int i = 0; i < 6; i++)
+        {
+            const Vector4D& p = planes[i];
+            float d = p[3];
+            for (int c = 0; c < 3; c++)
+                d += p[c] * (p[c] > 0.0f ? max[c] : min[c]);
+            if (d < 0.0f) return false;
+        }
+        return true;
     }
 
     const Matrix4D& Camera::GetView() const
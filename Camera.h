@@ -12,9 +12,19 @@ namespace ST
 
         const Math::Matrix4D& GetView() const;
         const Math::Matrix4D& GetProjection() const;
+
+        /** Whether any part of the box, given in the world space, may be
+            in the view. Boxes near the edges of the frustum may pass
+            even if they are out of it.
+        */
+        bool IsBoxVisible(const Math::Vector3D& min,
+                          const Math::Vector3D& max) const;
     private:
+        void updateFrustum();
+
         Math::Matrix4D view;
         Math::Matrix4D projection;
+        Math::Vector4D planes[6]; // Frustum planes facing inside.
     };
 }
 
@@ -0,0 +1,286 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "CompressedClip.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        // Three smallest components of a unit quaternion are within
+        // [-1/sqrt(2); 1/sqrt(2)], they are quantized to 15 bits and
+        // the top bits of the first two keep the index of the largest.
+        const float quat_range = 0.70710678f;
+        const float quat_steps = 32767.0f;
+        const float pos_steps  = 65535.0f;
+
+        void packQuaternion(const Quaternion& q, unsigned short* key)
+        {
+            float c[4] = { q.w, q.x, q.y, q.z };
+            int largest = 0;
+            for (int i = 1; i < 4; i++)
+                if (fabs(c[i]) > fabs(c[largest])) largest = i;
+
+            // q and -q are the same rotation, so the largest is positive.
+            float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+            for (int i = 0, k = 0; i < 4; i++)
+            {
+                if (i == largest) continue;
+                float v = (sign * c[i] / quat_range + 1.0f) * 0.5f;
+                v = max(0.0f, min(1.0f, v));
+                key[k++] = (unsigned short)(v * quat_steps + 0.5f);
+            }
+            key[0] |= (largest & 1) << 15;
+            key[1] |= (largest >> 1) << 15;
+        }
+
+        Quaternion unpackQuaternion(const unsigned short* key)
+        {
+            int largest = (key[0] >> 15) | (key[1] >> 15) << 1;
+
+            float c[4];
+            float sum = 0.0f;
+            for (int i = 0, k = 0; i < 4; i++)
+            {
+                if (i == largest) continue;
+                c[i] = ((key[k++] & 0x7fff) / quat_steps * 2.0f - 1.0f) *
+                       quat_range;
+                sum += c[i] * c[i];
+            }
+            c[largest] = sqrt(max(0.0f, 1.0f - sum));
+            return Quaternion(c[0], c[1], c[2], c[3]);
+        }
+
+        Quaternion nlerp(const Quaternion& a, const Quaternion& b, float t)
+        {
+            float sign = Quaternion::Dot(a, b) < 0.0f ? -1.0f : 1.0f;
+            Quaternion q(a.w + (sign * b.w - a.w) * t,
+                         a.x + (sign * b.x - a.x) * t,
+                         a.y + (sign * b.y - a.y) * t,
+                         a.z + (sign * b.z - a.z) * t);
+            q.Normalize();
+            return q;
+        }
+
+        /** Picks frames of the track that must be kept so that the
+            frames between them interpolate within the tolerance.
+        */
+        template <typename T, typename Lerp, typename Near>
+        void reduceKeys(const vector<T>& track, vector<int>& keys,
+                        Lerp lerp, Near near)
+        {
+            keys.assign(1, 0);
+
+            int last = track.size() - 1;
+            bool constant = true;
+            for (int f = 1; f <= last && constant; f++)
+                constant = near(track[0], track[f]);
+            if (constant) return;
+
+            // Extend the segment from 'start' while it stays close.
+            int start = 0;
+            for (int end = 2; end <= last; end++)
+            {
+                for (int f = start + 1; f < end; f++)
+                {
+                    float t = float(f - start) / (end - start);
+                    if (!near(lerp(track[start], track[end], t), track[f]))
+                    {
+                        start = end - 1;
+                        keys.push_back(start);
+                        break;
+                    }
+                }
+            }
+            keys.push_back(last);
+        }
+    }
+
+    CompressedClip::CompressedClip() : numFrames(0), numJoints(0)
+    {
+    }
+
+    void CompressedClip::Clear()
+    {
+        numFrames = numJoints = 0;
+        posTracks.clear();
+        rotTracks.clear();
+        posFrames.clear();
+        posKeys.clear();
+        rotFrames.clear();
+        rotKeys.clear();
+    }
+
+    void CompressedClip::Build(int frames, int joints,
+                               const vector<Vector3D>& positions,
+                               const vector<Quaternion>& orients,
+                               const Tolerance& tolerance)
+    {
+        if (frames > 65536)
+            throw runtime_error("Clip is too long to be compressed");
+
+        Clear();
+        numFrames = frames;
+        numJoints = joints;
+        if (numFrames < 1) return;
+
+        for (int j = 0; j < numJoints; j++)
+        {
+            addPositionTrack(positions, j, tolerance.position);
+            addRotationTrack(orients, j, tolerance.rotation);
+        }
+    }
+
+    void CompressedClip::addPositionTrack(const vector<Vector3D>& positions,
+                                          int joint, float tolerance)
+    {
+        vector<Vector3D> track(numFrames);
+        for (int f = 0; f < numFrames; f++)
+            track[f] = positions[f * numJoints + joint];
+
+        vector<int> keys;
+        reduceKeys(track, keys, Vector3D::Lerp,
+                   [tolerance](const Vector3D& a, const Vector3D& b)
+                   { return (a - b).Length() <= tolerance; });
+
+        // Keys are quantized within the range they take.
+        PositionTrack pt;
+        pt.first = posFrames.size();
+        pt.count = keys.size();
+        pt.min = pt.scale = track[keys[0]];
+        for (size_t k = 1; k < keys.size(); k++)
+            for (int c = 0; c < 3; c++)
+            {
+                pt.min[c] = min(pt.min[c], track[keys[k]][c]);
+                pt.scale[c] = max(pt.scale[c], track[keys[k]][c]);
+            }
+        for (int c = 0; c < 3; c++)
+            pt.scale[c] = (pt.scale[c] - pt.min[c]) / pos_steps;
+
+        for (size_t k = 0; k < keys.size(); k++)
+        {
+            posFrames.push_back(keys[k]);
+            for (int c = 0; c < 3; c++)
+            {
+                float v = pt.scale[c] > 0.0f ?
+                          (track[keys[k]][c] - pt.min[c]) / pt.scale[c] : 0.0f;
+                posKeys.push_back((unsigned short)min(v + 0.5f, pos_steps));
+            }
+        }
+        posTracks.push_back(pt);
+    }
+
+    void CompressedClip::addRotationTrack(const vector<Quaternion>& orients,
+                                          int joint, float tolerance)
+    {
+        vector<Quaternion> track(numFrames);
+        for (int f = 0; f < numFrames; f++)
+            track[f] = orients[f * numJoints + joint];
+
+        // Angle between rotations is twice the angle between quaternions.
+        float minCos = cos(tolerance * 0.5f);
+        vector<int> keys;
+        reduceKeys(track, keys, nlerp,
+                   [minCos](const Quaternion& a, const Quaternion& b)
+                   { return fabs(Quaternion::Dot(a, b)) >= minCos; });
+
+        RotationTrack rt;
+        rt.first = rotFrames.size();
+        rt.count = 0;
+        rt.constant = track[0];
+        if (keys.size() > 1)
+        {
+            rt.count = keys.size();
+            for (size_t k = 0; k < keys.size(); k++)
+            {
+                rotFrames.push_back(keys[k]);
+                rotKeys.resize(rotKeys.size() + 3);
+                packQuaternion(track[keys[k]], &rotKeys[rotKeys.size() - 3]);
+            }
+        }
+        rotTracks.push_back(rt);
+    }
+
+    int CompressedClip::findKey(const unsigned short* frames, int count,
+                                float frame)
+    {
+        int key = upper_bound(frames, frames + count, int(frame)) - frames - 1;
+        return max(key, 0);
+    }
+
+    void CompressedClip::Decode(float frame, int joint, Vector3D& pos,
+                                Quaternion& orient) const
+    {
+        const PositionTrack& pt = posTracks[joint];
+        const unsigned short* frames = &posFrames[pt.first];
+        int k = findKey(frames, pt.count, frame);
+
+        const unsigned short* key = &posKeys[3 * (pt.first + k)];
+        pos = Vector3D(pt.min[0] + key[0] * pt.scale[0],
+                       pt.min[1] + key[1] * pt.scale[1],
+                       pt.min[2] + key[2] * pt.scale[2]);
+        if (k + 1 < pt.count && frames[k] != frame)
+        {
+            key += 3;
+            Vector3D next(pt.min[0] + key[0] * pt.scale[0],
+                          pt.min[1] + key[1] * pt.scale[1],
+                          pt.min[2] + key[2] * pt.scale[2]);
+            float t = (frame - frames[k]) / (frames[k + 1] - frames[k]);
+            pos = Vector3D::Lerp(pos, next, t);
+        }
+
+        const RotationTrack& rt = rotTracks[joint];
+        if (rt.count == 0)
+        {
+            orient = rt.constant;
+            return;
+        }
+
+        frames = &rotFrames[rt.first];
+        k = findKey(frames, rt.count, frame);
+        orient = unpackQuaternion(&rotKeys[3 * (rt.first + k)]);
+        if (k + 1 < rt.count && frames[k] != frame)
+        {
+            Quaternion next = unpackQuaternion(&rotKeys[3 * (rt.first + k + 1)]);
+            float t = (frame - frames[k]) / (frames[k + 1] - frames[k]);
+            orient = nlerp(orient, next, t);
+        }
+
+        // Md5 files keep w negative, so do the decoded poses.
+        if (orient.w > 0.0f)
+            orient = Quaternion(-orient.w, -orient.x, -orient.y, -orient.z);
+    }
+
+    size_t CompressedClip::MemoryUsage() const
+    {
+        return sizeof(*this) +
+               posTracks.capacity() * sizeof(PositionTrack) +
+               rotTracks.capacity() * sizeof(RotationTrack) +
+               (posFrames.capacity() + posKeys.capacity() +
+                rotFrames.capacity() + rotKeys.capacity()) *
+               sizeof(unsigned short);
+    }
+
+    void CompressedClip::Write(CacheWriter& cache) const
+    {
+        cache.Write(numFrames);
+        cache.Write(numJoints);
+        cache.WriteArray(posTracks);
+        cache.WriteArray(rotTracks);
+        cache.WriteArray(posFrames);
+        cache.WriteArray(posKeys);
+        cache.WriteArray(rotFrames);
+        cache.WriteArray(rotKeys);
+    }
+
+    bool CompressedClip::Read(CacheReader& cache)
+    {
+        return cache.Read(numFrames) && cache.Read(numJoints) &&
+               cache.ReadArray(posTracks) && cache.ReadArray(rotTracks) &&
+               cache.ReadArray(posFrames) && cache.ReadArray(posKeys) &&
+               cache.ReadArray(rotFrames) && cache.ReadArray(rotKeys);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef COMPRESSEDCLIP_H_INCLUDED
+#define COMPRESSEDCLIP_H_INCLUDED
+
+#include <vector>
+#include "BinaryCache.h"
+#include "math/Vector3D.h"
+#include "math/Quaternion.h"
+
+namespace ST
+{
+    /** Joint poses of an animation clip stored in a lossy compact form.
+        Every joint has a position and a rotation track of its local
+        pose. Only keys that can't be interpolated from their neighbours
+        within the tolerance are kept. Positions are quantized to 16 bits
+        per component within the range of the track, rotations are stored
+        as the three smallest components of the quaternion (6 bytes).
+        Tracks that don't change are stored exactly.
+    */
+    class CompressedClip
+    {
+    public:
+        /** Error allowed for interpolated keys. Quantization adds
+            about 1/65536 of the track range to positions and 2e-5
+            to the quaternion components.
+        */
+        struct Tolerance
+        {
+            Tolerance() : position(0.001f), rotation(0.0005f) {}
+
+            float position; //!< Distance in model units.
+            float rotation; //!< Angle in radians.
+        };
+
+        CompressedClip();
+
+        /** Compresses local poses given frame by frame: joint 'j' of
+            frame 'f' is at [f * numJoints + j]. Clips longer than
+            65536 frames aren't supported.
+        */
+        void Build(int numFrames, int numJoints,
+                   const std::vector<Math::Vector3D>& positions,
+                   const std::vector<Math::Quaternion>& orients,
+                   const Tolerance& tolerance = Tolerance());
+        void Clear();
+
+        int NumFrames() const { return numFrames; }
+        int NumJoints() const { return numJoints; }
+
+        /** Local pose of the joint at the frame, which may fall
+            between two frames of the clip.
+        */
+        void Decode(float frame, int joint, Math::Vector3D& pos,
+                    Math::Quaternion& orient) const;
+
+        /** Bytes taken by the tracks and their keys. */
+        size_t MemoryUsage() const;
+
+        void Write(CacheWriter& cache) const;
+        bool Read(CacheReader& cache);
+
+    private:
+        struct PositionTrack
+        {
+            int first;            //!< First key in posFrames.
+            int count;
+            Math::Vector3D min;   //!< Value of the key 0.
+            Math::Vector3D scale; //!< Value of one quantization step.
+        };
+        struct RotationTrack
+        {
+            int first;                 //!< First key in rotFrames.
+            int count;                 //!< Zero if the track is constant.
+            Math::Quaternion constant;
+        };
+
+        void addPositionTrack(const std::vector<Math::Vector3D>& positions,
+                              int joint, float tolerance);
+        void addRotationTrack(const std::vector<Math::Quaternion>& orients,
+                              int joint, float tolerance);
+        static int findKey(const unsigned short* frames, int count,
+                           float frame);
+
+        int numFrames;
+        int numJoints;
+        std::vector<PositionTrack>  posTracks; //!< One per joint.
+        std::vector<RotationTrack>  rotTracks; //!< One per joint.
+        std::vector<unsigned short> posFrames; //!< Frames of position keys.
+        std::vector<unsigned short> posKeys;   //!< 3 values per key.
+        std::vector<unsigned short> rotFrames; //!< Frames of rotation keys.
+        std::vector<unsigned short> rotKeys;   //!< 3 values per key.
+    };
+}
+
+#endif // COMPRESSEDCLIP_H_INCLUDED
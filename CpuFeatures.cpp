@@ -0,0 +1,28 @@
+#include "CpuFeatures.h"
+
+namespace ST
+{
+#ifdef ST_X86_KERNELS
+    bool CpuHasSSE41()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.1");
+    }
+
+    bool CpuHasAVX2()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+#else
+    bool CpuHasSSE41()
+    {
+        return false;
+    }
+
+    bool CpuHasAVX2()
+    {
+        return false;
+    }
+#endif
+}
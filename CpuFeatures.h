@@ -0,0 +1,19 @@
+#ifndef CPUFEATURES_H_INCLUDED
+#define CPUFEATURES_H_INCLUDED
+
+// Kernels for x86 instruction sets are compiled with GCC's target
+// attributes and chosen at run time, so the rest of the project
+// is still built for the base instruction set.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define ST_X86_KERNELS 1
+#endif
+
+namespace ST
+{
+    // Instruction sets supported by the CPU the program runs on.
+    // Both return false where ST_X86_KERNELS is not defined.
+    bool CpuHasSSE41();
+    bool CpuHasAVX2(); // AVX2 together with FMA.
+}
+
+#endif // CPUFEATURES_H_INCLUDED
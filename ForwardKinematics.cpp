@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <stdexcept>
+#include "Adjacency.h"
+#include "ForwardKinematics.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    ForwardKinematics::ForwardKinematics()
+    {
+    }
+
+    void ForwardKinematics::Build(const vector<int>& parents)
+    {
+        int n = parents.size();
+        vector<int> from, to;
+        vector<int> stack;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            if (parents[i] < -1 || parents[i] >= n)
+                throw runtime_error("Parent of a joint isn't in the skeleton");
+            if (parents[i] < 0) stack.push_back(i);
+            else
+            {
+                from.push_back(parents[i]);
+                to.push_back(i);
+            }
+        }
+        Adjacency children;
+        children.Build(n, from, to);
+
+        // Depth-first order puts every subtree in one run of slots.
+        // Children were added last first, so they come out in order.
+        order.clear();
+        slot.assign(n, -1);
+        while (!stack.empty())
+        {
+            int i = stack.back();
+            stack.pop_back();
+            slot[i] = order.size();
+            order.push_back(i);
+            stack.insert(stack.end(), children.Begin(i), children.End(i));
+        }
+        if ((int)order.size() != n)
+            throw runtime_error("Joints of the skeleton form a cycle");
+
+        parent.resize(n);
+        end.resize(n);
+        for (int s = 0; s < n; s++)
+        {
+            int p = parents[order[s]];
+            parent[s] = p < 0 ? -1 : slot[p];
+            end[s] = s + 1;
+        }
+        for (int s = n - 1; s >= 0; s--)
+        {
+            if (parent[s] >= 0)
+                end[parent[s]] = max(end[parent[s]], end[s]);
+        }
+
+        localPos.assign(n, Vector3D());
+        localOrient.assign(n, Quaternion(1.0f, 0.0f, 0.0f, 0.0f));
+        pos.assign(n, Vector3D());
+        orient.assign(n, Quaternion(1.0f, 0.0f, 0.0f, 0.0f));
+        dirty.assign(n, 0);
+        dirtyRoots.clear();
+        changed.clear();
+    }
+
+    void ForwardKinematics::Clear()
+    {
+        Build(vector<int>());
+    }
+
+    void ForwardKinematics::SetLocal(size_t joint, const Vector3D& pos,
+                                     const Quaternion& orient)
+    {
+        int s = slot[joint];
+        localPos[s] = pos;
+        localOrient[s] = orient;
+        localOrient[s].Normalize();
+        markDirty(s);
+    }
+
+    void ForwardKinematics::SetLocalOrient(size_t joint,
+                                           const Quaternion& orient)
+    {
+        int s = slot[joint];
+        localOrient[s] = orient;
+        localOrient[s].Normalize();
+        markDirty(s);
+    }
+
+    void ForwardKinematics::SetPose(size_t joint, const Vector3D& pos,
+                                    const Quaternion& orient)
+    {
+        int s = slot[joint];
+        this->pos[s] = pos;
+        this->orient[s] = orient;
+        this->orient[s].Normalize();
+
+        int p = parent[s];
+        if (p < 0)
+        {
+            localPos[s] = pos;
+            localOrient[s] = this->orient[s];
+        }
+        else
+        {
+            Quaternion space = this->orient[p].Conjugate();
+            localPos[s] = space.Rotate(pos - this->pos[p]);
+            localOrient[s] = space * this->orient[s];
+            localOrient[s].Normalize();
+        }
+        markDirty(s);
+    }
+
+    void ForwardKinematics::markDirty(int s)
+    {
+        if (dirty[s]) return;
+        dirty[s] = 1;
+        dirtyRoots.push_back(s);
+    }
+
+    size_t ForwardKinematics::Update()
+    {
+        changed.clear();
+
+        // Subtrees of dirty joints inside a dirty subtree
+        // are recomputed with it.
+        sort(dirtyRoots.begin(), dirtyRoots.end());
+        int done = 0;
+        for (size_t r = 0; r < dirtyRoots.size(); r++)
+        {
+            int root = dirtyRoots[r];
+            dirty[root] = 0;
+            if (root < done) continue;
+
+            for (int s = root; s < end[root]; s++)
+            {
+                int p = parent[s];
+                if (p < 0)
+                {
+                    pos[s] = localPos[s];
+                    orient[s] = localOrient[s];
+                }
+                else
+                {
+                    pos[s] = pos[p] + orient[p].Rotate(localPos[s]);
+                    orient[s] = orient[p] * localOrient[s];
+                }
+                changed.push_back(order[s]);
+            }
+            done = end[root];
+        }
+
+        dirtyRoots.clear();
+        return changed.size();
+    }
+}
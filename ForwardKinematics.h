@@ -0,0 +1,91 @@
+#ifndef FORWARDKINEMATICS_H_INCLUDED
+#define FORWARDKINEMATICS_H_INCLUDED
+
+#include <vector>
+#include "math/Vector3D.h"
+#include "math/Quaternion.h"
+
+namespace ST
+{
+    /** Local transforms of the joints, relative to their parents, and
+        the object-space transforms computed from them.
+        Joints are kept in flat arrays in depth-first order, so each
+        subtree is one run of joints and a joint only needs the parent
+        before it. Editing a local transform marks its subtree dirty,
+        and Update() recomputes the dirty subtrees only.
+
+        Joints are addressed by their indices in the skeleton.
+    */
+    class ForwardKinematics
+    {
+    public:
+        ForwardKinematics();
+
+        /** Takes the parent of each joint, -1 for roots. Joints start
+            at the origin. Throws if a parent isn't in the skeleton
+            or joints form a cycle.
+        */
+        void Build(const std::vector<int>& parents);
+        void Clear();
+
+        size_t GetNumJoints() const { return order.size(); }
+
+        /** Sets the joint relative to its parent, its children follow
+            at the next Update().
+        */
+        void SetLocal(size_t joint, const Math::Vector3D& pos,
+                      const Math::Quaternion& orient);
+        void SetLocalOrient(size_t joint, const Math::Quaternion& orient);
+        const Math::Vector3D& GetLocalPos(size_t joint) const
+        {
+            return localPos[slot[joint]];
+        }
+        const Math::Quaternion& GetLocalOrient(size_t joint) const
+        {
+            return localOrient[slot[joint]];
+        }
+
+        /** Sets the object-space pose of the joint, e.g. after IKSolver
+            wrote it, and takes its local transform from the parent,
+            which must be up to date. Its children follow at the next
+            Update().
+        */
+        void SetPose(size_t joint, const Math::Vector3D& pos,
+                     const Math::Quaternion& orient);
+        /** Object-space transforms as of the last Update(). */
+        const Math::Vector3D& GetPos(size_t joint) const
+        {
+            return pos[slot[joint]];
+        }
+        const Math::Quaternion& GetOrient(size_t joint) const
+        {
+            return orient[slot[joint]];
+        }
+
+        /** Recomputes the subtrees of the joints edited since the last
+            Update() and returns how many joints it recomputed.
+        */
+        size_t Update();
+        /** Joints recomputed by the last Update(). */
+        const std::vector<int>& GetChanged() const { return changed; }
+
+    private:
+        void markDirty(int s);
+
+        std::vector<int> order;   // Joint in each slot, depth-first.
+        std::vector<int> slot;    // Slot of each joint.
+        std::vector<int> parent;  // Slot of the parent, -1 for roots.
+        std::vector<int> end;     // Slot after the subtree of each slot.
+
+        std::vector<Math::Vector3D>   localPos;    // Offset from the parent.
+        std::vector<Math::Quaternion> localOrient; // Relative to the parent.
+        std::vector<Math::Vector3D>   pos;         // Object space.
+        std::vector<Math::Quaternion> orient;
+
+        std::vector<char> dirty;       // Slots whose subtree must update.
+        std::vector<int>  dirtyRoots;  // Those slots, in no order.
+        std::vector<int>  changed;     // Joints of the last Update().
+    };
+}
+
+#endif // FORWARDKINEMATICS_H_INCLUDED
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include "IKBatch.h"
+
+using namespace std;
+
+namespace ST
+{
+    IKBatch::IKBatch()
+        : grouped(false), numShares(0), jobPool(0)
+    {
+    }
+
+    void IKBatch::SetSolver(const IKSolver& solver)
+    {
+        settings = solver;
+        solvers.clear();
+    }
+
+    void IKBatch::SetJobPool(JobPool* pool)
+    {
+        jobPool = pool;
+    }
+
+    size_t IKBatch::Add(MD5Model& model, IKChain& chain,
+                        const IKTarget& target, const IKLimits* limits)
+    {
+        // Solvers throw on empty chains, but only after the models
+        // before them are solved.
+        if (chain.GetNumJoints() == 0)
+            throw runtime_error("Cannot solve an empty chain");
+
+        Job job = { &model, &chain, target, limits, false };
+        jobs.push_back(job);
+        grouped = false;
+        return jobs.size() - 1;
+    }
+
+    void IKBatch::SetTarget(size_t job, const IKTarget& target)
+    {
+        jobs[job].target = target;
+    }
+
+    void IKBatch::Clear()
+    {
+        jobs.clear();
+        grouped = false;
+    }
+
+    size_t IKBatch::Solve()
+    {
+        if (jobs.empty()) return 0;
+        if (!grouped) groupModels();
+
+        // A pool of one thread would only add the queuing overhead,
+        // and a job of the pool without a model would have nothing to do.
+        size_t numModels = groups.size() - 1;
+        size_t numThreads = 1;
+        if (jobPool && jobPool->NumThreads() > 1)
+            numThreads = min(jobPool->NumThreads(), numModels);
+
+        while (solvers.size() < numThreads)
+            solvers.push_back(settings);
+
+        if (numThreads == 1)
+        {
+            for (size_t g = 0; g < numModels; g++)
+                solveModel(solvers[0], g);
+        }
+        else
+        {
+            if (numShares < numThreads)
+            {
+                shares.reset(new Share[numThreads]);
+                numShares = numThreads;
+            }
+
+            for (size_t t = 0; t < numThreads; t++)
+            {
+                shares[t].next = numModels * t / numThreads;
+                shares[t].end = numModels * (t + 1) / numThreads;
+            }
+            for (size_t t = 0; t < numThreads; t++)
+                jobPool->Add([this, t, numThreads]
+                             { solveShares(t, numThreads); });
+            jobPool->Wait();
+        }
+
+        size_t numReached = 0;
+        for (size_t i = 0; i < jobs.size(); i++)
+            numReached += jobs[i].reached;
+        return numReached;
+    }
+
+    //-- Sorts the jobs by the model, keeping their order within one --//
+    void IKBatch::groupModels()
+    {
+        order.resize(jobs.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+
+        less<const MD5Model*> before;
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                    { return before(jobs[a].model, jobs[b].model); });
+
+        groups.clear();
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            if (i == 0 || jobs[order[i]].model != jobs[order[i - 1]].model)
+                groups.push_back(i);
+        }
+        groups.push_back(order.size());
+        grouped = true;
+    }
+
+    void IKBatch::solveShares(size_t own, size_t numThreads)
+    {
+        // Own share first, then what the others haven't taken yet.
+        // Taking a model is one atomic increment, for the owner
+        // of the share and the others alike.
+        for (size_t s = 0; s < numThreads; s++)
+        {
+            Share& share = shares[(own + s) % numThreads];
+            for (size_t g = share.next++; g < share.end; g = share.next++)
+                solveModel(solvers[own], g);
+        }
+    }
+
+    void IKBatch::solveModel(IKSolver& solver, size_t group)
+    {
+        for (size_t i = groups[group]; i < groups[group + 1]; i++)
+        {
+            Job& job = jobs[order[i]];
+            MD5Model& model = *job.model;
+            solver.SetLimits(job.limits);
+
+            // Skeletons of animated models are their bind poses,
+            // what they play is skinned from their poses.
+            if (model.IsAnimated())
+            {
+                job.reached = solver.Solve(*job.chain, job.target,
+                                           model.GetPose());
+                model.InvalidatePose(job.chain->GetRoot());
+            }
+            else
+            {
+                job.reached = solver.Solve(*job.chain, job.target,
+                                           model.GetSkeleton());
+                model.InvalidateJoint(job.chain->GetRoot());
+            }
+        }
+    }
+}
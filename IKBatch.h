@@ -0,0 +1,102 @@
+#ifndef IKBATCH_H_INCLUDED
+#define IKBATCH_H_INCLUDED
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include "JobPool.h"
+#include "IKSolver.h"
+
+namespace ST
+{
+    /** Chains of many models solved together, e.g. the feet and hands
+        of every character of the scene once a frame.
+        Jobs of one model are solved in the order they were added,
+        so a spine goes before the arms that hang from it, and models
+        are solved in parallel by the jobs of the pool. Each job of
+        the pool has its own solver, whose matrices are reused from
+        frame to frame, and takes models from its own share of them
+        first and from the shares of the others when it runs out.
+
+        Animated models are solved on the pose of their last Animate()
+        and the solved subtrees are invalidated in it, so Skin() skins
+        them with the rest of the pose:
+
+            for each model: model.Animate(deltaTimeSec);
+            batch.Solve();
+            for each model: model.Skin();
+
+        Models without animation are solved on their skeletons,
+        UpdateJoints() of each model then skins them.
+    */
+    class IKBatch
+    {
+    public:
+        IKBatch();
+
+        /** Method, tolerance and the other settings of every solve
+            are copied from 'solver'. Its limits are replaced by those
+            of the jobs.
+        */
+        void SetSolver(const IKSolver& solver);
+        /** Models are solved by the jobs of 'pool' if it isn't null.
+            The pool must outlive the batch or be reset to null.
+        */
+        void SetJobPool(JobPool* pool);
+
+        /** Adds the job and returns its index. The model, the chain and
+            the limits must outlive the batch or Clear(), the chain
+            must be of the skeleton of the model and belong to one job
+            only. Throws if the chain is empty.
+        */
+        size_t Add(MD5Model& model, IKChain& chain, const IKTarget& target,
+                   const IKLimits* limits = 0);
+        /** Moves the target of the job for the next Solve(). */
+        void SetTarget(size_t job, const IKTarget& target);
+        void Clear();
+
+        size_t GetNumJobs() const { return jobs.size(); }
+
+        /** Solves every job and returns how many reached the target. */
+        size_t Solve();
+        /** Whether the job reached the target at the last Solve(). */
+        bool IsReached(size_t job) const { return jobs[job].reached; }
+
+    private:
+        IKBatch(const IKBatch&);
+        IKBatch& operator= (const IKBatch&);
+
+        struct Job
+        {
+            MD5Model*       model;
+            IKChain*        chain;
+            IKTarget        target;
+            const IKLimits* limits;
+            bool            reached;
+        };
+
+        /** Models [next; end) of the share of one job of the pool. */
+        struct Share
+        {
+            std::atomic<size_t> next;
+            size_t              end;
+            char                padding[64]; // Keeps shares off one line.
+        };
+
+        void groupModels();
+        void solveShares(size_t own, size_t numThreads);
+        void solveModel(IKSolver& solver, size_t group);
+
+        std::vector<Job>         jobs;
+        bool                     grouped;   // Whether 'order' is up to date.
+        std::vector<size_t>      order;     // Jobs sorted by the model.
+        std::vector<size_t>      groups;    // Of each model in 'order'.
+        std::vector<IKSolver>    solvers;   // One for each job of the pool.
+        std::unique_ptr<Share[]> shares;    // Of each job of the pool.
+        size_t                   numShares;
+        IKSolver                 settings;
+        JobPool*                 jobPool;
+    };
+}
+
+#endif // IKBATCH_H_INCLUDED
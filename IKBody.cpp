@@ -0,0 +1,546 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "IKBody.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        // Largest angle a joint turns by in one iteration, radians.
+        const float max_turn = 0.5f;
+        // Damping of the null space, which must hold the motion of
+        // the priorities above even where the step is damped.
+        const float null_damping = 0.01f;
+        // Most iterations that hold the first priority after the others,
+        // each damped step takes back about a half of its error.
+        const int settle_iterations = 20;
+
+        /** Rotation by the angle |v| around v. */
+        Quaternion expMap(const Vector3D& v)
+        {
+            float angle = v.Length();
+            if (angle < 1e-6f)
+            {
+                Quaternion q(1.0f, v[0] * 0.5f, v[1] * 0.5f, v[2] * 0.5f);
+                q.Normalize();
+                return q;
+            }
+            return Quaternion(angle, v);
+        }
+
+        /** Axis of the rotation scaled by its angle, the shorter way. */
+        Vector3D logMap(const Quaternion& q)
+        {
+            float sign = q.w < 0.0f ? -1.0f : 1.0f;
+            Vector3D axis(sign * q.x, sign * q.y, sign * q.z);
+            float sinHalf = axis.Length();
+            if (sinHalf < 1e-6f)
+                return axis * 2.0f;
+            return axis * (2.0f * atan2(sinHalf, sign * q.w) / sinHalf);
+        }
+    }
+
+    IKBody::IKBody()
+        : sorted(false), root(-1), numRows(0), numColumns(0),
+          rootMotion(false), damping(1.0f), posTolerance(0.01f),
+          rotTolerance(0.001f), maxIterations(100), iterations(0), limits(0)
+    {
+    }
+
+    size_t IKBody::AddTask(const IKChain& chain, const IKTarget& target,
+                           int priority)
+    {
+        size_t index = addTask(chain, priority);
+        tasks[index].target = target;
+        return index;
+    }
+
+    size_t IKBody::AddLook(const IKChain& chain, const Vector3D& axis,
+                           const Vector3D& point, int priority)
+    {
+        if (axis.Length() == 0.0f)
+            throw runtime_error("Look task has no axis");
+
+        size_t index = addTask(chain, priority);
+        Task& task = tasks[index];
+        task.target = IKTarget(point);
+        task.look = true;
+        task.axis = Vector3D::Normalize(axis);
+        return index;
+    }
+
+    size_t IKBody::addTask(const IKChain& chain, int priority)
+    {
+        if (chain.GetNumJoints() == 0)
+            throw runtime_error("Cannot solve an empty chain");
+        if (root >= 0 && chain.GetRoot() != root)
+            throw runtime_error("Tasks of the body must share the root");
+
+        root = chain.GetRoot();
+        Task task;
+        for (size_t i = 0; i < chain.GetNumJoints(); i++)
+            task.chain.push_back(chain.GetJoint(i));
+        task.look = false;
+        task.priority = priority;
+        task.weight = 1.0f;
+        task.reach = 0.0f;
+        task.firstRow = task.numRows = 0;
+        task.error = 0.0f;
+        task.reached = false;
+
+        tasks.push_back(task);
+        sorted = false;
+        return tasks.size() - 1;
+    }
+
+    void IKBody::SetTarget(size_t task, const IKTarget& target)
+    {
+        // The orientation takes rows of its own.
+        Task& t = tasks[task];
+        if (!t.look && t.target.hasOrient != target.hasOrient)
+            sorted = false;
+        t.target = target;
+    }
+
+    void IKBody::SetLookAt(size_t task, const Vector3D& point)
+    {
+        tasks[task].target.pos = point;
+    }
+
+    void IKBody::SetWeight(size_t task, float weight)
+    {
+        tasks[task].weight = weight;
+    }
+
+    void IKBody::Clear()
+    {
+        tasks.clear();
+        root = -1;
+        sorted = false;
+    }
+
+    void IKBody::SetRootMotion(bool rootMotion)
+    {
+        this->rootMotion = rootMotion;
+        sorted = false;
+    }
+
+    void IKBody::SetDamping(float damping)
+    {
+        this->damping = damping;
+    }
+
+    void IKBody::SetTolerance(float position, float rotation)
+    {
+        posTolerance = position;
+        rotTolerance = rotation;
+    }
+
+    void IKBody::SetMaxIterations(int iterations)
+    {
+        maxIterations = iterations;
+    }
+
+    void IKBody::SetLimits(const IKLimits* limits)
+    {
+        this->limits = limits;
+    }
+
+    bool IKBody::Solve(MD5Model::JointList& joints)
+    {
+        if (tasks.empty()) return true;
+        if (!sorted || column.size() != joints.size())
+        {
+            column.assign(joints.size(), -1);
+            sortTasks();
+        }
+
+        loadPose(joints);
+        iterations = 0;
+
+        bool reached = measureErrors();
+        for (; !reached && iterations < maxIterations; iterations++)
+        {
+            buildJacobian();
+            solveStep(levels.size() - 1);
+            applyStep();
+            reached = measureErrors();
+        }
+
+        // Steps of the lower priorities move the tasks above off their
+        // targets at the second order, so if the lower ones were left
+        // unreached, the last iterations hold just the first priority.
+        for (int i = 0; i < settle_iterations && !levelReached(0); i++)
+        {
+            buildJacobian();
+            solveStep(1);
+            applyStep();
+            reached = measureErrors();
+            iterations++;
+        }
+
+        storePose(joints);
+        return reached;
+    }
+
+    //-- Orders the rows by the priority and numbers the columns --//
+    void IKBody::sortTasks()
+    {
+        order.resize(tasks.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        stable_sort(order.begin(), order.end(), [this](size_t a, size_t b)
+                    { return tasks[a].priority < tasks[b].priority; });
+
+        levels.clear();
+        numRows = 0;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            Task& task = tasks[order[i]];
+            if (i == 0 || task.priority != tasks[order[i - 1]].priority)
+                levels.push_back(i);
+
+            task.firstRow = numRows;
+            task.numRows = task.look || !task.target.hasOrient ? 3 : 6;
+            numRows += task.numRows;
+        }
+        levels.push_back(order.size());
+
+        // Joints shared by the chains share their columns,
+        // those off every chain get none.
+        numColumns = rootMotion ? 3 : 0;
+        turning.clear();
+        for (size_t t = 0; t < tasks.size(); t++)
+        {
+            Task& task = tasks[t];
+            task.columns.clear();
+            if (rootMotion) task.columns.push_back(0);
+
+            for (size_t i = 0; i < task.chain.size(); i++)
+            {
+                int joint = task.chain[i];
+                if (column[joint] < 0)
+                {
+                    column[joint] = numColumns;
+                    numColumns += 3;
+                    turning.push_back(joint);
+                }
+                task.columns.push_back(column[joint]);
+            }
+        }
+        sorted = true;
+    }
+
+    void IKBody::loadPose(const MD5Model::JointList& joints)
+    {
+        size_t n = joints.size();
+        localPos.resize(n);
+        localOrient.resize(n);
+        pos.resize(n);
+        orient.resize(n);
+        below.assign(n, false);
+        parents.resize(n);
+
+        const MD5Model::Joint& first = joints[root];
+        parentPos = first.parentID >= 0 ? joints[first.parentID].pos :
+                                          Vector3D();
+        parentOrient = first.parentID >= 0 ?
+                       joints[first.parentID].orient :
+                       Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+        parentOrient.Normalize();
+
+        // Parents go before their children. Orientations are normalized,
+        // as the rounding of a pose solved again and again would make
+        // them grow down the joints off the chains.
+        for (size_t i = root; i < n; i++)
+        {
+            const MD5Model::Joint& joint = joints[i];
+            int parent = joint.parentID;
+            if ((int)i != root && (parent < 0 || !below[parent]))
+                continue;
+
+            below[i] = true;
+            parents[i] = parent;
+            pos[i] = joint.pos;
+            orient[i] = joint.orient;
+            orient[i].Normalize();
+
+            bool top = (int)i == root;
+            const Vector3D& origin = top ? parentPos : pos[parent];
+            Quaternion space = top ? parentOrient.Conjugate() :
+                                     orient[parent].Conjugate();
+            localPos[i] = space.Rotate(pos[i] - origin);
+            localOrient[i] = space * orient[i];
+        }
+
+        for (size_t t = 0; t < tasks.size(); t++)
+        {
+            Task& task = tasks[t];
+            task.reach = 0.0f;
+            for (size_t i = 1; i < task.chain.size(); i++)
+                task.reach += localPos[task.chain[i]].Length();
+        }
+    }
+
+    bool IKBody::measureErrors()
+    {
+        residual.resize(numRows);
+
+        bool reached = true;
+        for (size_t t = 0; t < tasks.size(); t++)
+        {
+            Task& task = tasks[t];
+            const IKTarget& target = task.target;
+            int end = task.chain.back();
+            float pull = 0.0f;
+
+            if (task.look)
+            {
+                // Axis turns the shortest way to the point.
+                Vector3D axis = orient[end].Rotate(task.axis);
+                Vector3D dir = target.pos - pos[end];
+                Vector3D normal = Vector3D::Cross(axis, dir);
+                float angle = atan2(normal.Length(), axis.Dot(dir));
+                Vector3D dr = normal.Length() > 1e-6f ?
+                              normal * (angle / normal.Length()) :
+                              Vector3D();
+                residual.segment<3>(task.firstRow) << dr[0], dr[1], dr[2];
+                task.reached = angle <= rotTolerance;
+            }
+            else
+            {
+                Vector3D dp = target.pos - pos[end];
+                residual.segment<3>(task.firstRow) << dp[0], dp[1], dp[2];
+                task.reached = dp.Length() <= posTolerance;
+                pull = dp.Length();
+
+                if (target.hasOrient)
+                {
+                    Vector3D dr = logMap(target.orient *
+                                         orient[end].Conjugate());
+                    residual.segment<3>(task.firstRow + 3)
+                        << dr[0], dr[1], dr[2];
+                    residual.segment<3>(task.firstRow + 3) *=
+                        target.orientWeight;
+                    task.reached = task.reached &&
+                                   dr.Length() <= rotTolerance;
+                }
+            }
+
+            task.error = residual.segment(task.firstRow, task.numRows).norm();
+            reached = reached && task.reached;
+
+            // Far targets are pulled at most by half of the chain at once,
+            // as in IKSolver, then the rows take the weight of the task.
+            if (pull > 0.5f * task.reach && task.reach > 0.0f)
+                residual.segment<3>(task.firstRow) *= 0.5f * task.reach / pull;
+            residual.segment(task.firstRow, task.numRows) *= task.weight;
+        }
+        return reached;
+    }
+
+    void IKBody::buildJacobian()
+    {
+        size_t width = 0;
+        for (size_t t = 0; t < tasks.size(); t++)
+            width = max(width, tasks[t].columns.size());
+        jacobian.setZero(numRows, 3 * width);
+
+        for (size_t t = 0; t < tasks.size(); t++)
+        {
+            const Task& task = tasks[t];
+            size_t row = task.firstRow;
+            size_t block = 0;
+            int end = task.chain.back();
+
+            if (rootMotion)
+            {
+                // Moving the root moves every end with it.
+                if (!task.look)
+                    jacobian.block<3, 3>(row, 0).setIdentity();
+                block++;
+            }
+
+            // Turning joint i by w moves the end by w x (end - p[i])
+            // and turns it by w. A look only turns by the part of w
+            // across its axis, turns around the axis don't change
+            // where it points.
+            Vector3D axis = orient[end].Rotate(task.axis);
+            Eigen::Vector3f a(axis[0], axis[1], axis[2]);
+            Eigen::Matrix3f across = Eigen::Matrix3f::Identity() -
+                                     a * a.transpose();
+            for (size_t i = 0; i < task.chain.size(); i++, block++)
+            {
+                size_t col = 3 * block;
+                if (task.look)
+                {
+                    jacobian.block<3, 3>(row, col) = across;
+                    continue;
+                }
+
+                Vector3D r = pos[end] - pos[task.chain[i]];
+                jacobian.block<3, 3>(row, col) <<
+                    0.0f,  r[2], -r[1],
+                   -r[2],  0.0f,  r[0],
+                    r[1], -r[0],  0.0f;
+
+                if (task.target.hasOrient)
+                {
+                    jacobian.block<3, 3>(row + 3, col).setIdentity();
+                    jacobian.block<3, 3>(row + 3, col) *=
+                        task.target.orientWeight;
+                }
+            }
+
+            jacobian.block(row, 0, task.numRows, 3 * block) *= task.weight;
+        }
+    }
+
+    bool IKBody::levelReached(size_t level) const
+    {
+        for (size_t i = levels[level]; i < levels[level + 1]; i++)
+        {
+            if (!tasks[order[i]].reached)
+                return false;
+        }
+        return true;
+    }
+
+    void IKBody::solveStep(size_t numLevels)
+    {
+        // Each priority takes the least motion that reduces the residual
+        // the priorities above leave, within their null space N:
+        // A = J * N, the step grows by A^T * (A * A^T + d^2 * I)^-1 * e
+        // and N loses the motion A can make, W^T * W for W = L^-1 * A,
+        // where L * L^T = A * A^T, but for a much smaller damping.
+        // So N = I - B^T * B, for B the rows W of the priorities above,
+        // is never formed.
+        step.setZero(numColumns);
+        size_t numBasis = 0;
+        if (numLevels > 1)
+            basis.resize(numRows, numColumns);
+
+        for (size_t l = 0; l < numLevels; l++)
+        {
+            projectLevel(levels[l], levels[l + 1], numBasis);
+
+            normal.noalias() = projected * projected.transpose();
+            normal.diagonal().array() += damping * damping;
+            cholesky.compute(normal);
+            dual = cholesky.solve(remaining);
+            step.noalias() += projected.transpose() * dual;
+
+            if (l + 1 < numLevels)
+            {
+                normal.diagonal().array() +=
+                    null_damping * null_damping - damping * damping;
+                cholesky.compute(normal);
+                cholesky.matrixL().solveInPlace(projected);
+                basis.middleRows(numBasis, projected.rows()) = projected;
+                numBasis += projected.rows();
+            }
+        }
+
+        // Near singular poses tiny errors ask for big turns, which
+        // the linearization doesn't hold for, so they are scaled down.
+        float largest = 0.0f;
+        for (size_t i = rootMotion ? 3 : 0; i < numColumns; i += 3)
+            largest = max(largest, step.segment<3>(i).norm());
+        if (largest > max_turn)
+            step *= max_turn / largest;
+    }
+
+    //-- Rows of tasks [first; last) of 'order' in the null space --//
+    void IKBody::projectLevel(size_t first, size_t last, size_t numBasis)
+    {
+        size_t firstRow = tasks[order[first]].firstRow;
+        const Task& end = tasks[order[last - 1]];
+        size_t rows = end.firstRow + end.numRows - firstRow;
+
+        // Only the blocks of the chains are multiplied, the Jacobian
+        // has zeros for the joints off them.
+        projected.setZero(rows, numColumns);
+        overlap.setZero(rows, numBasis);
+        remaining = residual.segment(firstRow, rows);
+        for (size_t i = first; i < last; i++)
+        {
+            const Task& task = tasks[order[i]];
+            size_t row = task.firstRow - firstRow;
+            for (size_t b = 0; b < task.columns.size(); b++)
+            {
+                // Products of a few rows are too small for the blocked
+                // kernels of Eigen, which would allocate for each.
+                int col = task.columns[b];
+                Eigen::Block<Eigen::MatrixXf, Eigen::Dynamic, 3> block(
+                    jacobian, task.firstRow, 3 * b, task.numRows, 3);
+
+                projected.block(row, col, task.numRows, 3) = block;
+                remaining.segment(row, task.numRows) -=
+                    block.lazyProduct(step.segment<3>(col));
+                if (numBasis > 0)
+                    overlap.middleRows(row, task.numRows) +=
+                        block.lazyProduct(basis.block(0, col, numBasis, 3)
+                                          .transpose());
+            }
+        }
+
+        // J * N = J - (J * B^T) * B
+        if (numBasis > 0)
+            projected.noalias() -= overlap * basis.topRows(numBasis);
+    }
+
+    void IKBody::applyStep()
+    {
+        if (rootMotion)
+        {
+            Vector3D move(step[0], step[1], step[2]);
+            localPos[root] += parentOrient.Conjugate().Rotate(move);
+        }
+
+        // Steps are angular velocities in the object space, so each joint
+        // turns in the space its parent had when the Jacobian was built.
+        for (size_t i = 0; i < turning.size(); i++)
+        {
+            int joint = turning[i];
+            int col = column[joint];
+            Vector3D w(step[col], step[col + 1], step[col + 2]);
+            const Quaternion& parent = joint == root ? parentOrient :
+                                       orient[parents[joint]];
+            localOrient[joint] = parent.Conjugate() * expMap(w) *
+                                 orient[joint];
+            localOrient[joint].Normalize();
+            if (limits)
+                limits->Project(joint, localOrient[joint]);
+        }
+        forwardKinematics();
+    }
+
+    void IKBody::forwardKinematics()
+    {
+        for (size_t i = root; i < pos.size(); i++)
+        {
+            if (!below[i]) continue;
+
+            bool top = (int)i == root;
+            const Vector3D& origin = top ? parentPos : pos[parents[i]];
+            const Quaternion& space = top ? parentOrient :
+                                            orient[parents[i]];
+            pos[i] = origin + space.Rotate(localPos[i]);
+            orient[i] = space * localOrient[i];
+        }
+    }
+
+    void IKBody::storePose(MD5Model::JointList& joints)
+    {
+        for (size_t i = root; i < joints.size(); i++)
+        {
+            if (!below[i]) continue;
+            joints[i].pos = pos[i];
+            joints[i].orient = orient[i];
+        }
+    }
+}
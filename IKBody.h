@@ -0,0 +1,154 @@
+#ifndef IKBODY_H_INCLUDED
+#define IKBODY_H_INCLUDED
+
+#include <vector>
+#include "Eigen/Core"
+#include "Eigen/Cholesky"
+#include "IKSolver.h"
+
+namespace ST
+{
+    /** Many chains of one skeleton solved together, so the tasks share
+        the joints their chains have in common, e.g. both feet planted,
+        a hand reaching and the head looking, all over the spine.
+
+        Tasks are solved by priority: each one moves the joints only
+        in the ways that don't disturb the tasks of higher priority,
+        which is the null space of their Jacobians. Tasks of the same
+        priority are solved together, by least squares weighted by
+        SetWeight(). A lower 'priority' number goes first. If the lower
+        priorities can't be reached, a few last iterations hold just
+        the first one, so that planted feet don't slide.
+
+        Chains of the tasks start at the same root. The Jacobian of a task
+        has columns only for the joints of its chain, so the products
+        of the solve only touch those, and the joints off every chain
+        just follow their parents.
+    */
+    class IKBody
+    {
+    public:
+        IKBody();
+
+        /** The end of 'chain' reaches 'target', the pole is ignored.
+            Returns the index of the task. Throws if the chain is empty
+            or doesn't start at the root of the other tasks.
+        */
+        size_t AddTask(const IKChain& chain, const IKTarget& target,
+                       int priority = 0);
+        /** The end of 'chain' turns so 'axis', in the space of the end
+            joint, points at 'point'. Turns around the axis are free.
+        */
+        size_t AddLook(const IKChain& chain, const Math::Vector3D& axis,
+                       const Math::Vector3D& point, int priority = 0);
+        void SetTarget(size_t task, const IKTarget& target);
+        void SetLookAt(size_t task, const Math::Vector3D& point);
+        /** Weight of the task against the others of its priority. */
+        void SetWeight(size_t task, float weight);
+        void Clear();
+
+        size_t GetNumTasks() const { return tasks.size(); }
+
+        /** The root moves as well as turns if 'rootMotion' is set,
+            e.g. hips go down so the feet stay planted while a hand
+            reaches to the floor. Otherwise it stays in place.
+        */
+        void SetRootMotion(bool rootMotion);
+        /** Settings are the same as of IKSolver. */
+        void SetDamping(float damping);
+        void SetTolerance(float position, float rotation);
+        void SetMaxIterations(int iterations);
+        void SetLimits(const IKLimits* limits);
+
+        /** Writes the solved joints to 'joints', the joints off the
+            chains follow them. The edited model needs
+            InvalidateJoint() of the root and UpdateJoints(), or
+            InvalidatePose() and Skin() if 'joints' is its GetPose().
+            Returns whether every task was reached within the tolerance.
+        */
+        bool Solve(MD5Model::JointList& joints);
+
+        /** Whether the task was reached at the last Solve(),
+            tasks can't be when those of higher priority prevent it.
+        */
+        bool IsReached(size_t task) const { return tasks[task].reached; }
+        /** Remaining error of the task at the last Solve(). */
+        float GetError(size_t task) const { return tasks[task].error; }
+        int GetIterations() const { return iterations; }
+
+    private:
+        struct Task
+        {
+            std::vector<int> chain;    // Joints, the root first.
+            std::vector<int> columns;  // Of each block in the step.
+            IKTarget         target;
+            bool             look;     // Aims 'axis' at the target if set.
+            Math::Vector3D   axis;     // In the space of the end joint.
+            int              priority;
+            float            weight;
+            float            reach;    // Length of the chain.
+            size_t           firstRow; // Of its rows in 'residual'.
+            size_t           numRows;
+            float            error;
+            bool             reached;
+        };
+
+        size_t addTask(const IKChain& chain, int priority);
+        void sortTasks();
+        void loadPose(const MD5Model::JointList& joints);
+        bool measureErrors();
+        void buildJacobian();
+        bool levelReached(size_t level) const;
+        void solveStep(size_t numLevels);
+        void projectLevel(size_t first, size_t last, size_t numBasis);
+        void applyStep();
+        void forwardKinematics();
+        void storePose(MD5Model::JointList& joints);
+
+        std::vector<Task>   tasks;
+        bool                sorted;   // Whether the data below is current.
+        std::vector<size_t> order;    // Tasks sorted by the priority.
+        std::vector<size_t> levels;   // First in 'order' of each priority.
+        std::vector<int>    column;   // First step column of each joint.
+        std::vector<int>    turning;  // Joints with columns.
+        int                 root;
+        size_t              numRows;
+        size_t              numColumns;
+
+        bool     rootMotion;
+        float    damping;
+        float    posTolerance;
+        float    rotTolerance;
+        int      maxIterations;
+        int      iterations;
+        const IKLimits* limits;
+
+        // Pose of the skeleton being solved, only the root and the joints
+        // below it are used.
+        std::vector<Math::Vector3D>   localPos;    // Offset from the parent.
+        std::vector<Math::Quaternion> localOrient; // Relative to the parent.
+        std::vector<Math::Vector3D>   pos;         // Object space.
+        std::vector<Math::Quaternion> orient;
+        std::vector<int>              parents;
+        std::vector<bool>             below;       // Whether under the root.
+        Math::Vector3D                parentPos;   // Of the root, fixed.
+        Math::Quaternion              parentOrient;
+
+        // Rows of every task by the priority. Columns of a task are
+        // blocks of 3, the root motion first and then its chain.
+        Eigen::MatrixXf               jacobian;
+        Eigen::VectorXf               residual;  // Targets less the pose.
+        Eigen::MatrixXf               projected; // Rows of a priority in
+                                                 // the null space above.
+        Eigen::MatrixXf               basis;     // Motion taken above.
+        Eigen::MatrixXf               overlap;   // Of the rows with it.
+        Eigen::MatrixXf               normal;    // A * A^T + damping^2.
+        Eigen::VectorXf               remaining; // Residual the step leaves.
+        Eigen::VectorXf               dual;
+        Eigen::VectorXf               step;      // Motion of the root, then
+                                                 // angular velocities.
+        Eigen::LLT<Eigen::MatrixXf>   cholesky;
+    };
+}
+
+#endif // IKBODY_H_INCLUDED
@@ -0,0 +1,184 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "MappedFile.h"
+#include "MD5Tokenizer.h"
+#include "IKLimits.h"
+#include "math/Utility.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        /** Part of the rotation around 'axis', 'axis' is unit. */
+        Quaternion twistAround(const Quaternion& q, const Vector3D& axis)
+        {
+            float along = q.x * axis[0] + q.y * axis[1] + q.z * axis[2];
+            Quaternion twist(q.w, axis[0] * along, axis[1] * along,
+                             axis[2] * along);
+            if (twist.Length() < 1e-6f)
+                return Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+
+            twist.Normalize();
+            if (twist.w < 0.0f)
+                twist = Quaternion(-twist.w, -twist.x, -twist.y, -twist.z);
+            return twist;
+        }
+
+        /** Angle of a twist around 'axis', within [-pi; pi]. */
+        float twistAngle(const Quaternion& twist, const Vector3D& axis)
+        {
+            float along = twist.x * axis[0] + twist.y * axis[1] +
+                          twist.z * axis[2];
+            return 2.0f * atan2(along, twist.w);
+        }
+    }
+
+    IKLimits::IKLimits()
+    {
+    }
+
+    void IKLimits::Load(const string& fileName,
+                        const MD5Model::JointList& bindPose)
+    {
+        MappedFile file;
+        if (!file.Open(fileName))
+            throw runtime_error("Cannot locate file: " + fileName);
+
+        Clear();
+
+        MD5Tokenizer tokenizer(file.Begin(), file.End());
+        Token param = tokenizer.Next();
+        while (!param.empty())
+        {
+            if (param != "limits" || tokenizer.Next() != "{")
+                throw runtime_error("Malformed file: " + fileName);
+
+            for (Token name = tokenizer.Next(); name != "}";
+                 name = tokenizer.Next())
+            {
+                if (name.empty())
+                    throw runtime_error("Malformed file: " + fileName);
+
+                string joint(name.begin, name.end);
+                joint.erase(remove(joint.begin(), joint.end(), '\"'),
+                            joint.end());
+
+                Token type = tokenizer.Next();
+                tokenizer.Next(); // Read the '(' character.
+                Vector3D axis;
+                axis[0] = tokenizer.NextFloat();
+                axis[1] = tokenizer.NextFloat();
+                axis[2] = tokenizer.NextFloat();
+                tokenizer.Next(); // Read the ')' character.
+
+                if (type == "hinge")
+                {
+                    float minAngle = tokenizer.NextFloat() * DEG_2_RAD;
+                    float maxAngle = tokenizer.NextFloat() * DEG_2_RAD;
+                    SetHinge(bindPose, joint, axis, minAngle, maxAngle);
+                }
+                else if (type == "cone")
+                {
+                    float maxAngle = tokenizer.NextFloat() * DEG_2_RAD;
+                    SetCone(bindPose, joint, axis, maxAngle);
+                }
+                else
+                    throw runtime_error("Unknown limit: " + type.str());
+            }
+
+            param = tokenizer.Next();
+        }
+    }
+
+    void IKLimits::Clear()
+    {
+        limits.clear();
+    }
+
+    void IKLimits::SetHinge(const MD5Model::JointList& bindPose,
+                            const string& joint, const Vector3D& axis,
+                            float minAngle, float maxAngle)
+    {
+        Limit& limit = addLimit(bindPose, joint, axis);
+        limit.type = LIMIT_HINGE;
+        limit.minAngle = minAngle;
+        limit.maxAngle = maxAngle;
+    }
+
+    void IKLimits::SetCone(const MD5Model::JointList& bindPose,
+                           const string& joint, const Vector3D& axis,
+                           float maxAngle)
+    {
+        Limit& limit = addLimit(bindPose, joint, axis);
+        limit.type = LIMIT_CONE;
+        limit.minAngle = 0.0f;
+        limit.maxAngle = maxAngle;
+    }
+
+    IKLimits::Limit& IKLimits::addLimit(const MD5Model::JointList& bindPose,
+                                        const string& joint,
+                                        const Vector3D& axis)
+    {
+        size_t index = 0;
+        while (index < bindPose.size() && bindPose[index].name != joint)
+            index++;
+        if (index == bindPose.size())
+            throw runtime_error("Skeleton has no joint: " + joint);
+        if (axis.Length() == 0.0f)
+            throw runtime_error("Limit of " + joint + " has no axis");
+
+        Limit none = { LIMIT_NONE, Vector3D(), 0.0f, 0.0f, Quaternion() };
+        limits.resize(bindPose.size(), none);
+
+        // Rotations of the joint relative to the bind pose are measured
+        // in its own space, which is where the axis is kept.
+        const MD5Model::Joint& bind = bindPose[index];
+        Limit& limit = limits[index];
+        limit.axis = bind.orient.InverseRotate(Vector3D::Normalize(axis));
+        limit.rest = bind.parentID >= 0 ?
+                     bindPose[bind.parentID].orient.Conjugate() * bind.orient :
+                     bind.orient;
+        return limit;
+    }
+
+    bool IKLimits::Project(size_t joint, Quaternion& local) const
+    {
+        if (!HasLimit(joint)) return false;
+
+        const Limit& limit = limits[joint];
+        Quaternion turn = limit.rest.Conjugate() * local;
+        Quaternion twist = twistAround(turn, limit.axis);
+
+        if (limit.type == LIMIT_HINGE)
+        {
+            // Only the twist around the hinge is kept, within the range.
+            float angle = twistAngle(twist, limit.axis);
+            angle = max(limit.minAngle, min(limit.maxAngle, angle));
+            turn = Quaternion(angle, limit.axis);
+        }
+        else
+        {
+            // Swing that tilts the axis is shortened to the cone,
+            // the twist around the axis is free.
+            Quaternion swing = turn * twist.Conjugate();
+            if (swing.w < 0.0f)
+                swing = Quaternion(-swing.w, -swing.x, -swing.y, -swing.z);
+
+            float angle = 2.0f * acos(min(1.0f, swing.w));
+            if (angle <= limit.maxAngle) return false;
+
+            Vector3D tilt(swing.x, swing.y, swing.z);
+            turn = Quaternion(limit.maxAngle, tilt) * twist;
+        }
+
+        Quaternion projected = limit.rest * turn;
+        projected.Normalize();
+        bool moved = fabs(Quaternion::Dot(projected, local)) < 1.0f - 1e-6f;
+        local = projected;
+        return moved;
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef IKLIMITS_H_INCLUDED
+#define IKLIMITS_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include "MD5Model.h"
+
+namespace ST
+{
+    /** Limits of how far joints may turn from the bind pose, relative
+        to their parents, so IK can't invert knees and elbows.
+        A hinge joint only turns around its axis, within an angle range.
+        A cone joint turns freely, but its axis stays within an angle
+        of where it points in the bind pose. Axes are given in the
+        model space of the bind pose.
+
+        Limits are read from a sidecar file next to the mesh, e.g.
+        boblampclean.iklimits, with angles in degrees:
+
+            limits {
+                "shin.L"     hinge ( 1 0 0 ) -5 150  // min max
+                "thigh.L"    cone ( 0 0 -1 ) 100     // max
+            }
+    */
+    class IKLimits
+    {
+    public:
+        IKLimits();
+
+        /** Reads the limits of the joints of 'bindPose'. Throws if the
+            file is malformed or names a joint 'bindPose' doesn't have.
+        */
+        void Load(const std::string& fileName,
+                  const MD5Model::JointList& bindPose);
+        void Clear();
+
+        /** Angles are in radians. */
+        void SetHinge(const MD5Model::JointList& bindPose,
+                      const std::string& joint, const Math::Vector3D& axis,
+                      float minAngle, float maxAngle);
+        void SetCone(const MD5Model::JointList& bindPose,
+                     const std::string& joint, const Math::Vector3D& axis,
+                     float maxAngle);
+
+        bool HasLimit(size_t joint) const
+        {
+            return joint < limits.size() && limits[joint].type != LIMIT_NONE;
+        }
+
+        /** Moves the rotation of the joint relative to its parent
+            to the nearest one its limit allows and returns whether
+            it was out of the limit. Doesn't allocate, so solvers
+            call it on every iteration.
+        */
+        bool Project(size_t joint, Math::Quaternion& local) const;
+
+    private:
+        enum LimitType
+        {
+            LIMIT_NONE,
+            LIMIT_HINGE,
+            LIMIT_CONE
+        };
+
+        struct Limit
+        {
+            LimitType        type;
+            Math::Vector3D   axis;     // In the space of the joint.
+            float            minAngle;
+            float            maxAngle;
+            Math::Quaternion rest;     // Bind rotation to the parent.
+        };
+
+        Limit& addLimit(const MD5Model::JointList& bindPose,
+                        const std::string& joint, const Math::Vector3D& axis);
+
+        std::vector<Limit> limits; // Of every joint.
+    };
+}
+
+#endif // IKLIMITS_H_INCLUDED
@@ -0,0 +1,578 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "IKSolver.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        // Largest angle a joint turns by in one iteration, radians.
+        const float max_turn = 0.5f;
+        // Limited FABRIK has stalled when an iteration leaves more
+        // of the squared distance to the target.
+        const float min_progress = 0.95f;
+        // Shorter bones and distances are taken for zero.
+        const float min_length = 1e-5f;
+
+        int findJoint(const MD5Model::JointList& joints, const string& name)
+        {
+            for (size_t i = 0; i < joints.size(); i++)
+            {
+                if (joints[i].name == name)
+                    return i;
+            }
+            throw runtime_error("Skeleton has no joint: " + name);
+        }
+
+        /** Rotation by the angle |v| around v. */
+        Quaternion expMap(const Vector3D& v)
+        {
+            float angle = v.Length();
+            if (angle < 1e-6f)
+            {
+                Quaternion q(1.0f, v[0] * 0.5f, v[1] * 0.5f, v[2] * 0.5f);
+                q.Normalize();
+                return q;
+            }
+            return Quaternion(angle, v);
+        }
+
+        /** Shortest rotation that turns the direction of 'from' to 'to'. */
+        Quaternion shortestArc(const Vector3D& from, const Vector3D& to)
+        {
+            Vector3D axis = Vector3D::Cross(from, to);
+            float angle = atan2(axis.Length(), from.Dot(to));
+            if (axis.Length() < min_length * from.Length() * to.Length())
+                return Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+            return Quaternion(angle, axis);
+        }
+
+        /** Point 'length' away from 'anchor' towards 'point'. */
+        Vector3D drag(const Vector3D& point, const Vector3D& anchor,
+                      float length)
+        {
+            Vector3D dir = point - anchor;
+            float distance = dir.Length();
+            if (distance < min_length)
+                return point;
+            return anchor + dir * (length / distance);
+        }
+
+        /** Axis of the rotation scaled by its angle, the shorter way. */
+        Vector3D logMap(const Quaternion& q)
+        {
+            float sign = q.w < 0.0f ? -1.0f : 1.0f;
+            Vector3D axis(sign * q.x, sign * q.y, sign * q.z);
+            float sinHalf = axis.Length();
+            if (sinHalf < 1e-6f)
+                return axis * 2.0f;
+            return axis * (2.0f * atan2(sinHalf, sign * q.w) / sinHalf);
+        }
+    }
+
+    IKChain::IKChain() : warmStart(false)
+    {
+    }
+
+    IKChain::IKChain(const MD5Model::JointList& skeleton, const string& root,
+                     const string& end)
+        : warmStart(false)
+    {
+        int first = findJoint(skeleton, root);
+        int last = findJoint(skeleton, end);
+
+        // Walk up from the end, then turn the chain root first.
+        for (int i = last; i != first; i = skeleton[i].parentID)
+        {
+            if (i < 0)
+                throw runtime_error("Joint " + end + " isn't below " + root);
+            joints.push_back(i);
+        }
+        joints.push_back(first);
+        reverse(joints.begin(), joints.end());
+    }
+
+    void IKChain::SetWarmStart(bool warmStart)
+    {
+        this->warmStart = warmStart;
+        solution.clear();
+    }
+
+    void IKChain::ResetWarmStart()
+    {
+        solution.clear();
+    }
+
+    IKTarget::IKTarget()
+        : orient(1.0f, 0.0f, 0.0f, 0.0f), hasOrient(false), orientWeight(1.0f),
+          hasPole(false)
+    {
+    }
+
+    IKTarget::IKTarget(const Vector3D& pos)
+        : pos(pos), orient(1.0f, 0.0f, 0.0f, 0.0f), hasOrient(false),
+          orientWeight(1.0f), hasPole(false)
+    {
+    }
+
+    IKTarget::IKTarget(const Vector3D& pos, const Quaternion& orient)
+        : pos(pos), orient(orient), hasOrient(true), orientWeight(1.0f),
+          hasPole(false)
+    {
+    }
+
+    IKSolver::IKSolver()
+        : method(IK_DAMPED_LEAST_SQUARES), damping(1.0f),
+          posTolerance(0.01f), rotTolerance(0.001f), maxIterations(100),
+          iterations(0), error(0.0f), limits(0), current(0)
+    {
+    }
+
+    void IKSolver::SetMethod(IKMethod method)
+    {
+        this->method = method;
+    }
+
+    void IKSolver::SetDamping(float damping)
+    {
+        this->damping = damping;
+    }
+
+    void IKSolver::SetTolerance(float position, float rotation)
+    {
+        posTolerance = position;
+        rotTolerance = rotation;
+    }
+
+    void IKSolver::SetMaxIterations(int iterations)
+    {
+        maxIterations = iterations;
+    }
+
+    void IKSolver::SetLimits(const IKLimits* limits)
+    {
+        this->limits = limits;
+    }
+
+    bool IKSolver::Solve(IKChain& chain, const IKTarget& target,
+                         MD5Model::JointList& joints)
+    {
+        if (chain.GetNumJoints() == 0)
+            throw runtime_error("Cannot solve an empty chain");
+
+        loadChain(chain, joints);
+
+        current = &chain;
+        iterations = 0;
+
+        bool reached = false;
+        bool twoBone = chain.GetNumJoints() == 3;
+        if (twoBone)
+        {
+            solveTwoBone(target);
+            for (size_t i = 0; i < 3; i++)
+                constrain(i);
+            reached = measureError(target);
+        }
+
+        // Limits may pull a limb off the target,
+        // then the method goes on from where they left it.
+        if (!twoBone || (!reached && limits))
+        {
+            if (method == IK_FABRIK || method == IK_CCD)
+            {
+                // Limits can hold FABRIK where they balance the dragging,
+                // then CCD sweeps, which turn within the limits, go on.
+                if (method == IK_CCD || !solveFabrik(target))
+                    solveCCD(target);
+
+                // End joint turns freely, so it just takes the orientation.
+                if (target.hasOrient)
+                    orient.back() = target.orient;
+                constrain(orient.size() - 1);
+                reached = measureError(target);
+            }
+            else
+                reached = solveJacobian(target);
+        }
+
+        storeChain(chain, joints);
+        current = 0;
+        return reached;
+    }
+
+    bool IKSolver::solveJacobian(const IKTarget& target)
+    {
+        bool reached = measureError(target);
+        for (; !reached && iterations < maxIterations; iterations++)
+        {
+            buildJacobian(target);
+            solveStep();
+            applyStep();
+            reached = measureError(target);
+        }
+        return reached;
+    }
+
+    bool IKSolver::solveFabrik(const IKTarget& target)
+    {
+        size_t n = pos.size();
+        points.assign(pos.begin(), pos.end());
+
+        // Joints are dragged as points along the bones, from the target
+        // back to the root and from the root forth to the end again,
+        // until the end stays within half the tolerance, so rounding
+        // of the turns below doesn't take it out of the tolerance.
+        float tolerance = 0.25f * posTolerance * posTolerance;
+        float previous = (points.back() - target.pos).LengthSquared();
+        while ((points.back() - target.pos).LengthSquared() > tolerance &&
+               iterations < maxIterations)
+        {
+            points.back() = target.pos;
+            for (size_t i = n - 1; i-- > 0;)
+                points[i] = drag(points[i], points[i + 1],
+                                 localPos[i + 1].Length());
+
+            points.front() = pos.front();
+            for (size_t i = 1; i < n; i++)
+                points[i] = drag(points[i], points[i - 1],
+                                 localPos[i].Length());
+            iterations++;
+
+            // Points know nothing of the limits, so the limited joints
+            // are laid along them and the next pass starts from there.
+            if (limits)
+            {
+                layBones();
+                points.assign(pos.begin(), pos.end());
+
+                float now = (points.back() - target.pos).LengthSquared();
+                if (now > min_progress * previous)
+                    return false;
+                previous = now;
+            }
+        }
+
+        if (!limits)
+            layBones();
+        return true;
+    }
+
+    void IKSolver::layBones()
+    {
+        // Joints turn by the shortest arcs that lay the bones
+        // along the points, which keeps their twist.
+        for (size_t i = 0; i + 1 < pos.size(); i++)
+        {
+            turn(i, shortestArc(pos[i + 1] - pos[i], points[i + 1] - pos[i]));
+            constrain(i);
+        }
+    }
+
+    void IKSolver::solveCCD(const IKTarget& target)
+    {
+        size_t n = pos.size();
+
+        // Every sweep turns each joint, from the end to the root,
+        // so the end points at the target from it.
+        float tolerance = posTolerance * posTolerance;
+        while ((pos.back() - target.pos).LengthSquared() > tolerance &&
+               iterations < maxIterations)
+        {
+            for (size_t i = n - 1; i-- > 0;)
+            {
+                turn(i, shortestArc(pos.back() - pos[i], target.pos - pos[i]));
+                constrain(i);
+            }
+            iterations++;
+        }
+    }
+
+    void IKSolver::loadChain(const IKChain& chain,
+                             const MD5Model::JointList& joints)
+    {
+        size_t n = chain.GetNumJoints();
+        localPos.resize(n);
+        localOrient.resize(n);
+        pos.resize(n);
+        orient.resize(n);
+        reach = 0.0f;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const MD5Model::Joint& joint = joints[chain.GetJoint(i)];
+            pos[i] = joint.pos;
+            orient[i] = joint.orient;
+            if (i == 0) continue;
+
+            Quaternion parent = orient[i - 1].Conjugate();
+            localPos[i] = parent.Rotate(pos[i] - pos[i - 1]);
+            localOrient[i] = parent * orient[i];
+            reach += localPos[i].Length();
+        }
+
+        // Root turns in the space of its own parent, which stays fixed.
+        const MD5Model::Joint& root = joints[chain.GetRoot()];
+        parentOrient = root.parentID >= 0 ?
+                       joints[root.parentID].orient :
+                       Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+        localPos[0] = pos[0];
+        localOrient[0] = parentOrient.Conjugate() * orient[0];
+
+        if (chain.warmStart && chain.solution.size() == n)
+        {
+            copy(chain.solution.begin(), chain.solution.end(),
+                 localOrient.begin());
+            forwardKinematics();
+        }
+    }
+
+    void IKSolver::solveTwoBone(const IKTarget& target)
+    {
+        const Vector3D root = pos[0];
+        Vector3D upper = pos[1] - root;
+        Vector3D lower = pos[2] - pos[1];
+        float upperLength = upper.Length();
+        float lowerLength = lower.Length();
+        if (upperLength < min_length || lowerLength < min_length)
+            return;
+
+        // Targets out of reach are aimed at by the limb stretched
+        // or folded as far as it goes.
+        Vector3D aim = target.pos - root;
+        float distance = aim.Length();
+        float reachable = max(fabs(upperLength - lowerLength),
+                              min(upperLength + lowerLength, distance));
+
+        // Middle joint bends as a hinge to the angle between the bones
+        // that puts the end at that distance from the root.
+        float cosBend = (upperLength * upperLength +
+                         lowerLength * lowerLength - reachable * reachable) /
+                        (2.0f * upperLength * lowerLength);
+        float cosNow = -upper.Dot(lower) / (upperLength * lowerLength);
+        float bend = acos(max(-1.0f, min(1.0f, cosBend))) -
+                     acos(max(-1.0f, min(1.0f, cosNow)));
+
+        Vector3D hinge = Vector3D::Cross(-upper, lower);
+        if (hinge.Length() < min_length * upperLength * lowerLength)
+        {
+            // Straight limbs bend towards the pole or anywhere,
+            // the root turns them to the pole below anyway.
+            Vector3D side = target.hasPole ? target.pole - root :
+                            Vector3D(upper[1], upper[2], upper[0]);
+            hinge = Vector3D::Cross(upper, side);
+            if (hinge.Length() < min_length)
+                hinge = Vector3D::Cross(upper, Vector3D(upper[2], upper[0],
+                                                        -upper[1]));
+        }
+        if (fabs(bend) > 0.0f && hinge.Length() > 0.0f)
+            turn(1, Quaternion(bend, hinge));
+
+        if (distance < min_length)
+            return;
+
+        // Root aims the end at the target by the shortest arc.
+        Vector3D end = pos[2] - root;
+        Vector3D axis = Vector3D::Cross(end, aim);
+        float angle = atan2(axis.Length(), end.Dot(aim));
+        if (axis.Length() > 0.0f)
+            turn(0, Quaternion(angle, axis));
+        else if (angle > 0.0f)
+            turn(0, Quaternion(angle, hinge));
+
+        // And twists the limb around the aim so the middle joint
+        // is on the side of the pole.
+        if (target.hasPole)
+        {
+            Vector3D dir = aim * (1.0f / distance);
+            Vector3D middle = pos[1] - root;
+            Vector3D pole = target.pole - root;
+            middle -= dir * dir.Dot(middle);
+            pole -= dir * dir.Dot(pole);
+            if (middle.Length() > min_length && pole.Length() > min_length)
+            {
+                float twist = atan2(Vector3D::Cross(middle, pole).Dot(dir),
+                                    middle.Dot(pole));
+                turn(0, Quaternion(twist, dir));
+            }
+        }
+
+        if (target.hasOrient)
+            orient[2] = target.orient;
+    }
+
+    void IKSolver::constrain(size_t i)
+    {
+        if (!limits) return;
+
+        const Quaternion& parent = i > 0 ? orient[i - 1] : parentOrient;
+        Quaternion local = parent.Conjugate() * orient[i];
+        if (limits->Project(current->GetJoint(i), local))
+            turn(i, parent * local * orient[i].Conjugate());
+    }
+
+    void IKSolver::turn(size_t first, const Quaternion& rotation)
+    {
+        const Vector3D center = pos[first];
+        for (size_t i = first; i < pos.size(); i++)
+        {
+            pos[i] = center + rotation.Rotate(pos[i] - center);
+            orient[i] = rotation * orient[i];
+            orient[i].Normalize();
+        }
+    }
+
+    bool IKSolver::measureError(const IKTarget& target)
+    {
+        size_t rows = target.hasOrient ? 6 : 3;
+        residual.resize(rows);
+
+        Vector3D dp = target.pos - pos.back();
+        residual.head<3>() << dp[0], dp[1], dp[2];
+        bool reached = dp.Length() <= posTolerance;
+
+        if (target.hasOrient)
+        {
+            Vector3D dr = logMap(target.orient * orient.back().Conjugate());
+            residual.tail<3>() << dr[0], dr[1], dr[2];
+            residual.tail<3>() *= target.orientWeight;
+            reached = reached && dr.Length() <= rotTolerance;
+        }
+
+        error = residual.norm();
+
+        // Far targets would make steps the linearization can't follow,
+        // so the end is pulled at most by half of the chain at once.
+        float pull = dp.Length();
+        if (pull > 0.5f * reach)
+            residual.head<3>() *= 0.5f * reach / pull;
+        return reached;
+    }
+
+    void IKSolver::buildJacobian(const IKTarget& target)
+    {
+        size_t n = pos.size();
+        jacobian.resize(residual.size(), 3 * n);
+
+        // Turning joint i by w moves the end by w x (end - p[i])
+        // and turns it by w.
+        const Vector3D& end = pos.back();
+        for (size_t i = 0; i < n; i++)
+        {
+            Vector3D r = end - pos[i];
+            jacobian.block<3, 3>(0, 3 * i) <<
+                0.0f,  r[2], -r[1],
+               -r[2],  0.0f,  r[0],
+                r[1], -r[0],  0.0f;
+
+            if (target.hasOrient)
+            {
+                jacobian.block<3, 3>(3, 3 * i).setIdentity();
+                jacobian.block<3, 3>(3, 3 * i) *= target.orientWeight;
+            }
+        }
+    }
+
+    void IKSolver::solveStep()
+    {
+        if (method == IK_DAMPED_LEAST_SQUARES)
+        {
+            // Joints are many and rows are few, so the system
+            // (J * J^T + d^2 * I) * y = e is solved for y and the step
+            // is J^T * y, the least joint motion that moves the end.
+            normal.noalias() = jacobian * jacobian.transpose();
+            normal.diagonal().array() += damping * damping;
+            cholesky.compute(normal);
+            dual = cholesky.solve(residual);
+            step.noalias() = jacobian.transpose() * dual;
+        }
+        else
+        {
+            // Step along J^T * e as far as it best reduces the error
+            // of the linearized chain.
+            step.noalias() = jacobian.transpose() * residual;
+            dual.noalias() = jacobian * step;
+            float length = dual.squaredNorm();
+            float scale = length > 0.0f ? residual.dot(dual) / length : 0.0f;
+            step *= scale;
+        }
+
+        // Near singular poses tiny errors ask for big turns, which
+        // the linearization doesn't hold for, so they are scaled down.
+        float largest = 0.0f;
+        for (int i = 0; i < step.size(); i += 3)
+            largest = max(largest, step.segment<3>(i).norm());
+        if (largest > max_turn)
+            step *= max_turn / largest;
+    }
+
+    void IKSolver::applyStep()
+    {
+        // Steps are angular velocities in the object space, so each joint
+        // turns in the space its parent had when the Jacobian was built.
+        for (size_t i = 0; i < pos.size(); i++)
+        {
+            Vector3D w(step[3 * i], step[3 * i + 1], step[3 * i + 2]);
+            const Quaternion& parent = i > 0 ? orient[i - 1] : parentOrient;
+            localOrient[i] = parent.Conjugate() * expMap(w) * orient[i];
+            localOrient[i].Normalize();
+            if (limits)
+                limits->Project(current->GetJoint(i), localOrient[i]);
+        }
+        forwardKinematics();
+    }
+
+    void IKSolver::forwardKinematics()
+    {
+        orient[0] = parentOrient * localOrient[0];
+        for (size_t i = 1; i < pos.size(); i++)
+        {
+            pos[i] = pos[i - 1] + orient[i - 1].Rotate(localPos[i]);
+            orient[i] = orient[i - 1] * localOrient[i];
+        }
+    }
+
+    void IKSolver::storeChain(IKChain& chain, MD5Model::JointList& joints)
+    {
+        // Joints below the chain keep their offsets from the nearest
+        // chain joint above them. Parents go before their children,
+        // so one pass finds them before the chain is overwritten.
+        follow.assign(joints.size(), -1);
+        for (size_t i = 0; i < chain.GetNumJoints(); i++)
+            follow[chain.GetJoint(i)] = i;
+
+        for (size_t k = chain.GetRoot() + 1; k < joints.size(); k++)
+        {
+            int parent = joints[k].parentID;
+            if (follow[k] >= 0 || parent < 0 || follow[parent] < 0)
+                continue;
+
+            int c = follow[k] = follow[parent];
+            const MD5Model::Joint& old = joints[chain.GetJoint(c)];
+            Quaternion turn = orient[c] * old.orient.Conjugate();
+
+            MD5Model::Joint& joint = joints[k];
+            joint.pos = pos[c] + turn.Rotate(joint.pos - old.pos);
+            joint.orient = turn * joint.orient;
+        }
+
+        for (size_t i = 0; i < chain.GetNumJoints(); i++)
+        {
+            MD5Model::Joint& joint = joints[chain.GetJoint(i)];
+            joint.pos = pos[i];
+            joint.orient = orient[i];
+        }
+
+        if (chain.warmStart)
+        {
+            chain.solution.resize(chain.GetNumJoints());
+            chain.solution[0] = parentOrient.Conjugate() * orient[0];
+            for (size_t i = 1; i < chain.GetNumJoints(); i++)
+                chain.solution[i] = orient[i - 1].Conjugate() * orient[i];
+        }
+    }
+}
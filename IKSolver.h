@@ -0,0 +1,174 @@
+#ifndef IKSOLVER_H_INCLUDED
+#define IKSOLVER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include "Eigen/Core"
+#include "Eigen/Cholesky"
+#include "MD5Model.h"
+#include "IKLimits.h"
+
+namespace ST
+{
+    /** Joints of the skeleton from 'root' down to 'end', in this order. */
+    class IKChain
+    {
+    public:
+        IKChain();
+        /** Throws if a joint is unknown or 'end' isn't below 'root'. */
+        IKChain(const MD5Model::JointList& joints, const std::string& root,
+                const std::string& end);
+
+        size_t GetNumJoints() const { return joints.size(); }
+        int GetJoint(size_t i) const { return joints[i]; }
+        int GetRoot() const { return joints.front(); }
+        int GetEnd() const { return joints.back(); }
+
+        /** Chains that warm-start begin every solve from the rotations
+            of their last solution instead of the pose of the skeleton,
+            so targets that move a little between frames take few
+            iterations. Each character needs its own chain then.
+        */
+        void SetWarmStart(bool warmStart);
+        bool IsWarmStart() const { return warmStart; }
+        /** Next solve starts from the pose of the skeleton again. */
+        void ResetWarmStart();
+
+    private:
+        friend class IKSolver;
+
+        std::vector<int>              joints;
+        bool                          warmStart;
+        std::vector<Math::Quaternion> solution; // Last rotations to parents.
+    };
+
+    /** Pose the end of a chain should reach, in the space of the joints. */
+    struct IKTarget
+    {
+        IKTarget();
+        explicit IKTarget(const Math::Vector3D& pos);
+        IKTarget(const Math::Vector3D& pos, const Math::Quaternion& orient);
+
+        Math::Vector3D   pos;
+        Math::Quaternion orient;
+        bool             hasOrient;    // Only the position is reached if not.
+        float            orientWeight; // Length a radian of error weighs as.
+        Math::Vector3D   pole;         // Two-bone chains bend towards it.
+        bool             hasPole;      // They keep their bend plane if not.
+    };
+
+    /** Turns the joints of a chain so its end reaches the target.
+        Every joint of the chain rotates around its position, freely
+        or within its limits, the root stays in place. Each iteration
+        linearizes the chain by its Jacobian, the derivative of the end
+        pose by the angular velocities of the joints, and steps by damped
+        least squares or by the Jacobian transpose. The solver keeps its
+        matrices, so solving chains of the same length doesn't allocate.
+
+        FABRIK and CCD are cheaper iterations for long chains, like
+        spines and tails. FABRIK drags the joints as points along
+        the bones towards the target and back to the root, CCD turns
+        joint after joint from the end so the end points at the target.
+        Both reach only the position, the end joint then takes
+        the orientation of the target if it has one.
+
+        Chains of three joints, like thigh -> shin -> ankle, are limbs
+        solved in closed form whatever the method: the middle joint
+        bends as a hinge to the distance of the target, the root aims
+        the limb at it and turns the bend towards the pole. The end
+        takes the orientation of the target if it has one. If limits
+        pull the limb off the target, the method iterates on from there.
+    */
+    class IKSolver
+    {
+    public:
+        enum IKMethod
+        {
+            IK_DAMPED_LEAST_SQUARES, // Stable near singular poses.
+            IK_JACOBIAN_TRANSPOSE,   // Cheaper steps, more of them.
+            IK_FABRIK,               // Forward and backward reaching.
+            IK_CCD                   // Cyclic coordinate descent.
+        };
+
+        IKSolver();
+
+        void SetMethod(IKMethod method);
+        /** Damping of least squares, in units of length. Larger values
+            keep steps small near singular poses and unreachable targets.
+        */
+        void SetDamping(float damping);
+        /** Solving stops when the end is within 'position' of the target
+            and within 'rotation' radians of its orientation.
+        */
+        void SetTolerance(float position, float rotation);
+        void SetMaxIterations(int iterations);
+        /** Joints of the chains are kept within 'limits' on every
+            iteration if it isn't null. Limits must outlive the solver
+            or be reset to null.
+        */
+        void SetLimits(const IKLimits* limits);
+
+        /** Writes the solved joints of the chain to 'joints', the joints
+            below the chain follow them. The edited model needs
+            InvalidateJoint(chain.GetRoot()) and UpdateJoints(), or
+            InvalidatePose(chain.GetRoot()) and Skin() if 'joints'
+            is its GetPose().
+            Returns whether the target was reached within the tolerance.
+        */
+        bool Solve(IKChain& chain, const IKTarget& target,
+                   MD5Model::JointList& joints);
+
+        /** Iterations and the remaining error of the last Solve(),
+            the error weighs the orientation as the target does,
+            two-bone chains take no iterations.
+        */
+        int GetIterations() const { return iterations; }
+        float GetError() const { return error; }
+
+    private:
+        void loadChain(const IKChain& chain,
+                       const MD5Model::JointList& joints);
+        bool solveJacobian(const IKTarget& target);
+        bool solveFabrik(const IKTarget& target);
+        void solveCCD(const IKTarget& target);
+        void solveTwoBone(const IKTarget& target);
+        void layBones();
+        void constrain(size_t i);
+        void turn(size_t first, const Math::Quaternion& rotation);
+        bool measureError(const IKTarget& target);
+        void buildJacobian(const IKTarget& target);
+        void solveStep();
+        void applyStep();
+        void forwardKinematics();
+        void storeChain(IKChain& chain, MD5Model::JointList& joints);
+
+        IKMethod method;
+        float    damping;
+        float    posTolerance;
+        float    rotTolerance;
+        int      maxIterations;
+        int      iterations;
+        float    error;
+        const IKLimits* limits;
+        const IKChain*  current; // Chain being solved.
+
+        // Pose of the chain being solved, the root first.
+        std::vector<Math::Vector3D>   localPos;    // Offset from the parent.
+        std::vector<Math::Quaternion> localOrient; // Relative to the parent.
+        std::vector<Math::Vector3D>   pos;         // Object space.
+        std::vector<Math::Quaternion> orient;
+        Math::Quaternion              parentOrient; // Of the root, fixed.
+        float                         reach;        // Length of the chain.
+        std::vector<Math::Vector3D>   points;       // Joints moved by FABRIK.
+
+        Eigen::MatrixXf               jacobian;  // Rows of the end pose.
+        Eigen::MatrixXf               normal;    // J * J^T + damping^2.
+        Eigen::VectorXf               residual;  // Target less the end pose.
+        Eigen::VectorXf               dual;      // Solution of the normal.
+        Eigen::VectorXf               step;      // Angular velocities.
+        Eigen::LLT<Eigen::MatrixXf>   cholesky;
+        std::vector<int>              follow;    // Chain joint of each joint.
+    };
+}
+
+#endif // IKSOLVER_H_INCLUDED
@@ -0,0 +1,91 @@
+#include "JobPool.h"
+
+using namespace std;
+
+namespace ST
+{
+    JobPool::JobPool(size_t numThreads) : running(0), quit(false)
+    {
+        if (numThreads == 0)
+            numThreads = max(thread::hardware_concurrency(), 1u);
+
+        for (size_t i = 1; i < numThreads; i++)
+            workers.push_back(thread(&JobPool::workerLoop, this));
+    }
+
+    JobPool::~JobPool()
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        jobAdded.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    void JobPool::Add(const Job& job)
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        jobAdded.notify_one();
+    }
+
+    void JobPool::Wait()
+    {
+        unique_lock<std::mutex> lock(mutex);
+        while (runOne(lock)) {}
+
+        // Queue is empty, wait for the jobs taken by the workers.
+        jobDone.wait(lock, [this] { return running == 0; });
+        if (error)
+        {
+            exception_ptr failure = error;
+            error = nullptr;
+            rethrow_exception(failure);
+        }
+    }
+
+    void JobPool::workerLoop()
+    {
+        unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            jobAdded.wait(lock, [this] { return quit || !jobs.empty(); });
+            if (quit) return;
+            runOne(lock);
+        }
+    }
+
+    //-- Runs the next job with the mutex unlocked --//
+    bool JobPool::runOne(unique_lock<std::mutex>& lock)
+    {
+        if (jobs.empty()) return false;
+
+        Job job;
+        job.swap(jobs.front());
+        jobs.pop_front();
+        running++;
+
+        // An exception can't leave a worker, and the job must count
+        // as finished anyway, so it's kept for Wait().
+        exception_ptr failure;
+        lock.unlock();
+        try
+        {
+            job();
+        }
+        catch (...)
+        {
+            failure = current_exception();
+        }
+        lock.lock();
+
+        if (failure && !error) error = failure;
+        if (--running == 0 && jobs.empty())
+            jobDone.notify_all();
+        return true;
+    }
+}
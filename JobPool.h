@@ -0,0 +1,60 @@
+#ifndef JOBPOOL_H_INCLUDED
+#define JOBPOOL_H_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace ST
+{
+    /** Pool of worker threads that run independent jobs.
+        Jobs are queued with Add() and Wait() is the join barrier:
+        the calling thread runs queued jobs as well and returns
+        only when every job added before has finished.
+        One pool can be shared by many models.
+    */
+    class JobPool
+    {
+    public:
+        typedef std::function<void()> Job;
+
+        /** 'numThreads' counts the calling thread too, so the pool
+            with 1 thread runs everything in Wait(). Zero means
+            one thread per hardware core.
+        */
+        explicit JobPool(size_t numThreads = 0);
+        ~JobPool();
+
+        size_t NumThreads() const { return workers.size() + 1; }
+
+        void Add(const Job& job);
+        /** Jobs that throw don't stop the others. Once every job has
+            finished, Wait() throws the first exception thrown since
+            the last Wait(). Jobs must not call Wait() of their pool,
+            it would wait for the job that called it.
+        */
+        void Wait();
+
+    private:
+        JobPool(const JobPool&);
+        JobPool& operator= (const JobPool&);
+
+        void workerLoop();
+        bool runOne(std::unique_lock<std::mutex>& lock);
+
+        std::vector<std::thread> workers;
+        std::deque<Job>          jobs;     //!< Jobs nobody has taken yet.
+        size_t                   running;  //!< Jobs taken but not finished.
+        std::exception_ptr       error;    //!< First thrown by the jobs.
+        bool                     quit;
+        std::mutex               mutex;
+        std::condition_variable  jobAdded; //!< Wakes up the workers.
+        std::condition_variable  jobDone;  //!< Wakes up Wait().
+    };
+}
+
+#endif // JOBPOOL_H_INCLUDED
@@ -1,5 +1,11 @@
-#include <fstream>
+#include <cmath>
 #include <stdexcept>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include "Log.h"
+#include "MappedFile.h"
+#include "MD5Tokenizer.h"
 #include "MD5Animation.h"
 
 using namespace std;
@@ -7,7 +13,70 @@ using namespace Math;
 
 namespace ST
 {
+    namespace
+    {
+        // Change the version whenever cached data changes its layout.
+        const char cache_magic[] = "MD5A";
+        const unsigned cache_version = 4;
+
+        // Skeletons of compressed frames decoded last. Two of them
+        // are interpolated and the next frame reuses one of them.
+        const size_t frame_cache_size = 4;
+
+        typedef MD5Animation::Transform Transform;
+
+        /** Transformation 'b' followed by 'a'. */
+        Transform compose(const Transform& a, const Transform& b)
+        {
+            Transform t;
+            t.pos = a.pos + a.orient.Rotate(b.pos);
+            t.orient = a.orient * b.orient;
+            return t;
+        }
+
+        Transform inverse(const Transform& a)
+        {
+            Transform t;
+            t.orient = a.orient.Conjugate();
+            t.pos = -t.orient.Rotate(a.pos);
+            return t;
+        }
+
+        /** Box that holds 'bound' moved by 'move'. */
+        MD5Animation::Bound moveBound(const MD5Animation::Bound& bound,
+                                      const Transform& move)
+        {
+            Vector3D center = (bound.min + bound.max) * 0.5f;
+            Vector3D extent = (bound.max - bound.min) * 0.5f;
+            Vector3D axes[3] = { move.orient.Rotate(Vector3D(1, 0, 0)),
+                                 move.orient.Rotate(Vector3D(0, 1, 0)),
+                                 move.orient.Rotate(Vector3D(0, 0, 1)) };
+
+            Vector3D reach;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    reach[i] += fabs(axes[j][i]) * extent[j];
+
+            center = move.pos + move.orient.Rotate(center);
+            MD5Animation::Bound moved;
+            moved.min = center - reach;
+            moved.max = center + reach;
+            return moved;
+        }
+
+        /** Rounds towards minus infinity, unlike '/'. */
+        long long floorDiv(long long a, long long b)
+        {
+            long long q = a / b;
+            return q * b > a ? q - 1 : q;
+        }
+    }
+
+    const long long MD5Animation::TicksPerSecond;
+
     MD5Animation::MD5Animation()
+        : frameUses(0), poseChanged(false), lastFrame0(-1), lastFrame1(-1),
+          lastQuotient(0), animTicks(0), extractRoot(false)
     {
     }
 
@@ -15,147 +84,335 @@ namespace ST
     {
     }
 
-    void MD5Animation::LoadAnimation(const string& fileName)
+    MD5Animation::ClipData::ClipData()
+        : compressed(false), numFrames(0), numJoints(0), frameRate(0),
+          numAnimatedComponents(0), animDuration(0), frameTicks(0),
+          loopTicks(0), rootJoint(0)
+    {
+    }
+
+    void MD5Animation::LoadAnimation(const string& fileName, bool compressed)
     {
-        ifstream file(fileName);
+        data = loadClip(fileName, compressed);
+        int numJoints = data->numJoints;
 
-        if (!file)
+        // There will be no push_back() for animatedSkeleton,
+        // so we need to assign something inside a vector.
+        animatedSkeleton.assign(numJoints, SkeletonJoint());
+
+        frameCache.clear();
+        localFrames.clear();
+        if (compressed)
+        {
+            CachedFrame empty = { -1, 0, vector<float>(PoseSize(numJoints)) };
+            frameCache.assign(frame_cache_size, empty);
+            decoded.assign(numJoints, SkeletonJoint());
+            localFrames.assign(2 * PoseSize(numJoints), 0.0f);
+        }
+        frameUses = 0;
+        blended.assign(PoseSize(numJoints), 0.0f);
+
+        // Nothing is sampled yet, so the first pose is new for every joint.
+        changedJoints.assign(numJoints, true);
+        poseChanged = true;
+        lastFrame0 = lastFrame1 = -1;
+        lastQuotient = 0.0f;
+
+        animTicks = 0;
+        root = data->rootStart;
+        rootMotion = Transform();
+        if (extractRoot) SetRootMotion(true);
+    }
+
+    shared_ptr<const MD5Animation::ClipData>
+    MD5Animation::loadClip(const string& fileName, bool compressed)
+    {
+        FileStamp stamp;
+        if (!GetFileStamp(fileName, stamp))
             throw runtime_error("Cannot locate file: " + fileName);
 
-        int pos = file.tellg();
-        file.seekg(0, std::ios::end);
-        int fileLength = file.tellg();
-        file.seekg(pos);
+        // Clips that are still played by somebody are taken as they are,
+        // unless the file has changed since.
+        static mutex loadedMutex;
+        static map<string, weak_ptr<const ClipData> > loaded;
+        lock_guard<mutex> lock(loadedMutex);
+
+        weak_ptr<const ClipData>& entry =
+            loaded[fileName + (compressed ? "|compressed" : "")];
+        shared_ptr<const ClipData> shared = entry.lock();
+        if (shared && shared->source.size == stamp.size &&
+            shared->source.time == stamp.time)
+            return shared;
+
+        shared_ptr<ClipData> clip = make_shared<ClipData>();
+        clip->source = stamp;
+        clip->compressed = compressed;
+
+        // Skeletons of all the frames are built only once,
+        // after that they come from the binary cache. Raw and compressed
+        // frames have caches of their own, so a clip loaded both ways
+        // doesn't rewrite the cache of the other way every time.
+        string cacheName = GetCacheName(compressed ? fileName + ".z" :
+                                                     fileName);
+        if (!clip->loadCache(cacheName, stamp))
+        {
+            clip->parseAnimation(fileName);
+            if (!clip->saveCache(cacheName, stamp))
+                log("Cannot write cache: %s", cacheName.c_str());
+        }
+
+        clip->parents.resize(clip->numJoints);
+        for (int i = 0; i < clip->numJoints; i++)
+            clip->parents[i] = clip->jointInfos[i].parentID;
+
+        if (clip->frameRate < 1)
+            throw runtime_error("Malformed file: " + fileName);
+        clip->frameTicks = (TicksPerSecond + clip->frameRate / 2) /
+                           clip->frameRate;
+        clip->loopTicks = clip->frameTicks * clip->numFrames;
+        clip->animDuration = float(clip->loopTicks) / TicksPerSecond;
+        clip->prepareRootMotion();
+
+        entry = clip;
+        return clip;
+    }
+
+    void MD5Animation::ClipData::parseAnimation(const string& fileName)
+    {
+        MappedFile file;
+        if (!file.Open(fileName))
+            throw runtime_error("Cannot locate file: " + fileName);
 
-        if (fileLength <= 0)
+        if (file.Size() == 0)
             throw runtime_error("Malformed file: " + fileName);
 
-        string param, junk;
-        file >> param;
-        while (file.good())
+        // Remove whatever was left by the stale cache.
+        jointInfos.clear();
+        bounds.clear();
+        baseFrame.clear();
+        poses.clear();
+        clip.Clear();
+
+        // Local poses of all the frames, only for compression.
+        vector<Vector3D> positions;
+        vector<Quaternion> orients;
+        Skeleton pose;
+
+        // Frame data is read into the same buffer for every frame.
+        FrameData frame;
+        int frameCount = 0;
+
+        // Like the model, the file is parsed right from the mapped memory
+        // and every block goes to arrays sized by the header.
+        MD5Tokenizer tokenizer(file.Begin(), file.End());
+        Token param = tokenizer.Next();
+
+        while (!param.empty())
         {
             if (param == "MD5Version")
             {
-                int MD5Version;
-                file >> MD5Version;
+                int MD5Version = tokenizer.NextInt();
                 if (MD5Version != 10)
-                    throw runtime_error("Incompatible version: " + MD5Version);
+                    throw runtime_error("Incompatible version: " +
+                                        to_string(MD5Version));
             }
             else if (param == "commandline")
             {
-                file.ignore(fileLength, '\n');
+                tokenizer.SkipLine();
             }
             else if (param == "numFrames")
             {
-                file >> numFrames;
-                file.ignore(fileLength, '\n');
-                frames.reserve(numFrames);
+                numFrames = tokenizer.NextInt();
             }
             else if (param == "numJoints")
             {
-                file >> numJoints;
-                file.ignore(fileLength, '\n');
+                numJoints = tokenizer.NextInt();
             }
             else if (param == "frameRate")
             {
-                file >> frameRate;
-                file.ignore(fileLength, '\n');
+                frameRate = tokenizer.NextInt();
             }
             else if (param == "numAnimatedComponents")
             {
-                file >> numAnimatedComponents;
-                file.ignore(fileLength, '\n');
+                numAnimatedComponents = tokenizer.NextInt();
             }
             else if (param == "hierarchy")
             {
-                jointInfos.reserve(numJoints);
-                file >> junk; // Read the '{' character.
+                jointInfos.resize(numJoints);
+                tokenizer.Next(); // Read the '{' character.
                 for (int i = 0; i < numJoints; i++)
                 {
-                    JointInfo joint;
-                    file >> joint.name >> joint.parentID >> joint.flags
-                         >> joint.startIndex;
-                    file.ignore(fileLength, '\n');
+                    JointInfo& joint = jointInfos[i];
+                    joint.name = tokenizer.Next().str();
+                    joint.parentID = tokenizer.NextInt();
+                    joint.flags = tokenizer.NextInt();
+                    joint.startIndex = tokenizer.NextInt();
+                    tokenizer.SkipLine(); // Ignore comments.
 
                     removeQuotes(joint.name);
-
-                    jointInfos.push_back(joint);
                 }
-                file >> junk; // Read the '}' character.
-                file.ignore(fileLength, '\n');
+                tokenizer.Next(); // Read the '}' character.
+
+                prepareChannels();
             }
             else if (param == "bounds")
             {
-                file >> junk; // Read the '{' character.
-                file.ignore(fileLength, '\n');
-                bounds.reserve(numFrames);
+                bounds.resize(numFrames);
+                tokenizer.Next(); // Read the '{' character.
                 for (int i = 0; i < numFrames; i++)
                 {
-                    Bound bound;
-                    file >> junk; // Read the '(' character.
-                    file >> bound.min[0] >> bound.min[1] >> bound.min[2];
-                    file >> junk >> junk; // Read the ')' and '(' characters.
-                    file >> bound.max[0] >> bound.max[1] >> bound.max[2];
-                    file.ignore(fileLength, '\n');
-
-                    bounds.push_back(bound);
+                    Bound& bound = bounds[i];
+                    tokenizer.Next(); // Read the '(' character.
+                    bound.min[0] = tokenizer.NextFloat();
+                    bound.min[1] = tokenizer.NextFloat();
+                    bound.min[2] = tokenizer.NextFloat();
+                    tokenizer.Next(); tokenizer.Next(); // ')' '('
+                    bound.max[0] = tokenizer.NextFloat();
+                    bound.max[1] = tokenizer.NextFloat();
+                    bound.max[2] = tokenizer.NextFloat();
+                    tokenizer.SkipLine(); // Read the ')' character.
                 }
-                file >> junk; // Read the '}' character.
-                file.ignore(fileLength, '\n');
+                tokenizer.Next(); // Read the '}' character.
             }
             else if (param == "baseframe")
             {
-                file >> junk; // Read the '{' character.
-                file.ignore(fileLength, '\n');
-                baseFrame.reserve(numJoints);
+                baseFrame.resize(numJoints);
+                tokenizer.Next(); // Read the '{' character.
                 for (int i = 0; i < numJoints; i++)
                 {
-                    BaseFrameJoint joint;
-                    file >> junk;
-                    file >> joint.pos[0] >> joint.pos[1] >> joint.pos[2];
-                    file >> junk >> junk;
-                    file >> joint.orient.x >> joint.orient.y >> joint.orient.z;
-                    file.ignore(fileLength, '\n');
-
-                    baseFrame.push_back(joint);
+                    BaseFrameJoint& joint = baseFrame[i];
+                    tokenizer.Next(); // '('
+                    joint.pos[0] = tokenizer.NextFloat();
+                    joint.pos[1] = tokenizer.NextFloat();
+                    joint.pos[2] = tokenizer.NextFloat();
+                    tokenizer.Next(); tokenizer.Next(); // ')' '('
+                    joint.orient.x = tokenizer.NextFloat();
+                    joint.orient.y = tokenizer.NextFloat();
+                    joint.orient.z = tokenizer.NextFloat();
+                    tokenizer.SkipLine(); // ')' and comments.
                 }
-                file >> junk; // Read the '}' character.
-                file.ignore(fileLength, '\n');
+                tokenizer.Next(); // Read the '}' character.
             }
             else if (param == "frame")
             {
-                FrameData frame;
-                file >> frame.frameID >> junk;
-                file.ignore(fileLength, '\n');
-                frame.data.reserve(numAnimatedComponents);
-                for (int i = 0; i < numAnimatedComponents; i++)
+                // Poses of all the frames are allocated at once.
+                if (frameCount == 0)
                 {
-                    float frameDatum;
-                    file >> frameDatum;
-                    frame.data.push_back(frameDatum);
+                    size_t size = size_t(numFrames) * numJoints;
+                    if (compressed)
+                    {
+                        positions.resize(size);
+                        orients.resize(size);
+                    }
+                    else poses.resize(numFrames * PoseSize(numJoints));
+                    pose.resize(numJoints);
+                    frame.data.resize(numAnimatedComponents);
                 }
-                frames.push_back(frame);
+                if (frameCount >= numFrames)
+                    throw runtime_error("Malformed file: " + fileName);
 
-                // Build a skeleton for this frame.
-                buildFrameSkeleton(frame);
+                frame.frameID = tokenizer.NextInt();
+                tokenizer.Next(); // Read the '{' character.
+                for (int i = 0; i < numAnimatedComponents; i++)
+                    frame.data[i] = tokenizer.NextFloat();
+                tokenizer.Next(); // Read the '}' character.
 
-                file >> junk;
-                file.ignore(fileLength, '\n');
+                if (compressed)
+                {
+                    buildLocalPose(frame, pose.data());
+                    size_t first = size_t(frameCount) * numJoints;
+                    for (int i = 0; i < numJoints; i++)
+                    {
+                        positions[first + i] = pose[i].pos;
+                        orients[first + i] = pose[i].orient;
+                    }
+                }
+                else
+                {
+                    // Build a skeleton for this frame.
+                    buildLocalPose(frame, pose.data());
+                    buildObjectSpace(pose.data());
+                    storePose(pose.data(),
+                              &poses[frameCount * PoseSize(numJoints)]);
+                }
+                frameCount++;
             }
 
-            file >> param;
+            param = tokenizer.Next();
         }
 
-        // There will be no push_back() for animatedSkeleton,
-        // so we need to assign something inside a vector.
-        animatedSkeleton.assign(numJoints, SkeletonJoint());
+        if (compressed)
+            clip.Build(numFrames, numJoints, positions, orients);
+    }
 
-        animTime = 0.0f;
-        frameDuration = 1.0f / frameRate;
-        animDuration  = frameDuration * numFrames;
+    bool MD5Animation::ClipData::loadCache(const string& cacheName,
+                                           const FileStamp& source)
+    {
+        CacheReader cache;
+        if (!cache.Open(cacheName, cache_magic, cache_version, source))
+            return false;
+
+        if (!cache.Read(numFrames) || !cache.Read(numJoints) ||
+            !cache.Read(frameRate) || !cache.Read(numAnimatedComponents))
+            return false;
+
+        jointInfos.resize(numJoints);
+        for (int i = 0; i < numJoints; i++)
+        {
+            JointInfo& joint = jointInfos[i];
+            if (!cache.ReadString(joint.name) ||
+                !cache.Read(joint.parentID) ||
+                !cache.Read(joint.flags) ||
+                !cache.Read(joint.startIndex))
+                return false;
+        }
+
+        if (!cache.ReadArray(bounds) || !cache.ReadArray(baseFrame))
+            return false;
+
+        // The cache keeps the frames only in the form they were asked for.
+        bool cachedCompressed;
+        if (!cache.Read(cachedCompressed) || cachedCompressed != compressed)
+            return false;
+
+        poses.clear();
+        clip.Clear();
+        if (compressed) return clip.Read(cache);
+
+        return cache.ReadArray(poses) &&
+               poses.size() == numFrames * PoseSize(numJoints);
     }
 
-    void MD5Animation::removeQuotes(string& str)
+    bool MD5Animation::ClipData::saveCache(const string& cacheName,
+                                           const FileStamp& source) const
+    {
+        CacheWriter cache(cache_magic, cache_version, source);
+
+        cache.Write(numFrames);
+        cache.Write(numJoints);
+        cache.Write(frameRate);
+        cache.Write(numAnimatedComponents);
+
+        for (int i = 0; i < numJoints; i++)
+        {
+            const JointInfo& joint = jointInfos[i];
+            cache.WriteString(joint.name);
+            cache.Write(joint.parentID);
+            cache.Write(joint.flags);
+            cache.Write(joint.startIndex);
+        }
+
+        cache.WriteArray(bounds);
+        cache.WriteArray(baseFrame);
+
+        cache.Write(compressed);
+        if (compressed) clip.Write(cache);
+        else cache.WriteArray(poses);
+
+        return cache.Save(cacheName);
+    }
+
+    void MD5Animation::ClipData::removeQuotes(string& str)
     {
         size_t n;
         while ((n = str.find('\"')) != string::npos)
@@ -164,56 +421,58 @@ namespace ST
         }
     }
 
-    void MD5Animation::buildFrameSkeleton(const FrameData& frameData)
+    void MD5Animation::ClipData::prepareChannels()
     {
-        Skeleton skeleton;
-        skeleton.reserve(numJoints);
-        for (int i = 0; i < numJoints; i++) // Construct it joint by joint.
+        // Components are given in the order of the flag bits.
+        channels.resize(numJoints);
+        for (int i = 0; i < numJoints; i++)
         {
-            int j = 0;
-            const JointInfo& jointInfo = jointInfos[i];
-            SkeletonJoint animatedJoint = baseFrame[i];
-            animatedJoint.parent = jointInfos[i].parentID;
-
-            // Extract coordinates where joint "i" is placed in given frame.
-            if (jointInfo.flags & 1)
-            {
-                animatedJoint.pos[0] = frameData.data[jointInfo.startIndex + j];
-                j++;
-            }
-            if (jointInfo.flags & 2)
+            JointChannels& joint = channels[i];
+            joint.start = jointInfos[i].startIndex;
+            joint.count = 0;
+            for (int bit = 0; bit < 6; bit++)
             {
-                animatedJoint.pos[1] = frameData.data[jointInfo.startIndex + j];
-                j++;
-            }
-            if (jointInfo.flags & 4)
-            {
-                animatedJoint.pos[2] = frameData.data[jointInfo.startIndex + j];
-                j++;
-            }
-            if (jointInfo.flags & 8)
-            {
-                animatedJoint.orient.x = frameData.data[jointInfo.startIndex +
-                                                        j];
-                j++;
-            }
-            if (jointInfo.flags & 16)
-            {
-                animatedJoint.orient.y = frameData.data[jointInfo.startIndex +
-                                                        j];
-                j++;
-            }
-            if (jointInfo.flags & 32)
-            {
-                animatedJoint.orient.z = frameData.data[jointInfo.startIndex +
-                                                        j];
-                j++;
+                if (jointInfos[i].flags & (1 << bit))
+                    joint.target[joint.count++] = bit;
             }
+        }
+    }
 
+    void MD5Animation::ClipData::buildLocalPose(const FrameData& frameData,
+                                                SkeletonJoint* pose) const
+    {
+        for (int i = 0; i < numJoints; i++) // Construct it joint by joint.
+        {
+            const BaseFrameJoint& base = baseFrame[i];
+            float components[6] = { base.pos[0], base.pos[1], base.pos[2],
+                                    base.orient.x, base.orient.y,
+                                    base.orient.z };
+
+            // Replace components that are animated in given frame.
+            const JointChannels& joint = channels[i];
+            const float* data = frameData.data.data() + joint.start;
+            for (int j = 0; j < joint.count; j++)
+                components[joint.target[j]] = data[j];
+
+            SkeletonJoint& animatedJoint = pose[i];
+            animatedJoint.parent = jointInfos[i].parentID;
+            animatedJoint.pos = Vector3D(components[0], components[1],
+                                         components[2]);
+            animatedJoint.orient.x = components[3];
+            animatedJoint.orient.y = components[4];
+            animatedJoint.orient.z = components[5];
             animatedJoint.orient.ComputeW();
+        }
+    }
 
+    void MD5Animation::ClipData::buildObjectSpace(
+        SkeletonJoint* skeleton) const
+    {
+        for (int i = 0; i < numJoints; i++)
+        {
             // Joints are given in such order that parent of joint "i"
             // has been already processed and is now in object coordinate space.
+            SkeletonJoint& animatedJoint = skeleton[i];
             if (animatedJoint.parent >= 0)
             {
                 SkeletonJoint& parentJoint = skeleton[animatedJoint.parent];
@@ -223,45 +482,462 @@ namespace ST
                 animatedJoint.orient = parentJoint.orient * animatedJoint.orient;
                 animatedJoint.orient.Normalize();
             }
+        }
+    }
 
-            skeleton.push_back(animatedJoint);
+    void MD5Animation::ClipData::storePose(const SkeletonJoint* skeleton,
+                                           float* pose) const
+    {
+        size_t stride = PoseStride(numJoints);
+        for (size_t row = 0; row < 7; row++)
+        {
+            // Padding joints don't move and don't rotate.
+            float padding = row == 3 ? 1.0f : 0.0f;
+            fill(pose + row * stride + numJoints, pose + (row + 1) * stride,
+                 padding);
         }
 
-        skeletons.push_back(skeleton);
+        for (int i = 0; i < numJoints; i++)
+        {
+            const SkeletonJoint& joint = skeleton[i];
+            pose[i] = joint.pos[0];
+            pose[stride + i] = joint.pos[1];
+            pose[2 * stride + i] = joint.pos[2];
+            pose[3 * stride + i] = joint.orient.w;
+            pose[4 * stride + i] = joint.orient.x;
+            pose[5 * stride + i] = joint.orient.y;
+            pose[6 * stride + i] = joint.orient.z;
+        }
+    }
+
+    void MD5Animation::ClipData::prepareRootMotion()
+    {
+        rootJoint = 0;
+        for (int i = 0; i < numJoints; i++)
+        {
+            if (jointInfos[i].name == "origin" && parents[i] < 0)
+                rootJoint = i;
+        }
+        if (numFrames < 1 || numJoints < 1) return;
+
+        // The clip wraps from the last frame to the first one, over that
+        // time the root moves on by the step of the last frame. So the
+        // first frame comes again where the root is after the clip.
+        rootStart = rootAt(0);
+        Transform last = rootAt(numFrames - 1);
+        Transform step = numFrames > 1 ?
+            compose(inverse(rootAt(numFrames - 2)), last) : Transform();
+        rootLoop = compose(compose(last, step), inverse(rootStart));
+    }
+
+    MD5Animation::Transform MD5Animation::ClipData::rootAt(int frame) const
+    {
+        // The root has no parent, so local and object space are the same.
+        Transform t;
+        if (compressed)
+        {
+            clip.Decode(frame, rootJoint, t.pos, t.orient);
+            return t;
+        }
+
+        size_t stride = PoseStride(numJoints);
+        const float* p = &poses[frame * PoseSize(numJoints) + rootJoint];
+        t.pos = Vector3D(p[0], p[stride], p[2 * stride]);
+        t.orient = Quaternion(p[3 * stride], p[4 * stride], p[5 * stride],
+                              p[6 * stride]);
+        return t;
+    }
+
+    const float* MD5Animation::getFramePose(int frame)
+    {
+        int numJoints = data->numJoints;
+        if (!data->compressed) return &data->poses[frame * PoseSize(numJoints)];
+
+        // Take the cached frame or decode it in place of the oldest one.
+        frameUses++;
+        CachedFrame* slot = &frameCache[0];
+        for (size_t i = 0; i < frameCache.size(); i++)
+        {
+            CachedFrame& cached = frameCache[i];
+            if (cached.frame == frame)
+            {
+                cached.lastUse = frameUses;
+                return cached.pose.data();
+            }
+            if (cached.lastUse < slot->lastUse) slot = &cached;
+        }
+
+        slot->frame = frame;
+        slot->lastUse = frameUses;
+        for (int i = 0; i < numJoints; i++)
+        {
+            data->clip.Decode(frame, i, decoded[i].pos, decoded[i].orient);
+            decoded[i].parent = data->parents[i];
+        }
+        data->buildObjectSpace(decoded.data());
+        data->storePose(decoded.data(), slot->pose.data());
+        return slot->pose.data();
+    }
+
+    size_t MD5Animation::GetMemoryUsage() const
+    {
+        if (!data) return 0;
+
+        size_t size = data->poses.capacity() * sizeof(float);
+        if (data->compressed) size += data->clip.MemoryUsage();
+        return size + GetPlaybackMemoryUsage();
+    }
+
+    size_t MD5Animation::GetPlaybackMemoryUsage() const
+    {
+        size_t size = sizeof(*this) +
+                      frameCache.capacity() * sizeof(CachedFrame) +
+                      (localFrames.capacity() + blended.capacity() +
+                       rootFrames.capacity()) *
+                      sizeof(float) +
+                      (decoded.capacity() + animatedSkeleton.capacity()) *
+                      sizeof(SkeletonJoint) +
+                      changedJoints.capacity() / 8;
+        for (size_t i = 0; i < frameCache.size(); i++)
+            size += frameCache[i].pose.capacity() * sizeof(float);
+        return size;
+    }
+
+    void MD5Animation::SetBlendTolerance(float tolerance)
+    {
+        if (tolerance > 0.0f) blender.SetNlerp(tolerance);
+        else blender.SetSlerp();
+
+        // The same frames give another pose now.
+        lastFrame0 = lastFrame1 = -1;
     }
 
     void MD5Animation::Update(float deltaTimeSec)
     {
-        if (numFrames < 1) return;
+        Advance(llround(double(deltaTimeSec) * TicksPerSecond));
+    }
 
-        animTime += deltaTimeSec;
+    void MD5Animation::Advance(long long ticks)
+    {
+        if (!data || data->numFrames < 1) return;
+
+        long long prevTicks = animTicks;
+        Transform prevRoot = root;
+        animTicks += ticks;
+        sample();
+        if (extractRoot)
+            rootMotion = rootDelta(prevTicks, prevRoot, animTicks, root);
+    }
 
-        while (animTime > animDuration)
-            animTime -= animDuration;
-        while (animTime < 0.0f)
-            animTime += animDuration;
+    void MD5Animation::SetTicks(long long ticks)
+    {
+        animTicks = ticks;
+        rootMotion = Transform();
+        if (!data || data->numFrames < 1) return;
 
-        float frameNumber = animTime * frameRate;
-        int frame0 = int(floor(frameNumber)) % numFrames;
-        int frame1 = int(ceil(frameNumber)) % numFrames;
+        sample();
+    }
 
-        float quotient = fmod(animTime, frameDuration) / frameDuration;
+    void MD5Animation::SetRootMotion(bool extract)
+    {
+        extractRoot = extract;
+        rootMotion = Transform();
+
+        // The same frames give another pose now.
+        lastFrame0 = lastFrame1 = -1;
+        if (!extract || !data || data->numFrames < 1) return;
+
+        // Frames moved in place keep the identity in the padding.
+        size_t size = PoseSize(data->numJoints);
+        size_t stride = PoseStride(data->numJoints);
+        rootFrames.assign(2 * size, 0.0f);
+        fill_n(&rootFrames[3 * stride], stride, 1.0f);
+        fill_n(&rootFrames[size + 3 * stride], stride, 1.0f);
+
+        // The motion starts from the root of the current pose.
+        sample();
+    }
+
+    void MD5Animation::sample()
+    {
+        int frame0, frame1;
+        float quotient;
+        findFrames(animTicks, frame0, frame1, quotient);
         interpolateSkeletons(frame0, frame1, quotient);
     }
 
+    MD5Animation::Transform MD5Animation::rootDelta(
+        long long prevTicks, const Transform& prev,
+        long long ticks, const Transform& next) const
+    {
+        // Every loop passed since 'prevTicks'
+        // adds the motion of the whole clip.
+        long long loops = floorDiv(ticks, data->loopTicks) -
+                          floorDiv(prevTicks, data->loopTicks);
+        Transform loopBack = inverse(data->rootLoop);
+        Transform delta = next;
+        for (; loops > 0; loops--) delta = compose(data->rootLoop, delta);
+        for (; loops < 0; loops++) delta = compose(loopBack, delta);
+        delta = compose(inverse(prev), delta);
+
+        // The skeleton stays at the root of the first frame.
+        const Transform& start = data->rootStart;
+        return compose(compose(start, delta), inverse(start));
+    }
+
+    MD5Animation::Transform MD5Animation::SampleRootMotion(
+        long long fromTicks, long long toTicks) const
+    {
+        if (!data || data->numFrames < 1) return Transform();
+
+        int frame0, frame1;
+        float quotient;
+        findFrames(fromTicks, frame0, frame1, quotient);
+        Transform from = rootBetween(frame0, frame1, quotient);
+        findFrames(toTicks, frame0, frame1, quotient);
+        Transform to = rootBetween(frame0, frame1, quotient);
+        return rootDelta(fromTicks, from, toTicks, to);
+    }
+
+    void MD5Animation::SampleLocalPose(long long ticks, float* pose)
+    {
+        if (!data || data->numFrames < 1) return;
+
+        int frame0, frame1;
+        float quotient;
+        findFrames(ticks, frame0, frame1, quotient);
+
+        int numJoints = data->numJoints;
+        const CompressedClip& clip = data->clip;
+        if (data->compressed)
+        {
+            // Compressed poses are local and interpolated between keys,
+            // so the time is decoded right away, unless the clip wraps.
+            if (frame1 >= frame0)
+            {
+                float frame = frame1 > frame0 ? frame0 + quotient : frame0;
+                for (int i = 0; i < numJoints; i++)
+                    clip.Decode(frame, i, decoded[i].pos, decoded[i].orient);
+                data->storePose(decoded.data(), pose);
+                if (extractRoot) moveRootLocal(pose);
+                return;
+            }
+
+            float* pose0 = &localFrames[0];
+            float* pose1 = pose0 + PoseSize(numJoints);
+            for (int i = 0; i < numJoints; i++)
+                clip.Decode(frame0, i, decoded[i].pos, decoded[i].orient);
+            data->storePose(decoded.data(), pose0);
+            for (int i = 0; i < numJoints; i++)
+                clip.Decode(frame1, i, decoded[i].pos, decoded[i].orient);
+            data->storePose(decoded.data(), pose1);
+            blender.Blend(pose0, pose1, quotient, numJoints, pose);
+            if (extractRoot) moveRootLocal(pose);
+            return;
+        }
+
+        const float* pose0 = getFramePose(frame0);
+        const float* pose1 = getFramePose(frame1);
+        blender.Blend(pose0, pose1, quotient, numJoints, pose);
+        PoseToLocal(pose, data->parents.data(), numJoints, pose);
+        if (extractRoot) moveRootLocal(pose);
+    }
+
+    void MD5Animation::findFrames(long long ticks, int& frame0, int& frame1,
+                                  float& quotient) const
+    {
+        ticks %= data->loopTicks;
+        if (ticks < 0) ticks += data->loopTicks;
+
+        long long frameTicks = data->frameTicks;
+        long long rest = ticks % frameTicks;
+        frame0 = int(ticks / frameTicks);
+        frame1 = rest > 0 ? (frame0 + 1) % data->numFrames : frame0;
+        quotient = float(rest) / float(frameTicks);
+    }
+
     void MD5Animation::interpolateSkeletons(int frame0, int frame1,
                                             float quotient)
     {
+        int numJoints = data->numJoints;
+
+        // Paused, slowed down or stepped with a fixed step
+        // the animation often lands on the same pose again.
+        if (frame0 == lastFrame0 && frame1 == lastFrame1 &&
+            quotient == lastQuotient)
+        {
+            if (poseChanged)
+            {
+                changedJoints.assign(numJoints, false);
+                poseChanged = false;
+            }
+            return;
+        }
+        lastFrame0 = frame0;
+        lastFrame1 = frame1;
+        lastQuotient = quotient;
+
+        // Frame0 is the newest in the cache, so frame1 can't evict it.
+        const float* pose0 = getFramePose(frame0);
+        const float* pose1 = getFramePose(frame1);
+        if (extractRoot)
+        {
+            // Frames are blended in place, with the root of the first.
+            root = rootBetween(frame0, frame1, quotient);
+            float* inPlace0 = &rootFrames[0];
+            float* inPlace1 = inPlace0 + PoseSize(numJoints);
+            moveRoot(pose0, inPlace0);
+            moveRoot(pose1, inPlace1);
+            pose0 = inPlace0;
+            pose1 = inPlace1;
+        }
+        blender.Blend(pose0, pose1, quotient, numJoints, blended.data());
+
+        const float* p = blended.data();
+        size_t stride = PoseStride(numJoints);
+
+        poseChanged = false;
         for (int i = 0; i < numJoints; i++)
         {
             SkeletonJoint& animatedJoint = animatedSkeleton[i];
-            const SkeletonJoint& joint0 = skeletons[frame0][i];
-            const SkeletonJoint& joint1 = skeletons[frame1][i];
+            Vector3D pos(p[i], p[stride + i], p[2 * stride + i]);
+            Quaternion orient(p[3 * stride + i], p[4 * stride + i],
+                              p[5 * stride + i], p[6 * stride + i]);
+
+            // Joints that aren't animated in the clip keep their pose.
+            bool changed = !samePose(animatedJoint, pos, orient);
+            changedJoints[i] = changed;
+            poseChanged = poseChanged || changed;
+
+            animatedJoint.pos = pos;
+            animatedJoint.orient = orient;
+        }
+    }
+
+    MD5Animation::Bound MD5Animation::GetBound() const
+    {
+        if (!data || data->numFrames < 1) return Bound();
+
+        // Nothing is sampled before the first Update().
+        if (lastFrame0 < 0) return boundAt(0, 0, 0.0f, extractRoot);
+        return boundAt(lastFrame0, lastFrame1, lastQuotient, extractRoot);
+    }
 
-            animatedJoint.pos = Vector3D::Lerp(joint0.pos, joint1.pos, quotient);
-            animatedJoint.orient = Quaternion::Slerp(joint0.orient,
-                                                     joint1.orient, quotient);
+    MD5Animation::Bound MD5Animation::SampleBound(long long ticks) const
+    {
+        if (!data || data->numFrames < 1) return Bound();
+
+        int frame0, frame1;
+        float quotient;
+        findFrames(ticks, frame0, frame1, quotient);
+        return boundAt(frame0, frame1, quotient, extractRoot);
+    }
+
+    MD5Animation::Bound MD5Animation::boundAt(int frame0, int frame1,
+                                              float quotient,
+                                              bool inPlace) const
+    {
+        if (data->bounds.empty()) return Bound();
+
+        Bound b0 = data->bounds[frame0];
+        Bound b1 = data->bounds[frame1];
+        if (inPlace)
+        {
+            const Transform& start = data->rootStart;
+            b0 = moveBound(b0, compose(start, inverse(data->rootAt(frame0))));
+            b1 = moveBound(b1, compose(start, inverse(data->rootAt(frame1))));
         }
+
+        Bound bound;
+        bound.min = Vector3D::Lerp(b0.min, b1.min, quotient);
+        bound.max = Vector3D::Lerp(b0.max, b1.max, quotient);
+        return bound;
+    }
+
+    MD5Animation::Transform MD5Animation::rootBetween(int frame0, int frame1,
+                                                      float quotient) const
+    {
+        // The root is interpolated on its own, over the end of
+        // the clip towards the first frame one loop further.
+        Transform root0 = data->rootAt(frame0);
+        Transform root1 = data->rootAt(frame1);
+        if (frame1 < frame0) root1 = compose(data->rootLoop, root1);
+
+        Transform t;
+        t.pos = Vector3D::Lerp(root0.pos, root1.pos, quotient);
+        t.orient = Quaternion::Slerp(root0.orient, root1.orient, quotient);
+        return t;
+    }
+
+    MD5Animation::Transform MD5Animation::frameRoot(const float* pose) const
+    {
+        int r = data->rootJoint;
+        size_t stride = PoseStride(data->numJoints);
+        const float* p = pose + r;
+
+        Transform t;
+        t.pos = Vector3D(p[0], p[stride], p[2 * stride]);
+        t.orient = Quaternion(p[3 * stride], p[4 * stride], p[5 * stride],
+                              p[6 * stride]);
+        return t;
+    }
+
+    void MD5Animation::moveRoot(const float* pose, float* out) const
+    {
+        Transform move = compose(data->rootStart, inverse(frameRoot(pose)));
+        size_t stride = PoseStride(data->numJoints);
+        for (int i = 0; i < data->numJoints; i++)
+        {
+            const float* p = pose + i;
+            Vector3D pos = move.pos + move.orient.Rotate(
+                Vector3D(p[0], p[stride], p[2 * stride]));
+            Quaternion orient = move.orient *
+                Quaternion(p[3 * stride], p[4 * stride], p[5 * stride],
+                           p[6 * stride]);
+
+            float* o = out + i;
+            o[0] = pos[0];
+            o[stride] = pos[1];
+            o[2 * stride] = pos[2];
+            o[3 * stride] = orient.w;
+            o[4 * stride] = orient.x;
+            o[5 * stride] = orient.y;
+            o[6 * stride] = orient.z;
+        }
+    }
+
+    void MD5Animation::moveRootLocal(float* pose) const
+    {
+        Transform move = compose(data->rootStart, inverse(frameRoot(pose)));
+        size_t stride = PoseStride(data->numJoints);
+        for (int i = 0; i < data->numJoints; i++)
+        {
+            if (data->parents[i] >= 0) continue;
+
+            float* p = pose + i;
+            Vector3D pos = move.pos + move.orient.Rotate(
+                Vector3D(p[0], p[stride], p[2 * stride]));
+            Quaternion orient = move.orient *
+                Quaternion(p[3 * stride], p[4 * stride], p[5 * stride],
+                           p[6 * stride]);
+
+            p[0] = pos[0];
+            p[stride] = pos[1];
+            p[2 * stride] = pos[2];
+            p[3 * stride] = orient.w;
+            p[4 * stride] = orient.x;
+            p[5 * stride] = orient.y;
+            p[6 * stride] = orient.z;
+        }
+    }
+
+    bool MD5Animation::samePose(const SkeletonJoint& joint,
+                                const Vector3D& pos, const Quaternion& orient)
+    {
+        return joint.pos[0] == pos[0] && joint.pos[1] == pos[1] &&
+               joint.pos[2] == pos[2] &&
+               joint.orient.w == orient.w && joint.orient.x == orient.x &&
+               joint.orient.y == orient.y && joint.orient.z == orient.z;
     }
 }
 
@@ -1,14 +1,19 @@
 #ifndef MD5ANIMATION_H_INCLUDED
 #define MD5ANIMATION_H_INCLUDED
 
+#include <memory>
 #include <vector>
+#include "BinaryCache.h"
+#include "CompressedClip.h"
+#include "PoseBlend.h"
 #include "math/Vector3D.h"
 #include "math/Quaternion.h"
 
 namespace ST
 {
     /** The class is responsible for parsing .md5anim file
-        and animating of the skeleton.
+        and animating of the skeleton. Copies of an animation share
+        the frames and play them on their own.
     */
     class MD5Animation
     {
@@ -16,8 +21,38 @@ namespace ST
         MD5Animation();
         virtual ~MD5Animation();
 
-        void LoadAnimation(const std::string& fileName);
+        /** Compressed animations keep only the key poses of the joints
+            and build skeletons of the frames when they are needed.
+            They take much less memory but are a bit less precise.
+        */
+        void LoadAnimation(const std::string& fileName,
+                           bool compressed = false);
+
+        /** Ticks of the animation clock in a second. Durations of frames
+            at 24, 25, 30, 48, 50, 60, 90, 120 or 144 fps are whole numbers
+            of ticks, so stepping by ticks never drifts and gives
+            the same poses on every machine.
+        */
+        static const long long TicksPerSecond = 705600000;
+
+        /** Advances the clock by 'deltaTimeSec' rounded to ticks. */
         void Update(float deltaTimeSec);
+        /** Advances the clock by 'ticks', which may be negative. */
+        void Advance(long long ticks);
+        /** Clock since the start, it isn't wrapped into the clip. */
+        long long GetTicks() const
+        {
+            return animTicks;
+        }
+        /** Jumps to 'ticks' without any root motion. */
+        void SetTicks(long long ticks);
+
+        /** Writes the pose of the clip at 'ticks' on the clock, wrapped
+            into the clip, to 'pose' laid out as PoseSize(), with the joints
+            in the space of their parents. With root motion the pose is
+            in place like the played skeleton, which isn't changed.
+        */
+        void SampleLocalPose(long long ticks, float* pose);
 
         /** Stores info neccesery to build skeletons for each frame. */
         struct JointInfo
@@ -45,13 +80,12 @@ namespace ST
         };
         typedef std::vector<BaseFrameJoint> BaseFrameJointList;
 
-        // TODO: add description.
+        /** Animated components of the joints for one frame. */
         struct FrameData
         {
             int frameID;
             std::vector<float> data;
         };
-        typedef std::vector<FrameData> FrameDataList;
 
         /** Skeleton's joint for one frame. */
         struct SkeletonJoint
@@ -68,7 +102,15 @@ namespace ST
         };
         /** Stores the joints of the skeleton for a single frame. */
         typedef std::vector<SkeletonJoint> Skeleton;
-        typedef std::vector<Skeleton> FrameSkeletonList;
+
+        /** Rotation by 'orient' followed by translation by 'pos'. */
+        struct Transform
+        {
+            Transform() : orient(1.0f, 0.0f, 0.0f, 0.0f) {}
+
+            Math::Vector3D pos;
+            Math::Quaternion orient;
+        };
 
         const Skeleton& GetSkeleton() const
         {
@@ -77,35 +119,215 @@ namespace ST
 
         int GetNumJoints() const
         {
-            return numJoints;
+            return data ? data->numJoints : 0;
+        }
+
+        int GetNumFrames() const
+        {
+            return data ? data->numFrames : 0;
+        }
+
+        int GetFrameRate() const
+        {
+            return data ? data->frameRate : 0;
         }
 
         const JointInfo& GetJointInfo(size_t index) const
         {
-            return jointInfos[index];
+            return data->jointInfos[index];
+        }
+
+        /** Whether the last Update() changed the skeleton at all
+            and which joints it changed.
+        */
+        bool HasPoseChanged() const
+        {
+            return poseChanged;
+        }
+
+        bool IsJointChanged(size_t index) const
+        {
+            return changedJoints[index];
+        }
+
+        float GetDuration() const
+        {
+            return data ? data->animDuration : 0.0f;
+        }
+
+        bool IsCompressed() const
+        {
+            return data && data->compressed;
+        }
+
+        /** Box around the mesh played by the last Update(), interpolated
+            between the bounds of the frames given in the file. With
+            root motion the box is moved in place with the skeleton.
+            The box is empty if the file has no bounds.
+        */
+        Bound GetBound() const;
+        /** Box around the mesh of the clip at 'ticks' on the clock,
+            as SampleLocalPose() samples it.
+        */
+        Bound SampleBound(long long ticks) const;
+
+        /** Bytes taken by the poses of all the frames, which are shared
+            with the other copies, and by the state of this copy.
+        */
+        size_t GetMemoryUsage() const;
+        /** Bytes taken by the state of this copy only. */
+        size_t GetPlaybackMemoryUsage() const;
+
+        /** Frames are blended by slerp when 'tolerance' is zero, otherwise
+            by nlerp that keeps within 'tolerance' radians of slerp.
+        */
+        void SetBlendTolerance(float tolerance);
+
+        /** Takes the motion of the "origin" joint, or of the first joint
+            if there is none, out of the skeleton. The skeleton is then
+            played in place, with the origin where it is in the first
+            frame, and the motion is given by GetRootMotion(). Over
+            the end of the clip the origin goes on as in the last frame.
+        */
+        void SetRootMotion(bool extract);
+        bool IsRootMotion() const
+        {
+            return extractRoot;
+        }
+        /** Motion of the origin made by the last Update() or Advance(),
+            in the model space. The model matrix multiplied by it
+            places the in-place skeleton where the clip has moved it.
+        */
+        const Transform& GetRootMotion() const
+        {
+            return rootMotion;
+        }
+        /** Motion of the origin from 'fromTicks' to 'toTicks' on the clock,
+            as GetRootMotion() gives it after Advance() between them.
+            The played skeleton isn't changed.
+        */
+        Transform SampleRootMotion(long long fromTicks,
+                                   long long toTicks) const;
+        /** Joint that carries the root motion, -1 if nothing is loaded. */
+        int GetRootJoint() const
+        {
+            return data ? data->rootJoint : -1;
         }
 
     private:
-        void removeQuotes(std::string& str);
-        void buildFrameSkeleton(const FrameData& frameData);
+        /** Components of the local pose that the frame data replaces:
+            0-2 is the position, 3-5 is the orientation x, y, z.
+        */
+        struct JointChannels
+        {
+            int start;
+            int count;
+            unsigned char target[6];
+        };
+
+        /** Everything read from the file. It doesn't change after loading
+            and is shared by the copies of the animation and by the
+            animations loaded from the same file, so a crowd playing one
+            clip keeps its frames only once.
+        */
+        struct ClipData
+        {
+            ClipData();
+
+            void parseAnimation(const std::string& fileName);
+            bool loadCache(const std::string& cacheName,
+                           const FileStamp& source);
+            bool saveCache(const std::string& cacheName,
+                           const FileStamp& source) const;
+            void removeQuotes(std::string& str);
+            void prepareChannels();
+            void buildLocalPose(const FrameData& frameData,
+                                SkeletonJoint* pose) const;
+            void buildObjectSpace(SkeletonJoint* skeleton) const;
+            void storePose(const SkeletonJoint* skeleton, float* pose) const;
+            void prepareRootMotion();
+            Transform rootAt(int frame) const;
+
+            FileStamp          source;
+            JointInfoList      jointInfos;
+            std::vector<int>   parents;  // Parent of every joint.
+            std::vector<JointChannels> channels; // Decoding of the frame data.
+            BoundList          bounds;
+            BaseFrameJointList baseFrame;
+            std::vector<float> poses;    // Skeletons of all the frames one
+                                         // after another, see PoseSize().
+            CompressedClip     clip;     // Local poses of compressed frames.
+            bool               compressed;
+
+            int numFrames;
+            int numJoints;
+            int frameRate;
+            int numAnimatedComponents;
+
+            float     animDuration;
+            long long frameTicks; // Duration of a frame on the clock.
+            long long loopTicks;  // Duration of the clip on the clock.
+
+            int       rootJoint;  // Joint that carries the root motion.
+            Transform rootStart;  // Root in the first frame.
+            Transform rootLoop;   // Root motion over the whole clip.
+        };
+
+        static std::shared_ptr<const ClipData>
+        loadClip(const std::string& fileName, bool compressed);
+        const float* getFramePose(int frame);
+        /** Finds the frames of 'ticks', wrapped into the clip. */
+        void findFrames(long long ticks, int& frame0, int& frame1,
+                        float& quotient) const;
+        Bound boundAt(int frame0, int frame1, float quotient,
+                      bool inPlace) const;
+        void sample();
+        Transform rootBetween(int frame0, int frame1, float quotient) const;
+        Transform rootDelta(long long prevTicks, const Transform& prev,
+                            long long ticks, const Transform& next) const;
+        Transform frameRoot(const float* pose) const;
+        /** Moves 'pose' so that its root is where it's in the first frame. */
+        void moveRoot(const float* pose, float* out) const;
+        /** Same for a pose in the space of the parents, where only
+            the joints without a parent move.
+        */
+        void moveRootLocal(float* pose) const;
         void interpolateSkeletons(int frame0, int frame1, float quotient);
+        static bool samePose(const SkeletonJoint& joint,
+                             const Math::Vector3D& pos,
+                             const Math::Quaternion& orient);
 
     private:
-        JointInfoList      jointInfos;
-        BoundList          bounds;
-        BaseFrameJointList baseFrame;
-        FrameDataList      frames;
-        FrameSkeletonList  skeletons; // Skeletons for all the frames.
-        Skeleton           animatedSkeleton; // Interpolated skeleton.
+        std::shared_ptr<const ClipData> data;
 
-        int numFrames;
-        int numJoints;
-        int frameRate;
-        int numAnimatedComponents;
+        // The rest is the state of this copy only.
+
+        /** Decoded skeleton of a compressed frame. */
+        struct CachedFrame
+        {
+            int frame;
+            unsigned lastUse;
+            std::vector<float> pose;
+        };
+        std::vector<CachedFrame> frameCache;  // Recently used frames.
+        unsigned                 frameUses;
+        Skeleton                 decoded;     // Scratch for decoding frames.
+        std::vector<float>       localFrames; // Two decoded local poses.
+
+        PoseBlender        blender;
+        std::vector<float> blended;          // Blended pose of the frames.
+        Skeleton           animatedSkeleton; // Interpolated skeleton.
+        std::vector<bool>  changedJoints;    // Joints moved by last Update().
+        bool               poseChanged;
+        int                lastFrame0;       // Pose of animatedSkeleton.
+        int                lastFrame1;
+        float              lastQuotient;
+        long long          animTicks;
 
-        float animDuration;
-        float frameDuration;
-        float animTime;
+        bool               extractRoot;
+        std::vector<float> rootFrames;       // Two frames moved in place.
+        Transform          root;             // Root of the sampled pose.
+        Transform          rootMotion;       // Made by the last update.
     };
 }
 
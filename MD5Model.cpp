@@ -1,6 +1,10 @@
 #include <stdexcept>
+#include <algorithm>
 #include "Log.h"
 #include "MD5Model.h"
+#include "MD5Tokenizer.h"
+#include "MappedFile.h"
+#include "BinaryCache.h"
 #include "math/Utility.h"
 #include <iostream>
 
@@ -9,7 +13,65 @@ using namespace Math;
 
 namespace ST
 {
-    MD5Model::MD5Model() : hasAnimation(false)
+    namespace
+    {
+        // Change the version whenever cached data changes its layout.
+        const char cache_magic[] = "MD5M";
+        const unsigned cache_version = 2;
+
+        // Vertices or faces processed by one job when a job pool is used.
+        const size_t job_size = 512;
+
+        // Clean vertices between two dirty ones that are skinned
+        // anyway instead of starting a new range.
+        const size_t dirty_gap = 16;
+
+        /** Weight of a vertex while weights of a level of detail
+            are merged, the position and normal are in joint space.
+        */
+        struct LODWeight
+        {
+            int      joint;
+            float    bias;
+            Vector3D pos;
+            Vector3D normal;
+
+            bool operator< (const LODWeight& rhs) const
+            {
+                return bias > rhs.bias; // Heaviest first.
+            }
+        };
+
+        /** Box that holds 'bound' transformed by 'm'. */
+        MD5Animation::Bound transformBound(const MD5Animation::Bound& bound,
+                                           const Matrix4D& m)
+        {
+            Vector3D center = (bound.min + bound.max) * 0.5f;
+            Vector3D extent = (bound.max - bound.min) * 0.5f;
+
+            // Matrix is column-major.
+            Vector3D moved, reach;
+            for (int i = 0; i < 3; i++)
+            {
+                moved[i] = m[i] * center[0] + m[4 + i] * center[1] +
+                           m[8 + i] * center[2] + m[12 + i];
+                for (int j = 0; j < 3; j++)
+                    reach[i] += fabs(m[4 * j + i]) * extent[j];
+            }
+
+            MD5Animation::Bound box;
+            box.min = moved - reach;
+            box.max = moved + reach;
+            return box;
+        }
+    }
+
+    MD5Model::MD5Model()
+        : hasAnimation(false), skinningMode(SKINNING_STREAM), jobPool(0),
+          animGraph(0), skinDirty(true), poseCopied(false),
+          posePending(false), poseChanged(0), poseEdits(0), jointsEdited(false),
+          normalMode(NORMALS_SKINNED), lod(-1), lodTime(0.0f),
+          lodSkinsDirty(false), cullCamera(0), visible(true)
     {
     }
 
@@ -33,182 +95,299 @@ namespace ST
         return joints;
     }
 
-    void MD5Model::Load(const string& fileName, const Shader& shader)
+    const ForwardKinematics& MD5Model::GetKinematics() const
+    {
+        return kinematics;
+    }
+
+    size_t MD5Model::GetNumMeshes() const
+    {
+        // The last mesh is the skeleton.
+        return meshes.empty() ? 0 : meshes.size() - 1;
+    }
+
+    const vector<Vector3D>& MD5Model::GetPositions(size_t mesh) const
     {
-        ifstream file(fileName);
+        return meshes[mesh].positionBuffer;
+    }
+
+    const vector<Vector3D>& MD5Model::GetNormals(size_t mesh) const
+    {
+        return meshes[mesh].normalBuffer;
+    }
 
-        if (!file)
+    void MD5Model::Load(const string& fileName, const Shader& shader)
+    {
+        FileStamp stamp;
+        if (!GetFileStamp(fileName, stamp))
             throw runtime_error("Cannot locate file: " + fileName);
 
-        int pos = file.tellg();
-        file.seekg(0, std::ios::end );
-        int fileLength = file.tellg();
-        file.seekg(pos);
+        // Text is parsed and meshes are prepared only once,
+        // after that the model comes from the binary cache.
+        string cacheName = GetCacheName(fileName);
+        bool cached = loadCache(cacheName, stamp);
+        if (!cached)
+        {
+            parseModel(fileName);
+            if (!saveCache(cacheName, stamp))
+                log("Cannot write cache: %s", cacheName.c_str());
+        }
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            // Adjacency is cheap to build, so it isn't cached.
+            if (cached)
+            {
+                prepareAdjacency(meshes[i]);
+                prepareFaceNormals(meshes[i]);
+            }
+            prepareSkinStream(meshes[i]);
+            meshes[i].positionBuffer = meshes[i].bindPositions;
+            meshes[i].normalBuffer = meshes[i].bindNormals;
+        }
+        prepareJointEdits();
+        prepareBindBound();
+        printJoints();
 
-        if (fileLength <= 0)
-            throw runtime_error("Malformed file: " + fileName);
+        // Somewhere here we should know model orientation.
+        // Place the model somewhere in the world.
+        model = Matrix4D::MakeTranslate(0, -50, -150) *
+             // Matrix4D::MakeRotY(-3.14159f / 2) *
+              Matrix4D::MakeRotX(-PI / 2);
 
-        string junk;
-        string param;
+        // We can load in memory only after model was positioned.
+        this->shader = &shader;
+        loadModelInVideomemory();
+    }
+
+    void MD5Model::parseModel(const string& fileName)
+    {
+        MappedFile file;
+        if (!file.Open(fileName))
+            throw runtime_error("Cannot locate file: " + fileName);
+
+        if (file.Size() == 0)
+            throw runtime_error("Malformed file: " + fileName);
 
         joints.clear();
         meshes.clear();
 
-        file >> param;
+        // The whole file is parsed in one pass right from the mapped memory.
+        // Every block is written into arrays sized by the counts given
+        // in its header, so there is no reallocation while loading.
+        MD5Tokenizer tokenizer(file.Begin(), file.End());
+        Token param = tokenizer.Next();
 
-        while (file.good())
+        while (!param.empty())
         {
             if (param == "MD5Version")
             {
-                int MD5Version;
-                file >> MD5Version;
+                int MD5Version = tokenizer.NextInt();
                 if (MD5Version != 10)
-                    throw runtime_error("Incompatible version: " + MD5Version);
+                    throw runtime_error("Incompatible version: " +
+                                        to_string(MD5Version));
             }
             else if (param == "commandline")
             {
-                file.ignore(fileLength, '\n');
+                tokenizer.SkipLine();
             }
             else if (param == "numJoints")
             {
-                int numJoints;
-                file >> numJoints;
-                joints.resize(numJoints);
+                joints.resize(tokenizer.NextInt());
             }
             else if (param == "numMeshes")
             {
-                int numMeshes;
-                file >> numMeshes;
-                meshes.reserve(numMeshes);
+                meshes.reserve(tokenizer.NextInt());
             }
             else if (param == "joints")
             {
-                Joint joint;
-                file >> junk; // Read the '{' character.
+                tokenizer.Next(); // Read the '{' character.
                 for (size_t i = 0; i < joints.size(); i++)
                 {
-                    file >> joint.name >> joint.parentID >> junk
-                         >> joint.pos[0] >> joint.pos[1] >> joint.pos[2]
-                         >> junk >> junk
-                         >> joint.orient.x >> joint.orient.y >> joint.orient.z
-                         >> junk;
-
+                    Joint& joint = joints[i];
+                    Token name = tokenizer.Next();
+                    joint.parentID = tokenizer.NextInt();
+                    tokenizer.Next(); // '('
+                    joint.pos[0] = tokenizer.NextFloat();
+                    joint.pos[1] = tokenizer.NextFloat();
+                    joint.pos[2] = tokenizer.NextFloat();
+                    tokenizer.Next(); tokenizer.Next(); // ')' '('
+                    joint.orient.x = tokenizer.NextFloat();
+                    joint.orient.y = tokenizer.NextFloat();
+                    joint.orient.z = tokenizer.NextFloat();
+                    tokenizer.SkipLine(); // ')' and comments.
+
+                    joint.name = name.str();
                     removeQuotes(joint.name);
                     joint.orient.ComputeW();
-
-                    joints[i] = joint;
-                    file.ignore(fileLength, '\n'); // Ignore comments.
                 }
-                file >> junk; // Read the '}' character.
+                tokenizer.Next(); // Read the '}' character.
             }
             else if (param == "mesh")
             {
-                Mesh mesh;
+                meshes.push_back(Mesh());
+                Mesh& mesh = meshes.back();
 
-                file >> junk; // Read the '{' character.
-                file >> param; // Must be 'shader'
-                while (param != "}")
+                tokenizer.Next(); // Read the '{' character.
+                param = tokenizer.Next(); // Must be 'shader'
+                while (!param.empty() && param != "}")
                 {
                     if (param == "shader")
                     {
-                        file >> mesh.shader;
+                        mesh.shader = tokenizer.Next().str();
                         removeQuotes(mesh.shader);
 
                         // Texture file "mesh.shader" should be loaded here.
 
-                        file.ignore(fileLength, '\n'); // Ignore comments.
+                        tokenizer.SkipLine(); // Ignore comments.
                     }
                     else if (param == "numverts")
                     {
-                        int numVerts;
-                        file >> numVerts;
-                        mesh.verts.reserve(numVerts);
-                        mesh.tex2DBuffer.reserve(numVerts);
-                        mesh.positionBuffer.reserve(numVerts);
-                        mesh.normalBuffer.reserve(numVerts);
+                        int numVerts = tokenizer.NextInt();
+                        mesh.verts.resize(numVerts);
+                        mesh.tex2DBuffer.resize(numVerts);
 
-                        file.ignore(fileLength, '\n'); // Ignore comments.
+                        tokenizer.SkipLine(); // Ignore comments.
 
                         for (int i = 0; i < numVerts; i++)
                         {
-                            Vertex vert;
+                            Vertex& vert = mesh.verts[i];
 
-                            file >> junk >> junk >> junk // vert vertIndex (
-                                 >> vert.tex[0] >> vert.tex[1] >> junk // s t )
-                                 >> vert.startWeight >> vert.weightCount;
+                            // vert vertIndex ( s t ) startWeight weightCount
+                            tokenizer.Next(); tokenizer.Next(); tokenizer.Next();
+                            vert.tex[0] = tokenizer.NextFloat();
+                            vert.tex[1] = tokenizer.NextFloat();
+                            tokenizer.Next();
+                            vert.startWeight = tokenizer.NextInt();
+                            vert.weightCount = tokenizer.NextInt();
 
-                            file.ignore(fileLength, '\n'); // Ignore comments.
+                            tokenizer.SkipLine(); // Ignore comments.
 
-                            mesh.verts.push_back(vert);
-                            mesh.tex2DBuffer.push_back(vert.tex);
+                            mesh.tex2DBuffer[i] = vert.tex;
                         }
                     }
                     else if (param == "numtris")
                     {
-                        int numTris;
-                        file >> numTris;
-                        mesh.indexBuffer.reserve(3 * numTris);
+                        int numTris = tokenizer.NextInt();
+                        mesh.indexBuffer.resize(3 * numTris);
 
-                        file.ignore(fileLength, '\n'); // Ignore comments.
+                        tokenizer.SkipLine(); // Ignore comments.
 
-                        size_t ind[3];
-                        for (int i = 0; i < numTris; i++)
+                        GLuint* ind = mesh.indexBuffer.data();
+                        for (int i = 0; i < numTris; i++, ind += 3)
                         {
-                            file >> junk >> junk >> ind[0] >> ind[1] >> ind[2];
-                            file.ignore(fileLength, '\n'); // Ignore comments.
-
-                            mesh.indexBuffer.push_back(ind[0]);
-                            mesh.indexBuffer.push_back(ind[1]);
-                            mesh.indexBuffer.push_back(ind[2]);
+                            tokenizer.Next(); tokenizer.Next(); // tri triIndex
+                            ind[0] = tokenizer.NextInt();
+                            ind[1] = tokenizer.NextInt();
+                            ind[2] = tokenizer.NextInt();
+                            tokenizer.SkipLine(); // Ignore comments.
                         }
                     }
                     else if (param == "numweights")
                     {
-                        int numWeights;
-                        file >> numWeights;
-                        mesh.weights.reserve(numWeights);
+                        int numWeights = tokenizer.NextInt();
+                        mesh.weights.resize(numWeights);
 
-                        file.ignore(fileLength, '\n'); // Ignore comments.
+                        tokenizer.SkipLine(); // Ignore comments.
 
                         for (int i = 0; i < numWeights; i++)
                         {
-                            Weight weight;
-
-                            file >> junk >> junk >> weight.jointID
-                                 >> weight.bias >> junk >> weight.pos[0]
-                                 >> weight.pos[1] >> weight.pos[2];
-
-                            file.ignore(fileLength, '\n'); // Ignore comments.
-
-                            mesh.weights.push_back(weight);
+                            Weight& weight = mesh.weights[i];
+
+                            // weight weightIndex jointID bias ( x y z )
+                            tokenizer.Next(); tokenizer.Next();
+                            weight.jointID = tokenizer.NextInt();
+                            weight.bias = tokenizer.NextFloat();
+                            tokenizer.Next();
+                            weight.pos[0] = tokenizer.NextFloat();
+                            weight.pos[1] = tokenizer.NextFloat();
+                            weight.pos[2] = tokenizer.NextFloat();
+
+                            tokenizer.SkipLine(); // Ignore comments.
                         }
                     }
                     else
                     {
-                        file.ignore(fileLength, '\n'); // Ignore comments.
+                        tokenizer.SkipLine(); // Ignore comments.
                     }
 
-                    file >> param;
+                    param = tokenizer.Next();
                 }
 
                 prepareMesh(mesh);
+                prepareAdjacency(mesh);
                 prepareNormals(mesh);
-                meshes.push_back(mesh);
             }
 
-            file >> param;
+            param = tokenizer.Next();
         }
-        printJoints();
+    }
 
-        // Somewhere here we should know model orientation.
-        // Place the model somewhere in the world.
-        model = Matrix4D::MakeTranslate(0, -50, -150) *
-             // Matrix4D::MakeRotY(-3.14159f / 2) *
-              Matrix4D::MakeRotX(-PI / 2);
+    bool MD5Model::loadCache(const string& cacheName, const FileStamp& source)
+    {
+        CacheReader cache;
+        if (!cache.Open(cacheName, cache_magic, cache_version, source))
+            return false;
 
-        // We can load in memory only after model was positioned.
-        this->shader = &shader;
-        loadModelInVideomemory();
+        unsigned numJoints, numMeshes;
+        if (!cache.Read(numJoints)) return false;
+        joints.resize(numJoints);
+        for (size_t i = 0; i < joints.size(); i++)
+        {
+            Joint& joint = joints[i];
+            if (!cache.ReadString(joint.name) ||
+                !cache.Read(joint.parentID) ||
+                !cache.Read(joint.pos) ||
+                !cache.Read(joint.orient))
+                return false;
+        }
+
+        if (!cache.Read(numMeshes)) return false;
+        meshes.resize(numMeshes);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            Mesh& mesh = meshes[i];
+            if (!cache.ReadString(mesh.shader) ||
+                !cache.ReadArray(mesh.verts) ||
+                !cache.ReadArray(mesh.weights) ||
+                !cache.ReadArray(mesh.bindPositions) ||
+                !cache.ReadArray(mesh.bindNormals) ||
+                !cache.ReadArray(mesh.tex2DBuffer) ||
+                !cache.ReadArray(mesh.indexBuffer))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool MD5Model::saveCache(const string& cacheName,
+                             const FileStamp& source) const
+    {
+        CacheWriter cache(cache_magic, cache_version, source);
+
+        cache.Write<unsigned>(joints.size());
+        for (size_t i = 0; i < joints.size(); i++)
+        {
+            const Joint& joint = joints[i];
+            cache.WriteString(joint.name);
+            cache.Write(joint.parentID);
+            cache.Write(joint.pos);
+            cache.Write(joint.orient);
+        }
+
+        cache.Write<unsigned>(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const Mesh& mesh = meshes[i];
+            cache.WriteString(mesh.shader);
+            cache.WriteArray(mesh.verts);
+            cache.WriteArray(mesh.weights);
+            cache.WriteArray(mesh.bindPositions);
+            cache.WriteArray(mesh.bindNormals);
+            cache.WriteArray(mesh.tex2DBuffer);
+            cache.WriteArray(mesh.indexBuffer);
+        }
+
+        return cache.Save(cacheName);
     }
 
     void MD5Model::removeQuotes(string& str)
@@ -220,18 +399,30 @@ namespace ST
         }
     }
 
-    void MD5Model::LoadAnim(const std::string& fileName)
+    void MD5Model::LoadAnim(const std::string& fileName, bool compressed)
     {
         MD5Animation tempAnim;
-        tempAnim.LoadAnimation(fileName);
+        tempAnim.LoadAnimation(fileName, compressed);
         if (!checkAnimation(tempAnim))
             throw runtime_error("File contains wrong animation: " + fileName);
 
         animation = tempAnim;
         hasAnimation = true;
+        skinDirty = true;
     }
 
-    bool MD5Model::checkAnimation(const MD5Animation& anim) const
+    void MD5Model::SetAnimation(const MD5Animation& anim)
+    {
+        if (!checkAnimation(anim))
+            throw runtime_error("Animation doesn't match the model");
+
+        animation = anim;
+        hasAnimation = true;
+        skinDirty = true;
+    }
+
+    template <typename Animation>
+    bool MD5Model::checkAnimation(const Animation& anim) const
     {
         if (joints.size() != (size_t)anim.GetNumJoints())
         {
@@ -255,69 +446,140 @@ namespace ST
 
     void MD5Model::prepareMesh(Mesh& mesh)
     {
-        mesh.positionBuffer.clear();
+        mesh.bindPositions.resize(mesh.verts.size());
 
         // Compute vertex positions.
         for (size_t i = 0; i < mesh.verts.size(); i++)
         {
-            Vector3D finalVertex;
-            const Vertex& vert = mesh.verts[i];
-            for (int j = 0; j < vert.weightCount; j++)
-            {
-                const Weight& weight = mesh.weights[vert.startWeight + j];
-                const Joint& joint = joints[weight.jointID];
+            prepareVertex(mesh, i);
+        }
+    }
 
-                // Convert position from Joint local space to object space.
-                Vector3D rotPos = joint.orient.Rotate(weight.pos);
-                finalVertex += (joint.pos + rotPos) * weight.bias;
-            }
+    void MD5Model::prepareVertex(Mesh& mesh, size_t i)
+    {
+        Vector3D finalVertex;
+        const Vertex& vert = mesh.verts[i];
+        for (int j = 0; j < vert.weightCount; j++)
+        {
+            const Weight& weight = mesh.weights[vert.startWeight + j];
+            const Joint& joint = joints[weight.jointID];
 
-            mesh.positionBuffer.push_back(finalVertex);
+            // Convert position from Joint local space to object space.
+            Vector3D rotPos = joint.orient.Rotate(weight.pos);
+            finalVertex += (joint.pos + rotPos) * weight.bias;
         }
+
+        mesh.bindPositions[i] = finalVertex;
     }
 
     void MD5Model::prepareNormals(Mesh& mesh)
     {
-        mesh.normalBuffer.clear();
+        mesh.bindNormals.resize(mesh.verts.size());
+        prepareFaceNormals(mesh);
 
-        for (size_t i = 0; i < mesh.indexBuffer.size(); i += 3)
+        for (size_t i = 0; i < mesh.verts.size(); i++)
         {
-            const Vector3D& v0 = mesh.positionBuffer[mesh.indexBuffer[i + 0]];
-            const Vector3D& v1 = mesh.positionBuffer[mesh.indexBuffer[i + 1]];
-            const Vector3D& v2 = mesh.positionBuffer[mesh.indexBuffer[i + 2]];
+            mesh.bindNormals[i] = mesh.normals.Gather(i);
+            prepareBindNormal(mesh, i);
+        }
+    }
+
+    void MD5Model::prepareFaceNormals(Mesh& mesh)
+    {
+        mesh.normals.UpdateFaces(mesh.bindPositions.data(),
+                                 0, mesh.normals.NumTriangles());
+        mesh.bindFaces = true;
+    }
 
-            Vector3D normal = Vector3D::Cross(v2 - v0, v1 - v0);
+    void MD5Model::prepareBindNormal(Mesh& mesh, size_t i)
+    {
+        Vertex& vert = mesh.verts[i];
+        const Vector3D& normal = mesh.bindNormals[i];
 
-            // Note: normals are all 0's at the beginning.
-            mesh.verts[mesh.indexBuffer[i + 0]].normal += normal;
-            mesh.verts[mesh.indexBuffer[i + 1]].normal += normal;
-            mesh.verts[mesh.indexBuffer[i + 2]].normal += normal;
+        // Put the bind-pose normal into joint-local space
+        // so the animated normal can be computed faster later.
+        vert.normal = Vector3D(0);
+        for (int j = 0; j < vert.weightCount; j++)
+        {
+            const Weight& weight = mesh.weights[vert.startWeight + j];
+            const Joint& joint = joints[weight.jointID];
+            vert.normal += joint.orient.InverseRotate(normal) * weight.bias;
         }
+    }
 
+    void MD5Model::prepareAdjacency(Mesh& mesh)
+    {
+        vector<int> rows, items;
         for (size_t i = 0; i < mesh.verts.size(); i++)
         {
-            Vertex& vert = mesh.verts[i];
-
-            Vector3D normal = Vector3D::Normalize(vert.normal);
-            mesh.normalBuffer.push_back(normal);
+            const Vertex& vert = mesh.verts[i];
+            for (int j = 0; j < vert.weightCount; j++)
+            {
+                rows.push_back(mesh.weights[vert.startWeight + j].jointID);
+                items.push_back(i);
+            }
+        }
+        mesh.jointVerts.Build(joints.size(), rows, items);
+        mesh.normals.Build(mesh.verts.size(), mesh.indexBuffer);
+    }
 
-            // Reset the normal to calculate the bind-pose in joint space.
-            vert.normal = Vector3D(0);
+    void MD5Model::prepareSkinStream(Mesh& mesh)
+    {
+        SkinStream& skin = mesh.skin;
+        skin.Clear();
 
-            // Put the bind-pose normal into joint-local space
-            // so the animated normal can be computed faster later.
+        size_t numWeights = 0;
+        skin.offset.resize(mesh.verts.size() + 1);
+        for (size_t i = 0; i < mesh.verts.size(); i++)
+        {
+            skin.offset[i] = numWeights;
+            numWeights += mesh.verts[i].weightCount;
+        }
+        skin.offset.back() = numWeights;
+
+        skin.joint.resize(numWeights);
+        skin.bias.resize(numWeights);
+        skin.x.resize(numWeights);
+        skin.y.resize(numWeights);
+        skin.z.resize(numWeights);
+        skin.nx.resize(numWeights);
+        skin.ny.resize(numWeights);
+        skin.nz.resize(numWeights);
+        skin.px.resize(numWeights);
+        skin.py.resize(numWeights);
+        skin.pz.resize(numWeights);
+        skin.qx.resize(numWeights);
+        skin.qy.resize(numWeights);
+        skin.qz.resize(numWeights);
+        skin.joints.assign(mesh.verts.size(), 0);
+
+        // Copy weights in the order of vertices, so that they
+        // are streamed linearly whatever order the file had.
+        for (size_t i = 0; i < mesh.verts.size(); i++)
+        {
+            const Vertex& vert = mesh.verts[i];
             for (int j = 0; j < vert.weightCount; j++)
             {
                 const Weight& weight = mesh.weights[vert.startWeight + j];
-                const Joint& joint = joints[weight.jointID];
-                vert.normal += joint.orient.InverseRotate(normal) * weight.bias;
+                size_t k = skin.offset[i] + j;
+
+                skin.joints[i] |= JointBit(weight.jointID);
+                skin.joint[k] = weight.jointID;
+                skin.bias[k] = weight.bias;
+                skin.x[k] = weight.pos[0];
+                skin.y[k] = weight.pos[1];
+                skin.z[k] = weight.pos[2];
+                skin.nx[k] = vert.normal[0];
+                skin.ny[k] = vert.normal[1];
+                skin.nz[k] = vert.normal[2];
             }
         }
     }
 
-    void MD5Model::prepareMesh(Mesh& mesh, const MD5Animation::Skeleton& skel)
+    void MD5Model::prepareMesh(Mesh& mesh, const MD5Animation::Skeleton& skel,
+                               size_t first, size_t last)
     {
-        for (size_t i = 0; i < mesh.verts.size(); i++)
+        for (size_t i = first; i < last; i++)
         {
             const Vertex& vert = mesh.verts[i];
             Vector3D& pos = mesh.positionBuffer[i];
@@ -341,21 +603,264 @@ namespace ST
 
     void MD5Model::Update(float deltaTimeSec)
     {
-        if (hasAnimation)
+        Animate(deltaTimeSec);
+        Skin();
+    }
+
+    void MD5Model::Animate(float deltaTimeSec)
+    {
+        if (!IsAnimated()) return;
+
+        // Distant models take a pose only every few frames, at the
+        // frame nearest to the interval, and catch up the time.
+        lodTime += deltaTimeSec;
+        float interval = lod >= 0 ? lods[lod].updateInterval : 0.0f;
+        if (!skinDirty && lodTime + 0.5f * deltaTimeSec < interval)
+            return;
+        deltaTimeSec = lodTime;
+        lodTime = 0.0f;
+
+        if (animGraph) animGraph->Update(deltaTimeSec);
+        else animation.Update(deltaTimeSec);
+        if (lodSkinsDirty) prepareLODSkins();
+
+        // Joints edited after the last pose go back to the animation.
+        poseChanged = changedJoints() | poseEdits;
+        poseEdits = 0;
+        poseCopied = false;
+        posePending = true;
+    }
+
+    void MD5Model::Skin()
+    {
+        if (!posePending) return;
+        posePending = false;
+
+        // Vertices of a model out of the view get stale,
+        // so all of them are skinned when it comes back.
+        bool wasVisible = visible;
+        if (cullCamera)
+        {
+            MD5Animation::Bound bound = GetBound();
+            visible = cullCamera->IsBoxVisible(bound.min, bound.max);
+        }
+        if (!visible) return;
+
+        // The same pose as the last time costs nothing.
+        JointMask changed = skinDirty || !wasVisible ? ~0ull :
+                                                       poseChanged | poseEdits;
+        if (!changed) return;
+
+        if (poseEdits) storePoseEdits();
+        const MD5Animation::Skeleton& skeleton = skinnedSkeleton();
+        if (skinningMode == SKINNING_STREAM)
+            PackSkeleton(skeleton, packedSkeleton);
+        else if (skinningMode == SKINNING_MATRIX_PALETTE)
+            BuildMatrixPalette(skeleton, palette);
+
+        // A pool of one thread would only add the queuing overhead.
+        bool parallel = jobPool && jobPool->NumThreads() > 1;
+        for (size_t i = 0; i < meshes.size(); i++)
         {
-            animation.Update(deltaTimeSec);
-            const MD5Animation::Skeleton& skeleton = animation.GetSkeleton();
-            for (size_t i = 0; i < meshes.size(); i++)
+            Mesh& mesh = meshes[i];
+            const SkinStream& skin = currentSkin(mesh);
+            size_t numVerts = mesh.verts.size();
+            mesh.dirtyFirst = numVerts;
+            mesh.dirtyLast = 0;
+
+            // Only runs of vertices weighted by the changed joints
+            // are skinned. Short gaps are skinned too, so that
+            // a mesh isn't split into lots of tiny ranges.
+            size_t first = 0;
+            while (first < numVerts)
             {
-                prepareMesh(meshes[i], skeleton);
+                while (first < numVerts && !(skin.joints[first] & changed))
+                    first++;
+                if (first == numVerts) break;
+
+                size_t last = first + 1, gap = 0;
+                while (last + gap < numVerts && gap < dirty_gap)
+                {
+                    if (skin.joints[last + gap] & changed)
+                    {
+                        last += gap + 1;
+                        gap = 0;
+                    }
+                    else gap++;
+                }
+
+                mesh.dirtyFirst = min(mesh.dirtyFirst, first);
+                mesh.dirtyLast = last;
+                if (parallel) addSkinJobs(mesh, first, last);
+                else skinVertices(mesh, first, last);
+                first = last;
             }
-            reloadModel();
         }
+
+        // Every buffer must be skinned before it's uploaded.
+        if (parallel) jobPool->Wait();
+        if (normalMode == NORMALS_RECOMPUTED)
+            recomputeNormals(parallel);
+        reloadModel();
+        skinDirty = false;
+    }
+
+    bool MD5Model::IsAnimated() const
+    {
+        return animGraph || hasAnimation;
+    }
+
+    JointMask MD5Model::changedJoints() const
+    {
+        JointMask changed = 0;
+        if (animGraph ? !animGraph->HasPoseChanged() :
+                        !animation.HasPoseChanged())
+            return changed;
+
+        for (size_t i = 0; i < joints.size(); i++)
+        {
+            if (animGraph ? animGraph->IsJointChanged(i) :
+                            animation.IsJointChanged(i))
+                changed |= JointBit(i);
+        }
+        return changed;
     }
 
-    void MD5Model::loadModelInVideomemory()
+    const MD5Animation::Skeleton& MD5Model::animatedSkeleton() const
     {
-        Mesh skeleton;
+        return animGraph ? animGraph->GetSkeleton() : animation.GetSkeleton();
+    }
+
+    const MD5Animation::Skeleton& MD5Model::skinnedSkeleton() const
+    {
+        return poseEdits ? editedSkeleton : animatedSkeleton();
+    }
+
+    //-- Copies the edited pose to the skeleton the kernels skin --//
+    void MD5Model::storePoseEdits()
+    {
+        editedSkeleton.resize(pose.size());
+        for (size_t i = 0; i < pose.size(); i++)
+        {
+            editedSkeleton[i].parent = pose[i].parentID;
+            editedSkeleton[i].pos = pose[i].pos;
+            editedSkeleton[i].orient = pose[i].orient;
+        }
+    }
+
+    void MD5Model::addSkinJobs(Mesh& mesh, size_t first, size_t last)
+    {
+        // Ranges of vertices don't share any output,
+        // so they are skinned in parallel without locking.
+        for (; first < last; first += job_size)
+        {
+            size_t end = min(first + job_size, last);
+            jobPool->Add([this, &mesh, first, end]
+                         { skinVertices(mesh, first, end); });
+        }
+    }
+
+    void MD5Model::recomputeNormals(bool parallel)
+    {
+        // All the faces are computed before any normal is gathered.
+        for (size_t i = 0; i + 1 < meshes.size(); i++)
+        {
+            Mesh& mesh = meshes[i];
+            if (mesh.dirtyFirst >= mesh.dirtyLast) continue;
+
+            // Faces of the bind pose leave nothing to update in place.
+            bool partial = mesh.dirtyFirst > 0 ||
+                           mesh.dirtyLast < mesh.verts.size();
+            if (partial && !mesh.bindFaces)
+            {
+                // Only a part has moved, update it around in place.
+                edit.verts.clear();
+                for (size_t v = mesh.dirtyFirst; v < mesh.dirtyLast; v++)
+                    edit.verts.push_back(v);
+                mesh.normals.UpdateAround(mesh.positionBuffer.data(),
+                                          edit.verts, mesh.normalBuffer.data(),
+                                          edit.changed);
+                for (size_t k = 0; k < edit.changed.size(); k++)
+                {
+                    size_t v = edit.changed[k];
+                    mesh.dirtyFirst = min(mesh.dirtyFirst, v);
+                    mesh.dirtyLast = max(mesh.dirtyLast, v + 1);
+                }
+                continue;
+            }
+
+            mesh.dirtyFirst = 0;
+            mesh.dirtyLast = mesh.verts.size();
+            mesh.bindFaces = false;
+            size_t numTris = mesh.normals.NumTriangles();
+            for (size_t first = 0; first < numTris; first += job_size)
+            {
+                size_t last = min(first + job_size, numTris);
+                if (!parallel)
+                {
+                    mesh.normals.UpdateFaces(mesh.positionBuffer.data(),
+                                             first, last);
+                    continue;
+                }
+                jobPool->Add([&mesh, first, last]
+                    { mesh.normals.UpdateFaces(mesh.positionBuffer.data(),
+                                               first, last); });
+            }
+        }
+        if (parallel) jobPool->Wait();
+
+        // Every vertex gathers its own normal, so no locks are needed.
+        for (size_t i = 0; i + 1 < meshes.size(); i++)
+        {
+            Mesh& mesh = meshes[i];
+            size_t numVerts = mesh.verts.size();
+            if (mesh.dirtyFirst > 0 || mesh.dirtyLast < numVerts) continue;
+
+            for (size_t first = 0; first < numVerts; first += job_size)
+            {
+                size_t last = min(first + job_size, numVerts);
+                if (!parallel)
+                {
+                    mesh.normals.Gather(first, last, mesh.normalBuffer.data());
+                    continue;
+                }
+                jobPool->Add([&mesh, first, last]
+                    { mesh.normals.Gather(first, last,
+                                          mesh.normalBuffer.data()); });
+            }
+        }
+        if (parallel) jobPool->Wait();
+    }
+
+    void MD5Model::skinVertices(Mesh& mesh, size_t first, size_t last)
+    {
+        if (skinningMode == SKINNING_STREAM)
+        {
+            SkinStreamRange(currentSkin(mesh), packedSkeleton, first, last,
+                            mesh.positionBuffer.data(),
+                            mesh.normalBuffer.data());
+        }
+        else if (skinningMode == SKINNING_MATRIX_PALETTE)
+        {
+            SkinPaletteRange(currentSkin(mesh), palette, first, last,
+                             mesh.positionBuffer.data(),
+                             mesh.normalBuffer.data());
+        }
+        else prepareMesh(mesh, skinnedSkeleton(), first, last);
+    }
+
+    SkinStream& MD5Model::currentSkin(Mesh& mesh)
+    {
+        if (lod >= 0 && lod < (int)mesh.lodSkins.size() &&
+            mesh.lodSkins[lod].NumVertices() > 0)
+            return mesh.lodSkins[lod];
+        return mesh.skin;
+    }
+
+    void MD5Model::prepareSkeletonMesh(Mesh& skeleton)
+    {
+        skeleton.positionBuffer.clear();
+        skeleton.indexBuffer.clear();
         for ( size_t i = joints.size() - 1, j = 0; i > 0; i-- )
         {
             const Joint& cur = joints[i];
@@ -368,7 +873,16 @@ namespace ST
             skeleton.indexBuffer.push_back(j + 2);
             j += 3;
         }
-        skeleton.normalBuffer.push_back( Vector3D(0, 0, 0) );
+
+        // Skeleton isn't lit, but every vertex needs a normal attribute.
+        skeleton.normalBuffer.assign(skeleton.positionBuffer.size(),
+                                     Vector3D(0, 0, 0));
+    }
+
+    void MD5Model::loadModelInVideomemory()
+    {
+        Mesh skeleton;
+        prepareSkeletonMesh(skeleton);
         meshes.push_back( skeleton );
 
         MeshList::iterator mesh = meshes.begin();
@@ -419,18 +933,26 @@ namespace ST
         for (size_t i = 0; i < meshes.size(); i++)
         {
             const Mesh& mesh = meshes[i];
-            // Load mesh vertex attributes in videomemory.
+            if (mesh.dirtyFirst >= mesh.dirtyLast) continue;
+
+            // Load changed vertex attributes in videomemory.
+            GLintptr offset = mesh.dirtyFirst * sizeof(Vector3D);
+            GLsizeiptr size = (mesh.dirtyLast - mesh.dirtyFirst) *
+                              sizeof(Vector3D);
             glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, mesh.positionBuffer.size() *
-                sizeof(Vector3D), &mesh.positionBuffer[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, offset, size,
+                            &mesh.positionBuffer[mesh.dirtyFirst]);
             glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo[1]);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, mesh.normalBuffer.size() *
-                sizeof(Vector3D), &mesh.normalBuffer[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, offset, size,
+                            &mesh.normalBuffer[mesh.dirtyFirst]);
         }
     }
 
     void MD5Model::Draw(bool draw_skeleton)
     {
+        if (!visible) return;
+
+        shader->SetUniformMatrix("model", model);
         shader->SetUniformBool("has_light", true);
 
         MeshList::iterator mesh = meshes.begin();
@@ -460,22 +982,481 @@ namespace ST
         }
     }
 
+    void MD5Model::SetSkinningMode(SkinningMode mode)
+    {
+        skinningMode = mode;
+        skinDirty = true;
+    }
+
+    void MD5Model::SetJobPool(JobPool* pool)
+    {
+        jobPool = pool;
+    }
+
+    void MD5Model::SetAnimGraph(AnimGraph* graph)
+    {
+        if (graph && !checkAnimation(*graph))
+            throw runtime_error("Animation graph doesn't match the model");
+
+        animGraph = graph;
+        skinDirty = true;
+    }
+
+    void MD5Model::SetNormalMode(NormalMode mode)
+    {
+        normalMode = mode;
+        skinDirty = true;
+    }
+
+    void MD5Model::SetNormalWeighting(MeshNormals::Weighting weighting)
+    {
+        if (meshes.empty()) return;
+
+        // Bind-pose normals change, and so do the skinned ones.
+        // Animated meshes are uploaded by the next Skin().
+        for (size_t i = 0; i + 1 < meshes.size(); i++)
+        {
+            Mesh& mesh = meshes[i];
+            mesh.normals.SetWeighting(weighting);
+            prepareMesh(mesh);
+            prepareNormals(mesh);
+            mesh.dirtyFirst = mesh.verts.size();
+            mesh.dirtyLast = 0;
+            for (size_t v = 0; v < mesh.verts.size(); v++)
+            {
+                updateSkinNormal(mesh, v);
+                if (!IsAnimated()) markBindVertex(mesh, v);
+            }
+        }
+        meshes.back().dirtyFirst = meshes.back().dirtyLast = 0;
+
+        if (!IsAnimated()) reloadModel();
+        skinDirty = true;
+        lodSkinsDirty = !lods.empty();
+    }
+
+    void MD5Model::SetAnimationLODs(const AnimationLODs& levels)
+    {
+        // Every level is checked before the model is changed.
+        vector<int> follow;
+        for (size_t l = 0; l < levels.size(); l++)
+            lodFollow(levels[l], follow);
+
+        lods = levels;
+        lod = -1;
+        prepareLODSkins();
+        skinDirty = true;
+    }
+
+    void MD5Model::SetViewDistance(float distance)
+    {
+        int level = -1;
+        while (level + 1 < (int)lods.size() &&
+               lods[level + 1].minDistance <= distance)
+            level++;
+
+        // Other weights move every vertex.
+        if (level == lod) return;
+        lod = level;
+        skinDirty = true;
+    }
+
+    int MD5Model::GetAnimationLOD() const
+    {
+        return lod;
+    }
+
+    void MD5Model::lodFollow(const AnimationLOD& level,
+                             vector<int>& follow) const
+    {
+        vector<bool> culled(joints.size(), false);
+        for (size_t n = 0; n < level.culledJoints.size(); n++)
+        {
+            const string& name = level.culledJoints[n];
+            size_t i = 0;
+            while (i < joints.size() && joints[i].name != name) i++;
+            if (i == joints.size())
+                throw runtime_error("Model has no joint: " + name);
+            culled[i] = true;
+        }
+
+        // Parents go before their children.
+        follow.resize(joints.size());
+        for (size_t i = 0; i < joints.size(); i++)
+        {
+            int parent = joints[i].parentID;
+            if (parent >= 0 && culled[parent]) culled[i] = true;
+            if (culled[i] && parent < 0)
+                throw runtime_error("Root joint cannot be culled: " +
+                                    joints[i].name);
+            follow[i] = culled[i] ? follow[parent] : i;
+        }
+    }
+
+    void MD5Model::prepareLODSkins()
+    {
+        vector<int> follow;
+        for (size_t i = 0; i + 1 < meshes.size(); i++)
+            meshes[i].lodSkins.assign(lods.size(), SkinStream());
+
+        for (size_t l = 0; l < lods.size(); l++)
+        {
+            const AnimationLOD& level = lods[l];
+            if (level.culledJoints.empty() && level.maxWeights <= 0)
+                continue;
+
+            lodFollow(level, follow);
+            for (size_t i = 0; i + 1 < meshes.size(); i++)
+                prepareLODSkin(meshes[i], follow, level.maxWeights,
+                               meshes[i].lodSkins[l]);
+        }
+        lodSkinsDirty = false;
+    }
+
+    void MD5Model::prepareLODSkin(Mesh& mesh, const vector<int>& follow,
+                                  int maxWeights, SkinStream& lodSkin)
+    {
+        const SkinStream& skin = mesh.skin;
+        size_t numVerts = skin.NumVertices();
+        lodSkin.Clear();
+        lodSkin.offset.resize(numVerts + 1);
+        lodSkin.joints.assign(numVerts, 0);
+
+        vector<LODWeight> merged;
+        for (size_t i = 0; i < numVerts; i++)
+        {
+            merged.clear();
+            float total = 0.0f;
+            for (int k = skin.offset[i]; k < skin.offset[i + 1]; k++)
+            {
+                LODWeight w;
+                w.joint = follow[skin.joint[k]];
+                w.bias = skin.bias[k];
+                w.pos = Vector3D(skin.x[k], skin.y[k], skin.z[k]);
+                w.normal = Vector3D(skin.nx[k], skin.ny[k], skin.nz[k]);
+                total += w.bias;
+
+                // Culled joint keeps its bind pose relative to the one
+                // it follows, so its weight moves to that joint's space.
+                if (w.joint != skin.joint[k])
+                {
+                    const Joint& from = joints[skin.joint[k]];
+                    const Joint& to = joints[w.joint];
+                    w.pos = to.orient.InverseRotate(
+                        from.pos + from.orient.Rotate(w.pos) - to.pos);
+                    w.normal = to.orient.InverseRotate(
+                        from.orient.Rotate(w.normal));
+                }
+
+                // Weights of one joint add up to a single weight.
+                size_t m = 0;
+                while (m < merged.size() && merged[m].joint != w.joint) m++;
+                if (m == merged.size())
+                {
+                    merged.push_back(w);
+                    merged[m].pos = w.pos * w.bias;
+                    merged[m].normal = w.normal * w.bias;
+                    continue;
+                }
+                merged[m].bias += w.bias;
+                merged[m].pos += w.pos * w.bias;
+                merged[m].normal += w.normal * w.bias;
+            }
+
+            // The lightest weights are dropped, the rest take their bias.
+            if (maxWeights > 0 && (int)merged.size() > maxWeights)
+            {
+                partial_sort(merged.begin(), merged.begin() + maxWeights,
+                             merged.end());
+                merged.resize(maxWeights);
+            }
+            float kept = 0.0f;
+            for (size_t m = 0; m < merged.size(); m++)
+                kept += merged[m].bias;
+
+            lodSkin.offset[i] = lodSkin.joint.size();
+            for (size_t m = 0; m < merged.size(); m++)
+            {
+                const LODWeight& w = merged[m];
+                float scale = w.bias > 0.0f ? 1.0f / w.bias : 0.0f;
+                Vector3D pos = w.pos * scale;
+                Vector3D normal = w.normal * scale;
+
+                lodSkin.joints[i] |= JointBit(w.joint);
+                lodSkin.joint.push_back(w.joint);
+                lodSkin.bias.push_back(kept > 0.0f ? w.bias * total / kept :
+                                                     0.0f);
+                lodSkin.x.push_back(pos[0]);
+                lodSkin.y.push_back(pos[1]);
+                lodSkin.z.push_back(pos[2]);
+                lodSkin.nx.push_back(normal[0]);
+                lodSkin.ny.push_back(normal[1]);
+                lodSkin.nz.push_back(normal[2]);
+            }
+        }
+        size_t numWeights = lodSkin.joint.size();
+        lodSkin.offset.back() = numWeights;
+
+        lodSkin.px.resize(numWeights);
+        lodSkin.py.resize(numWeights);
+        lodSkin.pz.resize(numWeights);
+        lodSkin.qx.resize(numWeights);
+        lodSkin.qy.resize(numWeights);
+        lodSkin.qz.resize(numWeights);
+    }
+
     const Matrix4D& MD5Model::GetModelTrans() const
     {
         return model;
     }
 
+    void MD5Model::SetModelTrans(const Matrix4D& trans)
+    {
+        model = trans;
+    }
+
+    void MD5Model::SetCullCamera(const Camera* camera)
+    {
+        // Vertices of a model out of the view are stale.
+        cullCamera = camera;
+        skinDirty = skinDirty || !visible;
+        visible = true;
+    }
+
+    bool MD5Model::IsVisible() const
+    {
+        return visible;
+    }
+
+    MD5Animation::Bound MD5Model::GetBound() const
+    {
+        MD5Animation::Bound bound = bindBound;
+        if (animGraph) bound = animGraph->GetBound();
+        else if (hasAnimation) bound = animation.GetBound();
+        return transformBound(bound, model);
+    }
+
+    void MD5Model::prepareBindBound()
+    {
+        bindBound = MD5Animation::Bound();
+        bool first = true;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const PositionBuffer& positions = meshes[i].bindPositions;
+            for (size_t v = 0; v < positions.size(); v++)
+            {
+                if (first) bindBound.min = bindBound.max = positions[v];
+                first = false;
+                for (int c = 0; c < 3; c++)
+                {
+                    bindBound.min[c] = min(bindBound.min[c], positions[v][c]);
+                    bindBound.max[c] = max(bindBound.max[c], positions[v][c]);
+                }
+            }
+        }
+    }
+
     void MD5Model::AffectJoint()
     {
         //   q -> mat  ,  .
-        joints[7].orient = Quaternion( 3.14159 / 4, Vector3D(0, 0, 1) ) * joints[7].orient;
-        for (size_t i = 0; i < meshes.size(); i++)
+        RotateJoint(7, Quaternion( 3.14159 / 4, Vector3D(0, 0, 1) ));
+        UpdateJoints();
+    }
+
+    void MD5Model::RotateJoint(size_t index, const Quaternion& rotation)
+    {
+        // The whole subtree turns around the joint.
+        int parent = joints[index].parentID;
+        Quaternion space = parent >= 0 ? joints[parent].orient.Conjugate() :
+                                         Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+        kinematics.SetLocalOrient(index,
+                                  space * rotation * joints[index].orient);
+        updateKinematics();
+    }
+
+    void MD5Model::SetLocalJoint(size_t index, const Quaternion& orient)
+    {
+        kinematics.SetLocalOrient(index, orient);
+        updateKinematics();
+    }
+
+    //-- Moves the joints below edited local transforms --//
+    void MD5Model::updateKinematics()
+    {
+        kinematics.Update();
+        const vector<int>& changed = kinematics.GetChanged();
+        for (size_t k = 0; k < changed.size(); k++)
+        {
+            int i = changed[k];
+            joints[i].pos = kinematics.GetPos(i);
+            joints[i].orient = kinematics.GetOrient(i);
+            edit.joints[i] = true;
+        }
+        jointsEdited = jointsEdited || !changed.empty();
+    }
+
+    void MD5Model::InvalidateJoint(size_t index)
+    {
+        // Parents are popped before their children, so each joint
+        // takes its local transform from the new pose of its parent.
+        edit.stack.assign(1, index);
+        while (!edit.stack.empty())
+        {
+            int i = edit.stack.back();
+            edit.stack.pop_back();
+
+            kinematics.SetPose(i, joints[i].pos, joints[i].orient);
+            edit.joints[i] = true;
+            edit.stack.insert(edit.stack.end(), jointChildren.Begin(i),
+                              jointChildren.End(i));
+        }
+        jointsEdited = true;
+    }
+
+    MD5Model::JointList& MD5Model::GetPose()
+    {
+        // Names and parents come from the bind pose.
+        if (poseCopied) return pose;
+        if (pose.size() != joints.size()) pose = joints;
+
+        const MD5Animation::Skeleton& played = animatedSkeleton();
+        for (size_t i = 0; i < played.size() && i < pose.size(); i++)
+        {
+            pose[i].pos = played[i].pos;
+            pose[i].orient = played[i].orient;
+        }
+        poseCopied = true;
+        return pose;
+    }
+
+    void MD5Model::InvalidatePose(size_t index)
+    {
+        // Edits are skinned from 'pose', so it must hold the played pose.
+        GetPose();
+        edit.stack.assign(1, index);
+        while (!edit.stack.empty())
+        {
+            int i = edit.stack.back();
+            edit.stack.pop_back();
+
+            poseEdits |= JointBit(i);
+            edit.stack.insert(edit.stack.end(), jointChildren.Begin(i),
+                              jointChildren.End(i));
+        }
+    }
+
+    void MD5Model::UpdateJoints()
+    {
+        if (!jointsEdited) return;
+
+        // Skeleton is the last mesh, it's rebuilt from the joints below.
+        for (size_t m = 0; m + 1 < meshes.size(); m++)
         {
-            prepareMesh(meshes[i]);
-            prepareNormals(meshes[i]);
+            Mesh& mesh = meshes[m];
+            mesh.dirtyFirst = mesh.verts.size();
+            mesh.dirtyLast = 0;
+
+            // Vertices weighted by the edited joints.
+            edit.verts.clear();
+            for (size_t j = 0; j < edit.joints.size(); j++)
+            {
+                if (!edit.joints[j]) continue;
+                for (const int* v = mesh.jointVerts.Begin(j);
+                     v != mesh.jointVerts.End(j); ++v)
+                {
+                    if (edit.vertMarks[*v]) continue;
+                    edit.vertMarks[*v] = 1;
+                    edit.verts.push_back(*v);
+                    prepareVertex(mesh, *v);
+                }
+            }
+
+            for (size_t k = 0; k < edit.verts.size(); k++)
+                edit.vertMarks[edit.verts[k]] = 0;
+
+            // Faces around them and all the vertices of these faces.
+            // Normals recomputed from the skinned faces left them animated.
+            if (!mesh.bindFaces) prepareFaceNormals(mesh);
+            mesh.normals.UpdateAround(mesh.bindPositions.data(), edit.verts,
+                                      mesh.bindNormals.data(), edit.changed);
+            for (size_t k = 0; k < edit.changed.size(); k++)
+            {
+                int v = edit.changed[k];
+                prepareBindNormal(mesh, v);
+                updateSkinNormal(mesh, v);
+            }
+
+            // Animated meshes are skinned again by the next Skin().
+            if (IsAnimated()) continue;
+            for (size_t k = 0; k < edit.verts.size(); k++)
+                markBindVertex(mesh, edit.verts[k]);
+            for (size_t k = 0; k < edit.changed.size(); k++)
+                markBindVertex(mesh, edit.changed[k]);
         }
 
+        Mesh& skeleton = meshes.back();
+        prepareSkeletonMesh(skeleton);
+        skeleton.dirtyFirst = 0;
+        skeleton.dirtyLast = skeleton.positionBuffer.size();
+
         reloadModel();
+        edit.joints.assign(joints.size(), false);
+        jointsEdited = false;
+
+        // Animated normals depend on the bind-pose normals.
+        skinDirty = true;
+        lodSkinsDirty = !lods.empty();
+    }
+
+    //-- Copies the bind-pose vertex to the buffers to upload --//
+    void MD5Model::markBindVertex(Mesh& mesh, size_t i)
+    {
+        mesh.positionBuffer[i] = mesh.bindPositions[i];
+        mesh.normalBuffer[i] = mesh.bindNormals[i];
+        mesh.dirtyFirst = min(mesh.dirtyFirst, i);
+        mesh.dirtyLast = max(mesh.dirtyLast, i + 1);
+    }
+
+    void MD5Model::updateSkinNormal(Mesh& mesh, size_t i)
+    {
+        SkinStream& skin = mesh.skin;
+        const Vector3D& normal = mesh.verts[i].normal;
+        for (int k = skin.offset[i]; k < skin.offset[i + 1]; k++)
+        {
+            skin.nx[k] = normal[0];
+            skin.ny[k] = normal[1];
+            skin.nz[k] = normal[2];
+        }
+    }
+
+    void MD5Model::prepareJointEdits()
+    {
+        vector<int> parents, children;
+        size_t maxVerts = 0;
+        for (size_t i = 0; i < joints.size(); i++)
+        {
+            if (joints[i].parentID < 0) continue;
+            parents.push_back(joints[i].parentID);
+            children.push_back(i);
+        }
+        jointChildren.Build(joints.size(), parents, children);
+
+        // Parents go before their children in md5 files.
+        parents.resize(joints.size());
+        for (size_t i = 0; i < joints.size(); i++)
+            parents[i] = joints[i].parentID;
+        kinematics.Build(parents);
+        for (size_t i = 0; i < joints.size(); i++)
+            kinematics.SetPose(i, joints[i].pos, joints[i].orient);
+        kinematics.Update();
+
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            maxVerts = max(maxVerts, meshes[i].verts.size());
+        }
+        edit.joints.assign(joints.size(), false);
+        edit.vertMarks.assign(maxVerts, 0);
+        jointsEdited = false;
     }
 
     void MD5Model::printJoints()
@@ -3,11 +3,19 @@
 
 #include "OpenGL.h"
 #include "Shader.h"
+#include "Camera.h"
 #include "math/Matrix4D.h"
 #include "math/Vector2D.h"
 #include "math/Vector3D.h"
 #include "math/Quaternion.h"
 #include "MD5Animation.h"
+#include "AnimGraph.h"
+#include "BinaryCache.h"
+#include "Skinning.h"
+#include "JobPool.h"
+#include "Adjacency.h"
+#include "MeshNormals.h"
+#include "ForwardKinematics.h"
 
 namespace ST
 {
@@ -23,19 +31,142 @@ namespace ST
         };
         typedef std::vector<Joint> JointList;
 
+        /** Layout of the weights used to skin animated meshes. */
+        enum SkinningMode
+        {
+            SKINNING_WEIGHT_LIST,   // Vertices index weights of the md5 mesh.
+            SKINNING_STREAM,        // Weights are streamed from SkinStream.
+            SKINNING_MATRIX_PALETTE // SkinStream weights are transformed
+                                    // by one matrix per joint.
+        };
+
+        /** Source of the normals of animated meshes. */
+        enum NormalMode
+        {
+            NORMALS_SKINNED,   // Bind-pose normals are skinned by weights.
+            NORMALS_RECOMPUTED // Normals are gathered from skinned faces.
+        };
+
+        /** Animation level of detail, used from 'minDistance' on.
+            Culled joints, given by the roots of their subtrees, follow
+            their nearest kept ancestor as in the bind pose, so their
+            weights are merged into the weights of that ancestor.
+            Vertices keep at most 'maxWeights' of the heaviest weights.
+        */
+        struct AnimationLOD
+        {
+            AnimationLOD() : minDistance(0.0f), updateInterval(0.0f),
+                             maxWeights(0)
+            {
+            }
+
+            float minDistance;
+            float updateInterval; // Seconds between poses, 0 for each frame.
+            std::vector<std::string> culledJoints;
+            int   maxWeights;     // 0 keeps all of them.
+        };
+        typedef std::vector<AnimationLOD> AnimationLODs;
+
         MD5Model();
         virtual ~MD5Model();
 
         void Load(const std::string& fileName, const Shader& shader);
-        void LoadAnim(const std::string& fileName);
+        void LoadAnim(const std::string& fileName, bool compressed = false);
+        /** Plays a copy of 'anim', which shares the frames with it,
+            so a crowd of models can play one loaded clip.
+        */
+        void SetAnimation(const MD5Animation& anim);
         void Draw( bool draw_skeleton );
         void Update(float deltaTimeSec);
+        /** Update() in two steps, so the played pose can be edited
+            in between, e.g. by IKBatch. Animate() plays the animation
+            and Skin() skins the pose of GetPose() with the edits.
+        */
+        void Animate(float deltaTimeSec);
+        void Skin();
+        /** Whether the model plays an animation or a graph. */
+        bool IsAnimated() const;
 
         void AffectJoint();
 
+        /** Rotates the joint and all its children around the joint.
+            Vertices are updated by UpdateJoints().
+        */
+        void RotateJoint(size_t index, const Math::Quaternion& rotation);
+        /** Sets the rotation of the joint relative to its parent,
+            its children follow it. Vertices are updated by UpdateJoints().
+        */
+        void SetLocalJoint(size_t index, const Math::Quaternion& orient);
+        /** Marks the subtree of the joint as changed after
+            joints were written through GetJoint() or GetSkeleton().
+        */
+        void InvalidateJoint(size_t index);
+        /** Pose played by the last Animate(), in the same space
+            as GetSkeleton(). Joints written to it are skinned by Skin()
+            after InvalidatePose(), until the next Animate() plays
+            the animation over them again.
+        */
+        JointList& GetPose();
+        /** Marks the subtree of the joint of GetPose() as changed. */
+        void InvalidatePose(size_t index);
+        /** Skins again only the vertices weighted by changed joints,
+            recomputes normals of the triangles around them
+            and uploads the changed ranges. Animated models only
+            update their bind pose, the next Update() skins it.
+        */
+        void UpdateJoints();
+        void SetSkinningMode(SkinningMode mode);
+        /** Meshes are skinned by the jobs of 'pool' if it isn't null.
+            The pool must outlive the model or be reset to null.
+        */
+        void SetJobPool(JobPool* pool);
+        /** Poses come from 'graph' instead of the animation if it isn't
+            null. The graph is updated by Update() and must outlive the
+            model or be reset to null. Throws if the joints don't match.
+        */
+        void SetAnimGraph(AnimGraph* graph);
+        void SetNormalMode(NormalMode mode);
+        /** Recomputes the bind-pose normals. Must be called after Load().
+            Animated models are skinned with them by the next Update().
+        */
+        void SetNormalWeighting(MeshNormals::Weighting weighting);
+        /** Levels of detail sorted by the distance, the model is at
+            full detail nearer than the first one. Weights of the levels
+            apply to the stream and matrix palette skinning.
+            Must be called after Load(), throws if a joint is unknown
+            or has no ancestor left to follow.
+        */
+        void SetAnimationLODs(const AnimationLODs& lods);
+        /** Picks the level of detail for the distance to the viewer. */
+        void SetViewDistance(float distance);
+        /** Index of the current level of detail, -1 for full detail. */
+        int GetAnimationLOD() const;
+
+        /** Animated models out of the view of 'camera' keep playing,
+            but aren't skinned, uploaded or drawn until Update() finds
+            them in the view. Models aren't culled if 'camera' is null.
+            The camera must outlive the model or be reset to null.
+        */
+        void SetCullCamera(const Camera* camera);
+        /** Whether the model was in the view at the last Update(). */
+        bool IsVisible() const;
+        /** Box around the mesh in the world space. Animated meshes
+            take the bounds of the played frames.
+        */
+        MD5Animation::Bound GetBound() const;
+
         Joint& GetJoint(size_t i);
         JointList& GetSkeleton();
+        /** Local and object-space transforms of the joints. */
+        const ForwardKinematics& GetKinematics() const;
+        /** Meshes skinned by the last Update() or UpdateJoints(),
+            without the skeleton.
+        */
+        size_t GetNumMeshes() const;
+        const std::vector<Math::Vector3D>& GetPositions(size_t mesh) const;
+        const std::vector<Math::Vector3D>& GetNormals(size_t mesh) const;
         const Math::Matrix4D& GetModelTrans() const;
+        void SetModelTrans(const Math::Matrix4D& trans);
 
     protected:
         typedef std::vector<Math::Vector3D> PositionBuffer;
@@ -76,24 +207,82 @@ namespace ST
             GLuint vbo[3];       // Buffer for vertex attributes and indices.
             GLuint vao;          // Vertex Array Object.
 
+            // Weights in structure-of-arrays layout for skinning.
+            SkinStream skin;
+            // Weights of each level of detail, empty if it keeps them all.
+            std::vector<SkinStream> lodSkins;
+
+            // Lookups for partial updates after joints are edited.
+            Adjacency    jointVerts;  // Vertices weighted by each joint.
+            MeshNormals  normals;     // Face normals, faces around vertices.
+            bool         bindFaces;   // Face normals are of the bind pose.
+
+            // Bind pose, the skinned buffers below hold the animated one.
+            PositionBuffer bindPositions;
+            NormalBuffer   bindNormals;
+
             // Buffers used for rendering.
             PositionBuffer positionBuffer;
             NormalBuffer   normalBuffer;
             Tex2DBuffer    tex2DBuffer;
             IndexBuffer    indexBuffer;
+
+            // Vertices [dirtyFirst; dirtyLast) are uploaded by reloadModel().
+            size_t dirtyFirst;
+            size_t dirtyLast;
         };
         typedef std::vector<Mesh> MeshList;
 
     private:
+        void parseModel(const std::string& fileName);
+        bool loadCache(const std::string& cacheName, const FileStamp& source);
+        bool saveCache(const std::string& cacheName,
+                       const FileStamp& source) const;
         void removeQuotes(std::string& str);
         void prepareMesh(Mesh& mesh);
-        void prepareMesh(Mesh& mesh, const MD5Animation::Skeleton& skeleton);
+        void prepareVertex(Mesh& mesh, size_t i);
+        void prepareMesh(Mesh& mesh, const MD5Animation::Skeleton& skeleton,
+                         size_t first, size_t last);
         void prepareNormals(Mesh& mesh);
+        void prepareFaceNormals(Mesh& mesh);
+        void prepareBindNormal(Mesh& mesh, size_t i);
+        void prepareAdjacency(Mesh& mesh);
+        void prepareSkeletonMesh(Mesh& skeleton);
+        void prepareJointEdits();
+        void updateKinematics();
+        void prepareBindBound();
+        void updateSkinNormal(Mesh& mesh, size_t i);
+        void markBindVertex(Mesh& mesh, size_t i);
+        void prepareSkinStream(Mesh& mesh);
+        void lodFollow(const AnimationLOD& level,
+                       std::vector<int>& follow) const;
+        void prepareLODSkins();
+        void prepareLODSkin(Mesh& mesh, const std::vector<int>& follow,
+                            int maxWeights, SkinStream& lodSkin);
+        SkinStream& currentSkin(Mesh& mesh);
+        void skinVertices(Mesh& mesh, size_t first, size_t last);
+        void recomputeNormals(bool parallel);
+        void addSkinJobs(Mesh& mesh, size_t first, size_t last);
+        JointMask changedJoints() const;
+        const MD5Animation::Skeleton& animatedSkeleton() const;
+        const MD5Animation::Skeleton& skinnedSkeleton() const;
+        void storePoseEdits();
         void loadModelInVideomemory();
         void reloadModel();
-        bool checkAnimation(const MD5Animation& anim) const;
+        template <typename Animation>
+        bool checkAnimation(const Animation& anim) const;
         void printJoints();
 
+        /** Scratch lists of UpdateJoints(), kept to avoid allocations. */
+        struct JointEdit
+        {
+            std::vector<bool> joints;    // Changed joints.
+            std::vector<int>  stack;     // Joints to visit in a subtree.
+            std::vector<int>  verts;     // Vertices to skin.
+            std::vector<int>  changed;   // Vertices with new normals.
+            std::vector<char> vertMarks; // Vertices already in 'verts'.
+        };
+
     private:
         const Shader*  shader;
         MeshList       meshes;       // Meshes that make up the whole.
@@ -101,6 +290,30 @@ namespace ST
         Math::Matrix4D model;        // Model transformation.
         MD5Animation   animation;    // Single animation for the model.
         bool           hasAnimation;
+        SkinningMode   skinningMode;
+        PackedSkeleton packedSkeleton; // Current pose for skinning kernels.
+        MatrixPalette  palette;        // Current pose as joint matrices.
+        JobPool*       jobPool;        // Skins meshes in parallel if set.
+        AnimGraph*     animGraph;      // Replaces the animation if set.
+        bool           skinDirty;      // All the vertices must be skinned.
+        JointList      pose;           // Played pose edited before Skin().
+        bool           poseCopied;     // Whether 'pose' is the played one.
+        bool           posePending;    // Animate() took a pose to skin.
+        JointMask      poseChanged;    // Joints moved by Animate().
+        JointMask      poseEdits;      // Joints of 'pose' edited since.
+        MD5Animation::Skeleton editedSkeleton; // Played pose with the edits.
+        Adjacency      jointChildren;  // Children of each joint.
+        ForwardKinematics kinematics;  // Local transforms of the joints.
+        JointEdit      edit;
+        bool           jointsEdited;
+        NormalMode     normalMode;
+        AnimationLODs  lods;           // Levels of detail by distance.
+        int            lod;            // Current level, -1 for full detail.
+        float          lodTime;        // Time since the last pose.
+        bool           lodSkinsDirty;  // Bind pose changed since built.
+        const Camera*  cullCamera;     // Culls models out of its view.
+        bool           visible;        // In the view at the last Update().
+        MD5Animation::Bound bindBound; // Box around the bind pose.
         GLint          posLocation;  // Position location in shader.
         GLint          normLocation; // Position location in shader.
     };
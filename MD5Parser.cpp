@@ -1,16 +1,27 @@
+#include <algorithm>
 #include "MD5Parser.h"
+#include "MappedFile.h"
 #include "Log.h"
-#include <sstream>
-#include <fstream>
-#include <iostream>
-#include <tuple>
 
 using namespace std;
 using namespace Math;
 
 namespace ST
 {
-    const string MD5Parser::skip_strings[] =
+    namespace
+    {
+        inline float to_float(const Token& token)
+        {
+            return MD5Tokenizer::ToFloat(token);
+        }
+
+        inline size_t to_uint(const Token& token)
+        {
+            return MD5Tokenizer::ToUInt(token);
+        }
+    }
+
+    const char* const MD5Parser::skip_strings[] =
     {
         "//", "MD5Version", "commandline", "numJoints",
         "numMeshes", "numverts", "numtris", "numweights",
@@ -18,7 +29,7 @@ namespace ST
     };
     const function
     <
-        void(MD5Parser&, const vector<string>&)
+        void(MD5Parser&, const vector<Token>&)
     > MD5Parser::state_parsers[] =
     {
         &MD5Parser::process_start,
@@ -41,89 +52,62 @@ namespace ST
         return skeleton;
     }
 
-    //-- Check whether fullstring starts with 'start', omitting ' ' --//
-    bool MD5Parser::starts_with(string fullstring, string start) const
+    //-- Check whether the line starting with 'first' should be skipped --//
+    bool MD5Parser::is_skipped(const Token& first) const
     {
-        if (start.empty()) return true;
-        if (fullstring.empty()) return false;
-        if (start.size() > fullstring.size()) return false;
-
-        size_t i = fullstring.find_first_not_of(" \t");
-        if (i == string::npos)
+        for (const char* skip_str : skip_strings)
         {
-            if (start.find_first_not_of(" \t") == string::npos) return true;
-            else return false;
+            // Most lines are "vert", "tri" or "weight", so compare
+            // the first character before the whole prefix.
+            if (skip_str[0] == *first.begin && first.StartsWith(skip_str))
+                return true;
         }
-
-        if (start.size() > fullstring.size() - i) return false;
-
-        return fullstring.compare(i, start.length(), start) == 0;
+        return false;
     }
 
-    vector<string> MD5Parser::tokenize(string line) const
+    void MD5Parser::Parse(string filename)
     {
-        string token;
-        stringstream ss(line);
-        vector<string> tokens;
-
-        while (ss >> token)
+        MappedFile input;
+        if (!input.Open(filename))
         {
-            size_t i = token.find("//");
-            if (i != string::npos)
-            {
-                if (i != 0)
-                    tokens.push_back(token.substr(0, i));
-                break;
-            }
-            tokens.push_back(token);
+            log("Cannot open file: %s", filename.c_str());
+            return;
         }
 
-        return tokens;
-    }
-
-    void MD5Parser::Parse(string filename)
-    {
-        string line;
-        ifstream input(filename);
-        while (getline(input, line))
+        MD5Tokenizer tokenizer(input.Begin(), input.End());
+        while (tokenizer.NextLine(tokens))
         {
-            processed_line++;
-            bool skip_line = false;
-            for (auto skip_str : skip_strings)
-            {
-                if (starts_with(line, skip_str))
-                {
-                    skip_line = true;
-                    break;
-                }
-            }
-            if (skip_line) continue;
-
-            vector<string> tokens = tokenize(line);
+            processed_line = tokenizer.GetLine();
             if (tokens.size() == 0) continue;
+            if (is_skipped(tokens[0])) continue;
             state_parsers[state](*this, tokens);
         }
-        input.close();
+        input.Close();
         state = START;
         processed_line = 0;
     }
 
-    void MD5Parser::process_start(const vector<string>& tokens)
+    void MD5Parser::process_start(const vector<Token>& tokens)
     {
         if (tokens[0] == "joints") state = JOINTS;
         else if (tokens[0] == "mesh") state = MESH;
         else state = UNKNOWN;
     }
 
-    void MD5Parser::process_joints(const vector<string>& tokens)
+    void MD5Parser::process_joints(const vector<Token>& tokens)
     {
         if (tokens.size() == 12)
         {
             Joint joint;
-            joint.name = tokens[0].substr(1, tokens[0].size() - 2);
-            joint.parent = stoul(tokens[1]);
-            joint.p = Vector3D(stof(tokens[3]), stof(tokens[4]), stof(tokens[5]));
-            joint.q = Quaternion(0, stof(tokens[8]), stof(tokens[9]), stof(tokens[10]));
+            // Quotes are stripped, so short or bare names are read too.
+            string& name = joint.name;
+            name = tokens[0].str();
+            name.erase(remove(name.begin(), name.end(), '\"'), name.end());
+            joint.parent = MD5Tokenizer::ToInt(tokens[1]);
+            joint.p = Vector3D(to_float(tokens[3]), to_float(tokens[4]),
+                               to_float(tokens[5]));
+            joint.q = Quaternion(0, to_float(tokens[8]), to_float(tokens[9]),
+                                 to_float(tokens[10]));
             joint.q.ComputeW();
             skeleton.push_back(joint);
         }
@@ -131,46 +115,47 @@ namespace ST
         else log_tokens("Malformed string: ", tokens);
     }
 
-    void MD5Parser::process_mesh(const vector<string>& tokens)
+    void MD5Parser::process_mesh(const vector<Token>& tokens)
     {
-        if (tokens[0] == "shader") mesh.texture_path = tokens[1];
+        if (tokens[0] == "shader") mesh.texture_path = tokens[1].str();
         else if (tokens[0] == "tri")
             for (size_t i = 2; i <= 4; i++)
-                mesh.triangles.push_back(stoul(tokens[i]));
+                mesh.triangles.push_back(to_uint(tokens[i]));
         else if (tokens[0] == "vert")
         {
             Vertex vertex;
-            vertex.s = stof(tokens[3]); vertex.t = stof(tokens[4]);
-            vertex.weight_index = stof(tokens[6]);
-            vertex.weight_count = stof(tokens[7]);
+            vertex.s = to_float(tokens[3]); vertex.t = to_float(tokens[4]);
+            vertex.weight_index = to_uint(tokens[6]);
+            vertex.weight_count = to_uint(tokens[7]);
             mesh.vertices.push_back(vertex);
         }
         else if (tokens[0] == "weight")
         {
             Weight weight;
-            weight.joint = stoul(tokens[2]);
-            weight.bias = stof(tokens[3]);
-            weight.p = Vector3D(stof(tokens[5]), stof(tokens[6]), stof(tokens[7]));
+            weight.joint = to_uint(tokens[2]);
+            weight.bias = to_float(tokens[3]);
+            weight.p = Vector3D(to_float(tokens[5]), to_float(tokens[6]),
+                                to_float(tokens[7]));
             mesh.weights.push_back(weight);
         }
         else if (tokens[0] == "}")
         {
             state = START;
-            skin.push_back(mesh);
+            skin.push_back(move(mesh));
             mesh.Clear();
         }
     }
 
-    void MD5Parser::process_unknown(const vector<string>& tokens)
+    void MD5Parser::process_unknown(const vector<Token>& tokens)
     {
         state = START;
         log_tokens("Malformed string: ", tokens);
     }
 
-    void MD5Parser::log_tokens(string prefix, const vector<string>& tokens)
+    void MD5Parser::log_tokens(string prefix, const vector<Token>& tokens)
     {
         string line;
-        for (auto token : tokens) line += token;
+        for (const Token& token : tokens) line.append(token.begin, token.end);
         log("(%d) %s%s", processed_line, prefix.c_str(), line.c_str());
     }
 }
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include "MD5Tokenizer.h"
 #include "math/Vector3D.h"
 #include "math/Quaternion.h"
 
@@ -68,30 +69,30 @@ namespace ST
 
     private:
         void parseModel();
-        bool starts_with(std::string fullstring, std::string start) const;
+        bool is_skipped(const Token& first) const;
         bool ends_with(std::string fullstring, std::string start) const;
-        std::vector<std::string> tokenize(std::string line) const;
-        void process_start(const std::vector<std::string>& tokens);
-        void process_joints(const std::vector<std::string>& tokens);
-        void process_mesh(const std::vector<std::string>& tokens);
-        void process_unknown(const std::vector<std::string>& tokens);
-        void log_tokens(std::string, const std::vector<std::string>&);
+        void process_start(const std::vector<Token>& tokens);
+        void process_joints(const std::vector<Token>& tokens);
+        void process_mesh(const std::vector<Token>& tokens);
+        void process_unknown(const std::vector<Token>& tokens);
+        void log_tokens(std::string, const std::vector<Token>&);
 
     private:
         static const size_t START = 0;
         static const size_t JOINTS = 1;
         static const size_t MESH = 2;
-        static const size_t UNKNOWN = 4;
+        static const size_t UNKNOWN = 3;
 
-        static const std::string skip_strings[];
+        static const char* const skip_strings[];
         static const std::function
         <
-            void(MD5Parser&, const std::vector<std::string>&)
+            void(MD5Parser&, const std::vector<Token>&)
         > state_parsers[];
 
         Mesh mesh; //!< Mesh, that is currently filled by parser.
         size_t state; //!< State of the parser.
         size_t processed_line; //!< Line number that is being processed.
+        std::vector<Token> tokens; //!< Tokens of the line being processed.
         std::vector<Mesh> skin; //!< Skin of the model is composed of meshes.
         std::vector<Joint> skeleton; //!< Skeleton of the model.
     };
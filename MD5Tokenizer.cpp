@@ -0,0 +1,220 @@
+#include <cmath>
+#include <stdexcept>
+#include "MD5Tokenizer.h"
+
+using namespace std;
+
+namespace ST
+{
+    namespace
+    {
+        // Every double up to 1e22 is exact, so a single
+        // multiplication or division rounds the result only once.
+        const double powers_of_10[] =
+        {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+            1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+            1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        const int max_exact_power = 22;
+
+        inline bool is_space(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+                   c == '\v' || c == '\f';
+        }
+
+        inline bool is_comment(const char* p, const char* end)
+        {
+            return p + 1 < end && p[0] == '/' && p[1] == '/';
+        }
+
+        inline bool is_digit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        void throw_malformed(const Token& token)
+        {
+            throw runtime_error("Malformed number: " + token.str());
+        }
+    }
+
+    MD5Tokenizer::MD5Tokenizer(const char* begin, const char* end)
+        : cur(begin), end(end), line(0), newlines(0)
+    {
+    }
+
+    bool MD5Tokenizer::NextLine(vector<Token>& tokens)
+    {
+        tokens.clear();
+        if (cur == end) return false;
+
+        line = newlines + 1;
+        while (cur != end && *cur != '\n')
+        {
+            if (is_space(*cur))
+            {
+                ++cur;
+                continue;
+            }
+            if (is_comment(cur, end))
+            {
+                while (cur != end && *cur != '\n') ++cur;
+                break;
+            }
+
+            const char* begin = cur;
+            while (cur != end && !is_space(*cur) && !is_comment(cur, end))
+                ++cur;
+            tokens.push_back(Token(begin, cur));
+        }
+        if (cur != end) // Step over '\n'.
+        {
+            ++newlines;
+            ++cur;
+        }
+
+        return true;
+    }
+
+    Token MD5Tokenizer::Next()
+    {
+        while (cur != end)
+        {
+            if (*cur == '\n')
+            {
+                ++newlines;
+                ++cur;
+            }
+            else if (is_space(*cur)) ++cur;
+            else if (is_comment(cur, end))
+            {
+                while (cur != end && *cur != '\n') ++cur;
+            }
+            else break;
+        }
+
+        line = newlines + 1;
+        const char* begin = cur;
+        while (cur != end && !is_space(*cur) && !is_comment(cur, end))
+            ++cur;
+
+        return Token(begin, cur);
+    }
+
+    void MD5Tokenizer::SkipLine()
+    {
+        while (cur != end && *cur != '\n') ++cur;
+        if (cur != end)
+        {
+            ++newlines;
+            ++cur;
+        }
+    }
+
+    //-- Same result as stof() for the numbers found in md5 files --//
+    float MD5Tokenizer::ToFloat(const Token& token)
+    {
+        const char* p = token.begin;
+        const char* e = token.end;
+
+        bool negative = false;
+        if (p != e && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+
+        // Collect up to 19 significant digits, the rest only moves exponent.
+        unsigned long long mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool has_digits = false;
+        for (; p != e && is_digit(*p); ++p, has_digits = true)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+            }
+            else exponent++;
+        }
+        if (p != e && *p == '.')
+        {
+            for (++p; p != e && is_digit(*p); ++p, has_digits = true)
+            {
+                if (digits < 19)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa) digits++;
+                    exponent--;
+                }
+            }
+        }
+        if (!has_digits) throw_malformed(token);
+
+        if (p + 1 < e && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            bool negative_exp = false;
+            if (p != e && (*p == '-' || *p == '+'))
+            {
+                negative_exp = *p == '-';
+                ++p;
+            }
+
+            // "1e" or "1e+" is a number followed by junk, as for strtof().
+            int exp = 0;
+            for (; p != e && is_digit(*p); ++p)
+                if (exp < 10000) exp = exp * 10 + (*p - '0');
+            exponent += negative_exp ? -exp : exp;
+        }
+
+        double value = double(mantissa);
+        if (exponent < 0 && exponent >= -max_exact_power)
+            value /= powers_of_10[-exponent];
+        else if (exponent > 0 && exponent <= max_exact_power)
+            value *= powers_of_10[exponent];
+        else if (exponent != 0)
+            value *= pow(10.0, exponent);
+
+        return float(negative ? -value : value);
+    }
+
+    int MD5Tokenizer::ToInt(const Token& token)
+    {
+        const char* p = token.begin;
+        bool negative = false;
+        if (p != token.end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+        if (p == token.end || !is_digit(*p)) throw_malformed(token);
+
+        int value = 0;
+        for (; p != token.end && is_digit(*p); ++p)
+            value = value * 10 + (*p - '0');
+
+        return negative ? -value : value;
+    }
+
+    size_t MD5Tokenizer::ToUInt(const Token& token)
+    {
+        const char* p = token.begin;
+        bool negative = false;
+        if (p != token.end && (*p == '-' || *p == '+'))
+        {
+            negative = *p == '-';
+            ++p;
+        }
+        if (p == token.end || !is_digit(*p)) throw_malformed(token);
+
+        // Negative value wraps around as it does for stoul().
+        size_t value = 0;
+        for (; p != token.end && is_digit(*p); ++p)
+            value = value * 10 + (*p - '0');
+
+        return negative ? 0 - value : value;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef MD5TOKENIZER_H_INCLUDED
+#define MD5TOKENIZER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace ST
+{
+    /** Token is a view into the text of the file.
+        It doesn't own the characters, so it's valid only
+        while the buffer it was cut from is alive.
+    */
+    struct Token
+    {
+        Token() : begin(0), end(0) {}
+        Token(const char* begin, const char* end) : begin(begin), end(end) {}
+
+        size_t size() const { return end - begin; }
+        bool empty() const { return begin == end; }
+        std::string str() const { return std::string(begin, end); }
+
+        bool operator== (const char* rhs) const
+        {
+            return std::strlen(rhs) == size() &&
+                   std::memcmp(begin, rhs, size()) == 0;
+        }
+        bool operator!= (const char* rhs) const { return !(*this == rhs); }
+
+        /** Checks whether the token starts with 'prefix'. */
+        bool StartsWith(const char* prefix) const
+        {
+            size_t length = std::strlen(prefix);
+            return length <= size() && std::memcmp(begin, prefix, length) == 0;
+        }
+
+        const char* begin; //!< First character of the token.
+        const char* end;   //!< One past the last character of the token.
+    };
+
+    /** Splits the text of *.md5mesh and *.md5anim files into tokens
+        without copying it. Tokens are separated by whitespace,
+        everything after "//" up to the end of the line is a comment.
+        Numbers are parsed right from the buffer without allocations.
+    */
+    class MD5Tokenizer
+    {
+    public:
+        MD5Tokenizer(const char* begin, const char* end);
+
+        /** Fills 'tokens' with the tokens of the next line.
+            Returns false when there are no more lines.
+        */
+        bool NextLine(std::vector<Token>& tokens);
+
+        /** Returns the next token skipping line breaks and comments.
+            Returns an empty token at the end of the buffer.
+        */
+        Token Next();
+        /** Skips the rest of the current line. */
+        void SkipLine();
+
+        float NextFloat() { return ToFloat(Next()); }
+        int NextInt() { return ToInt(Next()); }
+
+        size_t GetLine() const { return line; }
+        bool AtEnd() const { return cur == end; }
+
+        // Like stof() and stoul() parse the number at the beginning of
+        // the token. Throw runtime_error() if there is no number at all.
+        static float ToFloat(const Token& token);
+        static int ToInt(const Token& token);
+        static size_t ToUInt(const Token& token);
+
+    private:
+        const char* cur;      //!< Current position in the buffer.
+        const char* end;      //!< End of the buffer.
+        size_t      line;     //!< Line of the last token returned.
+        size_t      newlines; //!< Number of line breaks passed.
+    };
+}
+
+#endif // MD5TOKENIZER_H_INCLUDED
@@ -0,0 +1,67 @@
+#include "MappedFile.h"
+
+using namespace std;
+
+namespace ST
+{
+    MappedFile::MappedFile()
+        : file(INVALID_HANDLE_VALUE), mapping(0), data(0), size(0)
+    {
+    }
+
+    MappedFile::~MappedFile()
+    {
+        Close();
+    }
+
+    bool MappedFile::Open(const string& fileName)
+    {
+        Close();
+
+        file = ::CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                             0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!::GetFileSizeEx(file, &fileSize))
+        {
+            Close();
+            return false;
+        }
+
+        // Mapping of an empty file is not allowed, but it is a valid file.
+        if (fileSize.QuadPart == 0)
+            return true;
+
+        mapping = ::CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (!mapping)
+        {
+            Close();
+            return false;
+        }
+
+        data = static_cast<const char*>(
+            ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!data)
+        {
+            Close();
+            return false;
+        }
+
+        size = static_cast<size_t>(fileSize.QuadPart);
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (data) ::UnmapViewOfFile(data);
+        if (mapping) ::CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) ::CloseHandle(file);
+
+        file = INVALID_HANDLE_VALUE;
+        mapping = 0;
+        data = 0;
+        size = 0;
+    }
+}
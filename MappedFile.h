@@ -0,0 +1,43 @@
+#ifndef MAPPEDFILE_H_INCLUDED
+#define MAPPEDFILE_H_INCLUDED
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#undef WIN32_LEAN_AND_MEAN
+
+#include <string>
+
+namespace ST
+{
+    /** Read-only view of the whole file mapped into the address space.
+        Contents are paged in by the OS on first access, so nothing
+        is copied or allocated on the heap while the file is read.
+    */
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        /** Maps the file. Returns false if it cannot be opened or mapped.
+            An empty file is mapped successfully with Size() == 0.
+        */
+        bool Open(const std::string& fileName);
+        void Close();
+
+        const char* Begin() const { return data; }
+        const char* End() const { return data + size; }
+        size_t Size() const { return size; }
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator= (const MappedFile&);
+
+        HANDLE      file;    //!< Handle of the opened file.
+        HANDLE      mapping; //!< File mapping object.
+        const char* data;    //!< First byte of the mapped view.
+        size_t      size;    //!< Size of the view in bytes.
+    };
+}
+
+#endif // MAPPEDFILE_H_INCLUDED
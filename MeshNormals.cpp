@@ -0,0 +1,141 @@
+#include <cmath>
+#include <algorithm>
+#include "MeshNormals.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        float angle(const Vector3D& a, const Vector3D& b)
+        {
+            float length = a.Length() * b.Length();
+            if (length == 0) return 0;
+
+            float cosine = a.Dot(b) / length;
+            return acos(max(-1.0f, min(1.0f, cosine)));
+        }
+    }
+
+    MeshNormals::MeshNormals() : weighting(WEIGHT_AREA)
+    {
+    }
+
+    void MeshNormals::SetWeighting(Weighting w)
+    {
+        weighting = w;
+        angles.clear();
+        if (weighting == WEIGHT_ANGLE)
+            angles.resize(triangles.size());
+    }
+
+    void MeshNormals::build(size_t numVertices)
+    {
+        vector<int> faceIDs(triangles.size());
+        for (size_t i = 0; i < triangles.size(); i++)
+            faceIDs[i] = i / 3;
+        vertTris.Build(numVertices, triangles, faceIDs);
+
+        faces.assign(NumTriangles(), Vector3D());
+        marks.assign(max(numVertices, NumTriangles()), 0);
+        SetWeighting(weighting);
+    }
+
+    void MeshNormals::UpdateFaces(const Vector3D* positions,
+                                  size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+            updateFace(positions, i);
+    }
+
+    void MeshNormals::updateFace(const Vector3D* positions, size_t i)
+    {
+        const int* tri = &triangles[3 * i];
+        const Vector3D& v0 = positions[tri[0]];
+        const Vector3D& v1 = positions[tri[1]];
+        const Vector3D& v2 = positions[tri[2]];
+
+        // Length of the cross product is twice the area of the face.
+        Vector3D normal = Vector3D::Cross(v2 - v0, v1 - v0);
+        if (weighting != WEIGHT_AREA)
+        {
+            float length = normal.Length();
+            if (length > 0) normal = normal * (1 / length);
+        }
+        faces[i] = normal;
+
+        if (weighting == WEIGHT_ANGLE)
+        {
+            angles[3 * i + 0] = angle(v1 - v0, v2 - v0);
+            angles[3 * i + 1] = angle(v2 - v1, v0 - v1);
+            angles[3 * i + 2] = angle(v0 - v2, v1 - v2);
+        }
+    }
+
+    Vector3D MeshNormals::Gather(size_t vertex) const
+    {
+        // Faces are added in their order, so with area weighting the sum
+        // is the same as if every face was scattered to its vertices.
+        Vector3D sum;
+        for (const int* t = vertTris.Begin(vertex); t != vertTris.End(vertex); ++t)
+        {
+            if (weighting != WEIGHT_ANGLE)
+            {
+                sum += faces[*t];
+                continue;
+            }
+
+            const int* tri = &triangles[3 * *t];
+            int corner = tri[0] == int(vertex) ? 0 : tri[1] == int(vertex) ? 1 : 2;
+            sum += faces[*t] * angles[3 * *t + corner];
+        }
+        return Vector3D::Normalize(sum);
+    }
+
+    void MeshNormals::Gather(size_t first, size_t last, Vector3D* normals) const
+    {
+        for (size_t i = first; i < last; i++)
+            normals[i] = Gather(i);
+    }
+
+    void MeshNormals::UpdateAround(const Vector3D* positions,
+                                   const vector<int>& moved, Vector3D* normals,
+                                   vector<int>& changed)
+    {
+        // Faces touching the moved vertices.
+        movedFaces.clear();
+        for (size_t k = 0; k < moved.size(); k++)
+        {
+            int v = moved[k];
+            for (const int* t = vertTris.Begin(v); t != vertTris.End(v); ++t)
+            {
+                if (marks[*t]) continue;
+                marks[*t] = 1;
+                movedFaces.push_back(*t);
+                updateFace(positions, *t);
+            }
+        }
+        for (size_t k = 0; k < movedFaces.size(); k++)
+            marks[movedFaces[k]] = 0;
+
+        // Every corner of these faces gets a new normal.
+        changed.clear();
+        for (size_t k = 0; k < movedFaces.size(); k++)
+        {
+            const int* tri = &triangles[3 * movedFaces[k]];
+            for (int c = 0; c < 3; c++)
+            {
+                if (marks[tri[c]]) continue;
+                marks[tri[c]] = 1;
+                changed.push_back(tri[c]);
+            }
+        }
+        for (size_t k = 0; k < changed.size(); k++)
+        {
+            marks[changed[k]] = 0;
+            normals[changed[k]] = Gather(changed[k]);
+        }
+    }
+}
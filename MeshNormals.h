@@ -0,0 +1,80 @@
+#ifndef MESHNORMALS_H_INCLUDED
+#define MESHNORMALS_H_INCLUDED
+
+#include <vector>
+#include "Adjacency.h"
+#include "math/Vector3D.h"
+
+namespace ST
+{
+    /** Computes smooth vertex normals of a triangle mesh.
+        Face normals are cached and every vertex gathers the normals
+        of the triangles around it through a vertex -> triangles lookup.
+        Nothing is scattered, so any ranges of faces or vertices can be
+        updated in parallel, and after a few vertices have moved only
+        the faces around them need to be computed again.
+    */
+    class MeshNormals
+    {
+    public:
+        /** How much every face contributes to the vertex normal. */
+        enum Weighting
+        {
+            WEIGHT_AREA,   // By the area of the face (the cross product).
+            WEIGHT_ANGLE,  // By the angle of the face at the vertex.
+            WEIGHT_UNIFORM // All faces around the vertex are equal.
+        };
+
+        MeshNormals();
+
+        /** Prepares the lookup for triangles given by 'indices'.
+            Face normals must be computed with UpdateFaces() after that.
+        */
+        template <typename Index>
+        void Build(size_t numVertices, const std::vector<Index>& indices)
+        {
+            triangles.assign(indices.begin(), indices.end());
+            build(numVertices);
+        }
+
+        /** Face normals must be computed again after the change. */
+        void SetWeighting(Weighting weighting);
+        Weighting GetWeighting() const { return weighting; }
+
+        size_t NumVertices() const { return vertTris.NumRows(); }
+        size_t NumTriangles() const { return triangles.size() / 3; }
+
+        /** Computes face normals of triangles [first; last). */
+        void UpdateFaces(const Math::Vector3D* positions,
+                         size_t first, size_t last);
+        /** Returns the normalized normal of the vertex. */
+        Math::Vector3D Gather(size_t vertex) const;
+        /** Gathers normals of vertices [first; last). */
+        void Gather(size_t first, size_t last, Math::Vector3D* normals) const;
+
+        /** Updates faces around the 'moved' vertices and normals of all
+            the vertices of those faces. Vertices that got new normals
+            are put into 'changed'.
+        */
+        void UpdateAround(const Math::Vector3D* positions,
+                          const std::vector<int>& moved,
+                          Math::Vector3D* normals, std::vector<int>& changed);
+
+        const Adjacency& GetVertexTriangles() const { return vertTris; }
+        const int* GetTriangle(size_t i) const { return &triangles[3 * i]; }
+
+    private:
+        void build(size_t numVertices);
+        void updateFace(const Math::Vector3D* positions, size_t i);
+
+        Weighting                   weighting;
+        std::vector<int>            triangles;  //!< Three vertices per face.
+        Adjacency                   vertTris;   //!< Faces around vertices.
+        std::vector<Math::Vector3D> faces;      //!< Weighted face normals.
+        std::vector<float>          angles;     //!< Face angles at corners.
+        std::vector<char>           marks;      //!< Scratch of UpdateAround().
+        std::vector<int>            movedFaces; //!< Scratch of UpdateAround().
+    };
+}
+
+#endif // MESHNORMALS_H_INCLUDED
@@ -37,17 +37,22 @@ namespace ST
 
     void Model::construct_positions()
     {
+        // Every joint is converted to a matrix once instead of
+        // rotating by the quaternion for every weight.
+        palette.resize(skeleton.size());
+        for (size_t i = 0; i < skeleton.size(); i++)
+            palette[i].Set(skeleton[i].p, skeleton[i].q);
+
         for (const Vertex& vertex : vertices)
         {
             Vector3D final_vertex;
             for (size_t i = 0; i < vertex.weight_count; i++)
             {
                 const Weight& weight = weights[vertex.weight_index + i];
-                const Joint& joint = skeleton[weight.joint];
 
                 // Convert position from Joint local space to object space.
-                Vector3D rot_position = joint.q.Rotate(weight.p);
-                final_vertex += (joint.p + rot_position) * weight.bias;
+                final_vertex += palette[weight.joint].Transform(weight.p) *
+                                weight.bias;
             }
             positions.push_back(final_vertex);
         }
@@ -55,29 +60,24 @@ namespace ST
 
     void Model::construct_normals()
     {
-        for (size_t i = 0; i < indices.size(); i += 3)
-        {
-            const Vector3D& v0 = positions[indices[i + 0]];
-            const Vector3D& v1 = positions[indices[i + 1]];
-            const Vector3D& v2 = positions[indices[i + 2]];
+        mesh_normals.Build(vertices.size(), indices);
+        mesh_normals.UpdateFaces(positions.data(), 0,
+                                 mesh_normals.NumTriangles());
 
-            Vector3D normal = Vector3D::Cross(v2 - v0, v1 - v0);
+        normals.resize(vertices.size());
+        mesh_normals.Gather(0, vertices.size(), normals.data());
 
-            vertices[indices[i + 0]].normal += normal;
-            vertices[indices[i + 1]].normal += normal;
-            vertices[indices[i + 2]].normal += normal;
-        }
-        for (Vertex& vertex : vertices)
+        for (size_t v = 0; v < vertices.size(); v++)
         {
-            Vector3D normal = Vector3D::Normalize(vertex.normal);
-            normals.push_back(normal);
+            Vertex& vertex = vertices[v];
+            const Vector3D& normal = normals[v];
             vertex.normal = Vector3D(0);
 
             for (size_t i = 0; i < vertex.weight_count; i++)
             {
                 const Weight& weight = weights[vertex.weight_index + i];
-                const Joint& joint = skeleton[weight.joint];
-                vertex.normal += joint.q.InverseRotate(normal) * weight.bias;
+                vertex.normal += palette[weight.joint].InverseRotate(normal) *
+                                 weight.bias;
             }
         }
     }
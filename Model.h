@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 #include "MD5Parser.h"
+#include "MeshNormals.h"
+#include "Skinning.h"
 #include "math/Vector3D.h"
 
 namespace ST
@@ -30,6 +32,8 @@ namespace ST
         std::vector<Math::Vector3D> positions;
 
         std::vector<Joint> skeleton;
+        MatrixPalette palette; //!< Matrices of the skeleton joints.
+        MeshNormals mesh_normals;
     };
 }
 
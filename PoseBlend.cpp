@@ -0,0 +1,535 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "PoseBlend.h"
+#include "CpuFeatures.h"
+#include "math/Quaternion.h"
+
+#ifdef ST_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const float half_pi = 1.57079633f;
+
+        /** Nlerp with the quotient 't' replaced by
+            t + t (t - 0.5) (t - 1) (A (t - 0.5)^2 + B),
+            where A and B are polynomials of |cos| of the half angle
+            between quaternions fitted to follow slerp.
+            The parts that depend on 't' only are the same for all joints.
+        */
+        struct Correction
+        {
+            explicit Correction(float t)
+                : t(t), c1((t - 0.5f) * (t - 0.5f)),
+                  c2(t * (t - 0.5f) * (t - 1.0f))
+            {}
+
+            float t, c1, c2;
+        };
+
+        inline float corrected(float d, const Correction& c)
+        {
+            float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+            float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+            return c.t + c.c2 * (A * c.c1 + B);
+        }
+
+        //-- Orientation rows start with w, every next one is 'stride' further --//
+        void slerp_joint(const float* a, const float* b, float t,
+                         size_t stride, size_t j, float* out)
+        {
+            Quaternion qa(a[j], a[stride + j], a[2 * stride + j],
+                          a[3 * stride + j]);
+            Quaternion qb(b[j], b[stride + j], b[2 * stride + j],
+                          b[3 * stride + j]);
+            Quaternion q = Quaternion::Slerp(qa, qb, t);
+            out[j] = q.w;
+            out[stride + j] = q.x;
+            out[2 * stride + j] = q.y;
+            out[3 * stride + j] = q.z;
+        }
+
+        void lerp_scalar(const float* a, const float* b, float t,
+                         size_t count, float* out)
+        {
+            for (size_t i = 0; i < count; i++)
+                out[i] = a[i] + t * (b[i] - a[i]);
+        }
+
+        void nlerp_scalar(const float* a, const float* b, const Correction& c,
+                          size_t stride, size_t numJoints, float minCos,
+                          float* out)
+        {
+            for (size_t j = 0; j < stride; j++)
+            {
+                float aw = a[j], ax = a[stride + j];
+                float ay = a[2 * stride + j], az = a[3 * stride + j];
+                float bw = b[j], bx = b[stride + j];
+                float by = b[2 * stride + j], bz = b[3 * stride + j];
+
+                float d = aw * bw + ax * bx + ay * by + az * bz;
+                if (fabs(d) < minCos && j < numJoints)
+                {
+                    slerp_joint(a, b, c.t, stride, j, out);
+                    continue;
+                }
+                if (signbit(d))
+                {
+                    bw = -bw; bx = -bx; by = -by; bz = -bz;
+                }
+
+                float t = corrected(fabs(d), c);
+                float qw = aw + t * (bw - aw);
+                float qx = ax + t * (bx - ax);
+                float qy = ay + t * (by - ay);
+                float qz = az + t * (bz - az);
+
+                float length = sqrt(qw * qw + qx * qx + qy * qy + qz * qz);
+                out[j] = qw / length;
+                out[stride + j] = qx / length;
+                out[2 * stride + j] = qy / length;
+                out[3 * stride + j] = qz / length;
+            }
+        }
+
+#ifdef ST_X86_KERNELS
+        // Kernels do the same operations in the same order as the scalar
+        // code and FMA isn't enabled, so all of them give equal results.
+        __attribute__((target("sse4.1")))
+        void lerp_sse41(const float* a, const float* b, float t,
+                        size_t count, float* out)
+        {
+            __m128 vt = _mm_set1_ps(t);
+            for (size_t i = 0; i < count; i += 4)
+            {
+                __m128 va = _mm_loadu_ps(a + i);
+                __m128 vb = _mm_loadu_ps(b + i);
+                _mm_storeu_ps(out + i, _mm_add_ps(va,
+                              _mm_mul_ps(vt, _mm_sub_ps(vb, va))));
+            }
+        }
+
+        __attribute__((target("sse4.1")))
+        inline __m128 poly_sse41(__m128 x, float c0, float c1, float c2)
+        {
+            // c0 + x * (c1 + x * c2)
+            return _mm_add_ps(_mm_set1_ps(c0), _mm_mul_ps(x,
+                   _mm_add_ps(_mm_set1_ps(c1),
+                              _mm_mul_ps(x, _mm_set1_ps(c2)))));
+        }
+
+        __attribute__((target("sse4.1")))
+        void nlerp_sse41(const float* a, const float* b, const Correction& c,
+                         size_t stride, size_t numJoints, float minCos,
+                         float* out)
+        {
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            for (size_t j = 0; j < stride; j += 4)
+            {
+                __m128 aw = _mm_loadu_ps(a + j);
+                __m128 ax = _mm_loadu_ps(a + stride + j);
+                __m128 ay = _mm_loadu_ps(a + 2 * stride + j);
+                __m128 az = _mm_loadu_ps(a + 3 * stride + j);
+                __m128 bw = _mm_loadu_ps(b + j);
+                __m128 bx = _mm_loadu_ps(b + stride + j);
+                __m128 by = _mm_loadu_ps(b + 2 * stride + j);
+                __m128 bz = _mm_loadu_ps(b + 3 * stride + j);
+
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                           _mm_mul_ps(aw, bw), _mm_mul_ps(ax, bx)),
+                           _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+                __m128 s = _mm_and_ps(d, sign);
+                bw = _mm_xor_ps(bw, s); bx = _mm_xor_ps(bx, s);
+                by = _mm_xor_ps(by, s); bz = _mm_xor_ps(bz, s);
+
+                // A = 1.0904 + d * (-3.2452 + d * (3.55645 - d * 1.43519))
+                __m128 ad = _mm_andnot_ps(sign, d);
+                __m128 A = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(ad,
+                           _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(ad,
+                           _mm_sub_ps(_mm_set1_ps(3.55645f),
+                                      _mm_mul_ps(ad, _mm_set1_ps(1.43519f)))))));
+                __m128 B = poly_sse41(ad, 0.848013f, -1.06021f, 0.215638f);
+                __m128 t = _mm_add_ps(_mm_set1_ps(c.t),
+                           _mm_mul_ps(_mm_set1_ps(c.c2), _mm_add_ps(
+                           _mm_mul_ps(A, _mm_set1_ps(c.c1)), B)));
+
+                __m128 qw = _mm_add_ps(aw, _mm_mul_ps(t, _mm_sub_ps(bw, aw)));
+                __m128 qx = _mm_add_ps(ax, _mm_mul_ps(t, _mm_sub_ps(bx, ax)));
+                __m128 qy = _mm_add_ps(ay, _mm_mul_ps(t, _mm_sub_ps(by, ay)));
+                __m128 qz = _mm_add_ps(az, _mm_mul_ps(t, _mm_sub_ps(bz, az)));
+
+                __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+                                _mm_mul_ps(qw, qw), _mm_mul_ps(qx, qx)),
+                                _mm_mul_ps(qy, qy)), _mm_mul_ps(qz, qz)));
+                _mm_storeu_ps(out + j, _mm_div_ps(qw, length));
+                _mm_storeu_ps(out + stride + j, _mm_div_ps(qx, length));
+                _mm_storeu_ps(out + 2 * stride + j, _mm_div_ps(qy, length));
+                _mm_storeu_ps(out + 3 * stride + j, _mm_div_ps(qz, length));
+
+                // Joints that rotate too far are redone by slerp.
+                int slow = _mm_movemask_ps(_mm_cmplt_ps(ad,
+                                                        _mm_set1_ps(minCos)));
+                for (; slow; slow &= slow - 1)
+                {
+                    size_t k = j + __builtin_ctz(slow);
+                    if (k < numJoints) slerp_joint(a, b, c.t, stride, k, out);
+                }
+            }
+        }
+
+        __attribute__((target("avx")))
+        void lerp_avx(const float* a, const float* b, float t,
+                      size_t count, float* out)
+        {
+            __m256 vt = _mm256_set1_ps(t);
+            for (size_t i = 0; i < count; i += 8)
+            {
+                __m256 va = _mm256_loadu_ps(a + i);
+                __m256 vb = _mm256_loadu_ps(b + i);
+                _mm256_storeu_ps(out + i, _mm256_add_ps(va,
+                                 _mm256_mul_ps(vt, _mm256_sub_ps(vb, va))));
+            }
+        }
+
+        __attribute__((target("avx")))
+        inline __m256 poly_avx(__m256 x, float c0, float c1, float c2)
+        {
+            return _mm256_add_ps(_mm256_set1_ps(c0), _mm256_mul_ps(x,
+                   _mm256_add_ps(_mm256_set1_ps(c1),
+                                 _mm256_mul_ps(x, _mm256_set1_ps(c2)))));
+        }
+
+        __attribute__((target("avx")))
+        void nlerp_avx(const float* a, const float* b, const Correction& c,
+                       size_t stride, size_t numJoints, float minCos,
+                       float* out)
+        {
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            for (size_t j = 0; j < stride; j += 8)
+            {
+                __m256 aw = _mm256_loadu_ps(a + j);
+                __m256 ax = _mm256_loadu_ps(a + stride + j);
+                __m256 ay = _mm256_loadu_ps(a + 2 * stride + j);
+                __m256 az = _mm256_loadu_ps(a + 3 * stride + j);
+                __m256 bw = _mm256_loadu_ps(b + j);
+                __m256 bx = _mm256_loadu_ps(b + stride + j);
+                __m256 by = _mm256_loadu_ps(b + 2 * stride + j);
+                __m256 bz = _mm256_loadu_ps(b + 3 * stride + j);
+
+                __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                           _mm256_mul_ps(aw, bw), _mm256_mul_ps(ax, bx)),
+                           _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+                __m256 s = _mm256_and_ps(d, sign);
+                bw = _mm256_xor_ps(bw, s); bx = _mm256_xor_ps(bx, s);
+                by = _mm256_xor_ps(by, s); bz = _mm256_xor_ps(bz, s);
+
+                __m256 ad = _mm256_andnot_ps(sign, d);
+                __m256 A = _mm256_add_ps(_mm256_set1_ps(1.0904f),
+                           _mm256_mul_ps(ad, _mm256_add_ps(
+                           _mm256_set1_ps(-3.2452f), _mm256_mul_ps(ad,
+                           _mm256_sub_ps(_mm256_set1_ps(3.55645f),
+                           _mm256_mul_ps(ad, _mm256_set1_ps(1.43519f)))))));
+                __m256 B = poly_avx(ad, 0.848013f, -1.06021f, 0.215638f);
+                __m256 t = _mm256_add_ps(_mm256_set1_ps(c.t),
+                           _mm256_mul_ps(_mm256_set1_ps(c.c2), _mm256_add_ps(
+                           _mm256_mul_ps(A, _mm256_set1_ps(c.c1)), B)));
+
+                __m256 qw = _mm256_add_ps(aw,
+                            _mm256_mul_ps(t, _mm256_sub_ps(bw, aw)));
+                __m256 qx = _mm256_add_ps(ax,
+                            _mm256_mul_ps(t, _mm256_sub_ps(bx, ax)));
+                __m256 qy = _mm256_add_ps(ay,
+                            _mm256_mul_ps(t, _mm256_sub_ps(by, ay)));
+                __m256 qz = _mm256_add_ps(az,
+                            _mm256_mul_ps(t, _mm256_sub_ps(bz, az)));
+
+                __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(
+                                _mm256_add_ps(_mm256_mul_ps(qw, qw),
+                                              _mm256_mul_ps(qx, qx)),
+                                _mm256_mul_ps(qy, qy)), _mm256_mul_ps(qz, qz)));
+                _mm256_storeu_ps(out + j, _mm256_div_ps(qw, length));
+                _mm256_storeu_ps(out + stride + j, _mm256_div_ps(qx, length));
+                _mm256_storeu_ps(out + 2 * stride + j,
+                                 _mm256_div_ps(qy, length));
+                _mm256_storeu_ps(out + 3 * stride + j,
+                                 _mm256_div_ps(qz, length));
+
+                int slow = _mm256_movemask_ps(_mm256_cmp_ps(ad,
+                               _mm256_set1_ps(minCos), _CMP_LT_OQ));
+                for (; slow; slow &= slow - 1)
+                {
+                    size_t k = j + __builtin_ctz(slow);
+                    if (k < numJoints) slerp_joint(a, b, c.t, stride, k, out);
+                }
+            }
+        }
+#endif
+
+        typedef void (*LerpRows)(const float*, const float*, float,
+                                 size_t, float*);
+        typedef void (*NlerpRows)(const float*, const float*,
+                                  const Correction&, size_t, size_t, float,
+                                  float*);
+
+#ifdef ST_X86_KERNELS
+        LerpRows lerp_rows = CpuHasAVX2() ? lerp_avx :
+                             CpuHasSSE41() ? lerp_sse41 : lerp_scalar;
+        NlerpRows nlerp_rows = CpuHasAVX2() ? nlerp_avx :
+                               CpuHasSSE41() ? nlerp_sse41 : nlerp_scalar;
+#else
+        LerpRows lerp_rows = lerp_scalar;
+        NlerpRows nlerp_rows = nlerp_scalar;
+#endif
+
+        //-- Joint 'j' of a pose as w, x, y, z and x, y, z --//
+        struct PoseJoint
+        {
+            PoseJoint(const float* pose, size_t stride, size_t j)
+                : w(pose[3 * stride + j]), x(pose[4 * stride + j]),
+                  y(pose[5 * stride + j]), z(pose[6 * stride + j]),
+                  px(pose[j]), py(pose[stride + j]), pz(pose[2 * stride + j])
+            {}
+
+            void Store(float* pose, size_t stride, size_t j) const
+            {
+                pose[j] = px;
+                pose[stride + j] = py;
+                pose[2 * stride + j] = pz;
+                pose[3 * stride + j] = w;
+                pose[4 * stride + j] = x;
+                pose[5 * stride + j] = y;
+                pose[6 * stride + j] = z;
+            }
+
+            float w, x, y, z;
+            float px, py, pz;
+        };
+
+        /** Same as Quaternion::Rotate() of the position by the
+            orientation of 'q', or by its conjugate if 'sign' is -1.
+        */
+        inline void rotate(const PoseJoint& q, float sign, float& vx,
+                           float& vy, float& vz)
+        {
+            float x = sign * q.x, y = sign * q.y, z = sign * q.z;
+            float tx = 2.0f * (y * vz - z * vy);
+            float ty = 2.0f * (z * vx - x * vz);
+            float tz = 2.0f * (x * vy - y * vx);
+            float rx = vx + q.w * tx + (y * tz - z * ty);
+            float ry = vy + q.w * ty + (z * tx - x * tz);
+            float rz = vz + q.w * tz + (x * ty - y * tx);
+            vx = rx;
+            vy = ry;
+            vz = rz;
+        }
+
+        /** Orientation of 'a', or of its conjugate if 'sign' is -1,
+            times the orientation of 'b' written to 'b'.
+        */
+        inline void multiply(const PoseJoint& a, float sign, PoseJoint& b)
+        {
+            float x = sign * a.x, y = sign * a.y, z = sign * a.z;
+            float w = a.w * b.w - x * b.x - y * b.y - z * b.z;
+            float rx = a.w * b.x + x * b.w + y * b.z - z * b.y;
+            float ry = a.w * b.y - x * b.z + y * b.w + z * b.x;
+            float rz = a.w * b.z + x * b.y - y * b.x + z * b.w;
+            b.w = w;
+            b.x = rx;
+            b.y = ry;
+            b.z = rz;
+        }
+
+        inline void normalize(PoseJoint& q)
+        {
+            float length = sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+            if (length > 0.0f)
+            {
+                float scale = 1.0f / length;
+                q.w *= scale;
+                q.x *= scale;
+                q.y *= scale;
+                q.z *= scale;
+            }
+        }
+
+        //-- Largest difference from slerp for quaternions 'angle' apart --//
+        float nlerp_error(float angle)
+        {
+            // Error depends only on the angle, so take a = 1
+            // and b rotated from it in one plane.
+            float d = cos(angle), s = sin(angle);
+            float maxError = 0.0f;
+            for (int k = 1; k < 32; k++)
+            {
+                Correction c(k / 32.0f);
+                float t = corrected(d, c);
+                float w = 1.0f + t * (d - 1.0f), x = t * s;
+
+                // Rotation angle is twice the angle between quaternions.
+                float error = 2.0f * fabs(atan2(x, w) - c.t * angle);
+                maxError = max(maxError, error);
+            }
+            return maxError;
+        }
+    }
+
+    PoseBlender::PoseBlender() : nlerp(false), minCos(1.0f)
+    {
+    }
+
+    void PoseBlender::SetSlerp()
+    {
+        nlerp = false;
+    }
+
+    void PoseBlender::SetNlerp(float tolerance)
+    {
+        nlerp = true;
+
+        // Error grows with the angle, find where it passes the tolerance.
+        const int steps = 512;
+        minCos = 1.0f;
+        for (int i = 1; i <= steps; i++)
+        {
+            float angle = i * half_pi / steps;
+            if (nlerp_error(angle) > tolerance) break;
+            minCos = cos(angle);
+        }
+    }
+
+    void PoseBlender::Blend(const float* a, const float* b, float quotient,
+                            size_t numJoints, float* out) const
+    {
+        size_t stride = PoseStride(numJoints);
+        lerp_rows(a, b, quotient, 3 * stride, out);
+
+        a += 3 * stride;
+        b += 3 * stride;
+        out += 3 * stride;
+
+        // Same ends as Quaternion::Slerp().
+        if (quotient <= 0.0f || quotient >= 1.0f)
+        {
+            const float* end = quotient <= 0.0f ? a : b;
+            memcpy(out, end, 4 * stride * sizeof(float));
+            return;
+        }
+
+        if (nlerp)
+        {
+            nlerp_rows(a, b, Correction(quotient), stride, numJoints, minCos,
+                       out);
+            return;
+        }
+
+        for (size_t j = 0; j < numJoints; j++)
+            slerp_joint(a, b, quotient, stride, j, out);
+        for (size_t j = numJoints; j < stride; j++)
+        {
+            out[j] = 1.0f;
+            out[stride + j] = out[2 * stride + j] = out[3 * stride + j] = 0.0f;
+        }
+    }
+
+    void PoseBlender::Add(const float* base, const float* additive,
+                          const float* reference, float weight,
+                          size_t numJoints, float* out) const
+    {
+        size_t stride = PoseStride(numJoints);
+        if (out != base) memcpy(out, base, PoseSize(numJoints) * sizeof(float));
+
+        weight = max(0.0f, min(weight, 1.0f));
+        Correction c(weight);
+        for (size_t j = 0; j < numJoints; j++)
+        {
+            PoseJoint joint(out, stride, j);
+            PoseJoint ref(reference, stride, j);
+            PoseJoint delta(additive, stride, j);
+            joint.px += weight * (delta.px - ref.px);
+            joint.py += weight * (delta.py - ref.py);
+            joint.pz += weight * (delta.pz - ref.pz);
+
+            // Rotation from the reference to the additive pose,
+            // taken the short way and scaled by the weight.
+            multiply(ref, -1.0f, delta);
+            float sign = delta.w < 0.0f ? -1.0f : 1.0f;
+            Quaternion q(sign * delta.w, sign * delta.x, sign * delta.y,
+                         sign * delta.z);
+            if (weight < 1.0f)
+            {
+                if (nlerp && q.w >= minCos)
+                {
+                    float t = corrected(q.w, c);
+                    q = Quaternion(1.0f + t * (q.w - 1.0f), t * q.x, t * q.y,
+                                   t * q.z);
+                }
+                else q = Quaternion::Slerp(Quaternion(1.0f), q, weight);
+            }
+            delta.w = q.w;
+            delta.x = q.x;
+            delta.y = q.y;
+            delta.z = q.z;
+
+            multiply(joint, 1.0f, delta);
+            normalize(delta);
+            joint.w = delta.w;
+            joint.x = delta.x;
+            joint.y = delta.y;
+            joint.z = delta.z;
+            joint.Store(out, stride, j);
+        }
+    }
+
+    void PoseToLocal(const float* in, const int* parents, size_t numJoints,
+                     float* out)
+    {
+        size_t stride = PoseStride(numJoints);
+        if (out != in) memcpy(out, in, PoseSize(numJoints) * sizeof(float));
+
+        // Going backwards every parent is still in object space.
+        for (size_t i = numJoints; i-- > 0;)
+        {
+            int parent = parents[i];
+            if (parent < 0) continue;
+
+            PoseJoint p(out, stride, parent);
+            PoseJoint joint(out, stride, i);
+            joint.px -= p.px;
+            joint.py -= p.py;
+            joint.pz -= p.pz;
+            rotate(p, -1.0f, joint.px, joint.py, joint.pz);
+            multiply(p, -1.0f, joint);
+            joint.Store(out, stride, i);
+        }
+    }
+
+    void PoseToObject(const float* in, const int* parents, size_t numJoints,
+                      float* out)
+    {
+        size_t stride = PoseStride(numJoints);
+        if (out != in) memcpy(out, in, PoseSize(numJoints) * sizeof(float));
+
+        for (size_t i = 0; i < numJoints; i++)
+        {
+            int parent = parents[i];
+            if (parent < 0) continue;
+
+            PoseJoint p(out, stride, parent);
+            PoseJoint joint(out, stride, i);
+            rotate(p, 1.0f, joint.px, joint.py, joint.pz);
+            joint.px += p.px;
+            joint.py += p.py;
+            joint.pz += p.pz;
+            multiply(p, 1.0f, joint);
+            normalize(joint);
+            joint.Store(out, stride, i);
+        }
+    }
+}
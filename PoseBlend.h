@@ -0,0 +1,65 @@
+#ifndef POSEBLEND_H_INCLUDED
+#define POSEBLEND_H_INCLUDED
+
+#include <cstddef>
+
+namespace ST
+{
+    /** Pose of a skeleton laid out as a structure of arrays: seven rows
+        of position x, y, z and orientation w, x, y, z. Every row holds
+        'stride' joints, the number of joints rounded up to 8, so kernels
+        never need tails. Padding joints keep the identity orientation.
+        Poses of many frames can be stored one after another.
+    */
+    inline size_t PoseStride(size_t numJoints)
+    {
+        return (numJoints + 7) & ~size_t(7);
+    }
+    inline size_t PoseSize(size_t numJoints)
+    {
+        return 7 * PoseStride(numJoints);
+    }
+
+    /** Interpolates whole poses at once. Positions are interpolated
+        linearly. Orientations either by slerp, with the same results
+        as Quaternion::Slerp(), or by nlerp with a correction of the
+        quotient that follows slerp within a given angle.
+    */
+    class PoseBlender
+    {
+    public:
+        PoseBlender();
+
+        void SetSlerp();
+        /** Joints that rotate too far between the poses for nlerp
+            to stay within 'tolerance' radians of slerp still use slerp.
+        */
+        void SetNlerp(float tolerance);
+        bool IsNlerp() const { return nlerp; }
+
+        /** Writes pose 'a' interpolated towards 'b' by 'quotient' to 'out'. */
+        void Blend(const float* a, const float* b, float quotient,
+                   size_t numJoints, float* out) const;
+        /** Writes 'base' with the difference of 'additive' from
+            'reference' added by 'weight' to 'out'. Poses are local.
+        */
+        void Add(const float* base, const float* additive,
+                 const float* reference, float weight, size_t numJoints,
+                 float* out) const;
+
+    private:
+        bool  nlerp;
+        float minCos; //!< Smallest |a . b| nlerp is used for.
+    };
+
+    /** Convert a pose between object space and the space of the parent
+        joints, 'parents' has -1 for the roots. Parents must go before
+        their children. 'in' and 'out' may be the same pose.
+    */
+    void PoseToLocal(const float* in, const int* parents, size_t numJoints,
+                     float* out);
+    void PoseToObject(const float* in, const int* parents, size_t numJoints,
+                      float* out);
+}
+
+#endif // POSEBLEND_H_INCLUDED
@@ -0,0 +1,323 @@
+#include "Skinning.h"
+#include "CpuFeatures.h"
+
+#ifdef ST_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    void SkinStream::Clear()
+    {
+        offset.clear(); joints.clear(); joint.clear(); bias.clear();
+        x.clear(); y.clear(); z.clear();
+        nx.clear(); ny.clear(); nz.clear();
+        px.clear(); py.clear(); pz.clear();
+        qx.clear(); qy.clear(); qz.clear();
+    }
+
+    void PackSkeleton(const MD5Animation::Skeleton& skeleton,
+                      PackedSkeleton& packed)
+    {
+        packed.resize(8 * skeleton.size());
+        for (size_t i = 0; i < skeleton.size(); i++)
+        {
+            const MD5Animation::SkeletonJoint& joint = skeleton[i];
+            float* p = &packed[8 * i];
+            p[0] = joint.pos[0];
+            p[1] = joint.pos[1];
+            p[2] = joint.pos[2];
+            p[3] = joint.orient.w;
+            p[4] = joint.orient.x;
+            p[5] = joint.orient.y;
+            p[6] = joint.orient.z;
+            p[7] = 0.0f;
+        }
+    }
+
+    namespace
+    {
+        //-- Same operations as Quaternion::Rotate() --//
+        inline void rotate(const float* q, float vx, float vy, float vz,
+                           float& rx, float& ry, float& rz)
+        {
+            float tx = 2 * (q[2] * vz - q[3] * vy);
+            float ty = 2 * (q[3] * vx - q[1] * vz);
+            float tz = 2 * (q[1] * vy - q[2] * vx);
+
+            rx = vx + q[0] * tx + (q[2] * tz - q[3] * ty);
+            ry = vy + q[0] * ty + (q[3] * tx - q[1] * tz);
+            rz = vz + q[0] * tz + (q[1] * ty - q[2] * tx);
+        }
+
+        void skin_weights_scalar(SkinStream& s, const float* joints,
+                                 int begin, int end)
+        {
+            for (int k = begin; k < end; k++)
+            {
+                const float* joint = joints + 8 * s.joint[k];
+                const float bias = s.bias[k];
+                float rx, ry, rz;
+
+                rotate(joint + 3, s.x[k], s.y[k], s.z[k], rx, ry, rz);
+                s.px[k] = (joint[0] + rx) * bias;
+                s.py[k] = (joint[1] + ry) * bias;
+                s.pz[k] = (joint[2] + rz) * bias;
+
+                rotate(joint + 3, s.nx[k], s.ny[k], s.nz[k], rx, ry, rz);
+                s.qx[k] = rx * bias;
+                s.qy[k] = ry * bias;
+                s.qz[k] = rz * bias;
+            }
+        }
+
+#ifdef ST_X86_KERNELS
+        __attribute__((target("sse4.1")))
+        inline void rotate4(__m128 qw, __m128 qx, __m128 qy, __m128 qz,
+                            __m128 vx, __m128 vy, __m128 vz,
+                            __m128& rx, __m128& ry, __m128& rz)
+        {
+            __m128 two = _mm_set1_ps(2.0f);
+            __m128 tx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qy, vz),
+                                                   _mm_mul_ps(qz, vy)));
+            __m128 ty = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qz, vx),
+                                                   _mm_mul_ps(qx, vz)));
+            __m128 tz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qx, vy),
+                                                   _mm_mul_ps(qy, vx)));
+
+            rx = _mm_add_ps(_mm_add_ps(vx, _mm_mul_ps(qw, tx)),
+                 _mm_sub_ps(_mm_mul_ps(qy, tz), _mm_mul_ps(qz, ty)));
+            ry = _mm_add_ps(_mm_add_ps(vy, _mm_mul_ps(qw, ty)),
+                 _mm_sub_ps(_mm_mul_ps(qz, tx), _mm_mul_ps(qx, tz)));
+            rz = _mm_add_ps(_mm_add_ps(vz, _mm_mul_ps(qw, tz)),
+                 _mm_sub_ps(_mm_mul_ps(qx, ty), _mm_mul_ps(qy, tx)));
+        }
+
+        __attribute__((target("sse4.1")))
+        void skin_weights_sse41(SkinStream& s, const float* joints,
+                                int begin, int end)
+        {
+            int k = begin;
+            for (; k + 4 <= end; k += 4)
+            {
+                const float* j0 = joints + 8 * s.joint[k + 0];
+                const float* j1 = joints + 8 * s.joint[k + 1];
+                const float* j2 = joints + 8 * s.joint[k + 2];
+                const float* j3 = joints + 8 * s.joint[k + 3];
+
+                // Two loads per joint and transposition give
+                // one register per component for 4 weights.
+                __m128 px = _mm_loadu_ps(j0), py = _mm_loadu_ps(j1);
+                __m128 pz = _mm_loadu_ps(j2), qw = _mm_loadu_ps(j3);
+                _MM_TRANSPOSE4_PS(px, py, pz, qw);
+                __m128 qx = _mm_loadu_ps(j0 + 4), qy = _mm_loadu_ps(j1 + 4);
+                __m128 qz = _mm_loadu_ps(j2 + 4), pad = _mm_loadu_ps(j3 + 4);
+                _MM_TRANSPOSE4_PS(qx, qy, qz, pad);
+
+                __m128 bias = _mm_loadu_ps(&s.bias[k]);
+                __m128 rx, ry, rz;
+
+                rotate4(qw, qx, qy, qz, _mm_loadu_ps(&s.x[k]),
+                        _mm_loadu_ps(&s.y[k]), _mm_loadu_ps(&s.z[k]),
+                        rx, ry, rz);
+                _mm_storeu_ps(&s.px[k], _mm_mul_ps(_mm_add_ps(px, rx), bias));
+                _mm_storeu_ps(&s.py[k], _mm_mul_ps(_mm_add_ps(py, ry), bias));
+                _mm_storeu_ps(&s.pz[k], _mm_mul_ps(_mm_add_ps(pz, rz), bias));
+
+                rotate4(qw, qx, qy, qz, _mm_loadu_ps(&s.nx[k]),
+                        _mm_loadu_ps(&s.ny[k]), _mm_loadu_ps(&s.nz[k]),
+                        rx, ry, rz);
+                _mm_storeu_ps(&s.qx[k], _mm_mul_ps(rx, bias));
+                _mm_storeu_ps(&s.qy[k], _mm_mul_ps(ry, bias));
+                _mm_storeu_ps(&s.qz[k], _mm_mul_ps(rz, bias));
+            }
+            skin_weights_scalar(s, joints, k, end);
+        }
+
+        __attribute__((target("avx2,fma")))
+        inline void rotate8(__m256 qw, __m256 qx, __m256 qy, __m256 qz,
+                            __m256 vx, __m256 vy, __m256 vz,
+                            __m256& rx, __m256& ry, __m256& rz)
+        {
+            __m256 two = _mm256_set1_ps(2.0f);
+            __m256 tx = _mm256_mul_ps(two,
+                _mm256_fmsub_ps(qy, vz, _mm256_mul_ps(qz, vy)));
+            __m256 ty = _mm256_mul_ps(two,
+                _mm256_fmsub_ps(qz, vx, _mm256_mul_ps(qx, vz)));
+            __m256 tz = _mm256_mul_ps(two,
+                _mm256_fmsub_ps(qx, vy, _mm256_mul_ps(qy, vx)));
+
+            rx = _mm256_add_ps(_mm256_fmadd_ps(qw, tx, vx),
+                 _mm256_fmsub_ps(qy, tz, _mm256_mul_ps(qz, ty)));
+            ry = _mm256_add_ps(_mm256_fmadd_ps(qw, ty, vy),
+                 _mm256_fmsub_ps(qz, tx, _mm256_mul_ps(qx, tz)));
+            rz = _mm256_add_ps(_mm256_fmadd_ps(qw, tz, vz),
+                 _mm256_fmsub_ps(qx, ty, _mm256_mul_ps(qy, tx)));
+        }
+
+        __attribute__((target("avx2,fma")))
+        void skin_weights_avx2(SkinStream& s, const float* joints,
+                               int begin, int end)
+        {
+            int k = begin;
+            for (; k + 8 <= end; k += 8)
+            {
+                // Joints are 8 floats apart, so joint index * 8
+                // is the offset of the joint in the packed skeleton.
+                __m256i index = _mm256_slli_epi32(_mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&s.joint[k])), 3);
+                __m256 px = _mm256_i32gather_ps(joints + 0, index, 4);
+                __m256 py = _mm256_i32gather_ps(joints + 1, index, 4);
+                __m256 pz = _mm256_i32gather_ps(joints + 2, index, 4);
+                __m256 qw = _mm256_i32gather_ps(joints + 3, index, 4);
+                __m256 qx = _mm256_i32gather_ps(joints + 4, index, 4);
+                __m256 qy = _mm256_i32gather_ps(joints + 5, index, 4);
+                __m256 qz = _mm256_i32gather_ps(joints + 6, index, 4);
+
+                __m256 bias = _mm256_loadu_ps(&s.bias[k]);
+                __m256 rx, ry, rz;
+
+                rotate8(qw, qx, qy, qz, _mm256_loadu_ps(&s.x[k]),
+                        _mm256_loadu_ps(&s.y[k]), _mm256_loadu_ps(&s.z[k]),
+                        rx, ry, rz);
+                _mm256_storeu_ps(&s.px[k],
+                                 _mm256_mul_ps(_mm256_add_ps(px, rx), bias));
+                _mm256_storeu_ps(&s.py[k],
+                                 _mm256_mul_ps(_mm256_add_ps(py, ry), bias));
+                _mm256_storeu_ps(&s.pz[k],
+                                 _mm256_mul_ps(_mm256_add_ps(pz, rz), bias));
+
+                rotate8(qw, qx, qy, qz, _mm256_loadu_ps(&s.nx[k]),
+                        _mm256_loadu_ps(&s.ny[k]), _mm256_loadu_ps(&s.nz[k]),
+                        rx, ry, rz);
+                _mm256_storeu_ps(&s.qx[k], _mm256_mul_ps(rx, bias));
+                _mm256_storeu_ps(&s.qy[k], _mm256_mul_ps(ry, bias));
+                _mm256_storeu_ps(&s.qz[k], _mm256_mul_ps(rz, bias));
+            }
+            skin_weights_scalar(s, joints, k, end);
+        }
+#endif
+
+        typedef void (*SkinWeights)(SkinStream&, const float*, int, int);
+
+        SkinWeights get_kernel(SkinningKernel kernel)
+        {
+#ifdef ST_X86_KERNELS
+            if (kernel == SKINNING_KERNEL_AVX2) return skin_weights_avx2;
+            if (kernel == SKINNING_KERNEL_SSE41) return skin_weights_sse41;
+#endif
+            return skin_weights_scalar;
+        }
+
+        SkinningKernel current_kernel = GetBestSkinningKernel();
+        SkinWeights skin_weights = get_kernel(current_kernel);
+    }
+
+    SkinningKernel GetBestSkinningKernel()
+    {
+        if (CpuHasAVX2()) return SKINNING_KERNEL_AVX2;
+        if (CpuHasSSE41()) return SKINNING_KERNEL_SSE41;
+        return SKINNING_KERNEL_SCALAR;
+    }
+
+    SkinningKernel GetSkinningKernel()
+    {
+        return current_kernel;
+    }
+
+    bool SetSkinningKernel(SkinningKernel kernel)
+    {
+        if ((kernel == SKINNING_KERNEL_AVX2 && !CpuHasAVX2()) ||
+            (kernel == SKINNING_KERNEL_SSE41 && !CpuHasSSE41()))
+            return false;
+
+        current_kernel = kernel;
+        skin_weights = get_kernel(kernel);
+        return true;
+    }
+
+    void SkinStreamRange(SkinStream& s, const PackedSkeleton& skeleton,
+                         size_t first, size_t last,
+                         Vector3D* positions, Vector3D* normals)
+    {
+        if (first >= last) return;
+
+        // Contribution of every weight. Arrays are read and written
+        // strictly in order, only the joint is looked up by index.
+        skin_weights(s, &skeleton[0], s.offset[first], s.offset[last]);
+
+        // Sum weights of every vertex in the same order as the md5 mesh.
+        for (size_t i = first; i < last; i++)
+        {
+            Vector3D pos, normal;
+            for (int k = s.offset[i]; k < s.offset[i + 1]; k++)
+            {
+                pos += Vector3D(s.px[k], s.py[k], s.pz[k]);
+                normal += Vector3D(s.qx[k], s.qy[k], s.qz[k]);
+            }
+            positions[i] = pos;
+            normals[i] = normal;
+        }
+    }
+
+    //-------------- Matrix palette --------------//
+    void JointMatrix::Set(const Vector3D& pos, const Quaternion& q)
+    {
+        float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+        float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+        float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+        m[0] = 1 - 2 * (yy + zz);
+        m[1] = 2 * (xy - wz);
+        m[2] = 2 * (xz + wy);
+        m[3] = pos[0];
+
+        m[4] = 2 * (xy + wz);
+        m[5] = 1 - 2 * (xx + zz);
+        m[6] = 2 * (yz - wx);
+        m[7] = pos[1];
+
+        m[8] = 2 * (xz - wy);
+        m[9] = 2 * (yz + wx);
+        m[10] = 1 - 2 * (xx + yy);
+        m[11] = pos[2];
+    }
+
+    void BuildMatrixPalette(const MD5Animation::Skeleton& skeleton,
+                            MatrixPalette& palette)
+    {
+        palette.resize(skeleton.size());
+        for (size_t i = 0; i < skeleton.size(); i++)
+            palette[i].Set(skeleton[i].pos, skeleton[i].orient);
+    }
+
+    void SkinPaletteRange(const SkinStream& s, const MatrixPalette& palette,
+                          size_t first, size_t last,
+                          Vector3D* positions, Vector3D* normals)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            float px = 0, py = 0, pz = 0;
+            float nx = 0, ny = 0, nz = 0;
+            for (int k = s.offset[i]; k < s.offset[i + 1]; k++)
+            {
+                const float* m = palette[s.joint[k]].m;
+                const float b = s.bias[k];
+                const float x = s.x[k], y = s.y[k], z = s.z[k];
+                px += b * (m[0] * x + m[1] * y + m[2] * z + m[3]);
+                py += b * (m[4] * x + m[5] * y + m[6] * z + m[7]);
+                pz += b * (m[8] * x + m[9] * y + m[10] * z + m[11]);
+
+                const float u = s.nx[k], v = s.ny[k], w = s.nz[k];
+                nx += b * (m[0] * u + m[1] * v + m[2] * w);
+                ny += b * (m[4] * u + m[5] * v + m[6] * w);
+                nz += b * (m[8] * u + m[9] * v + m[10] * w);
+            }
+            positions[i] = Vector3D(px, py, pz);
+            normals[i] = Vector3D(nx, ny, nz);
+        }
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef SKINNING_H_INCLUDED
+#define SKINNING_H_INCLUDED
+
+#include <vector>
+#include "MD5Animation.h"
+#include "math/Vector3D.h"
+#include "math/Quaternion.h"
+
+namespace ST
+{
+    /** Set of joints as bits. Joints from 63 on share the last bit,
+        so for bigger skeletons the set may hold some extra joints.
+    */
+    typedef unsigned long long JointMask;
+    inline JointMask JointBit(int joint)
+    {
+        return 1ull << (joint < 63 ? joint : 63);
+    }
+
+    /** Skinning data of a mesh laid out as a structure of arrays.
+        Weights are stored in the order of the vertices they belong to,
+        so weights of vertex 'i' are [offset[i]; offset[i + 1]) and
+        skinning walks every array linearly from start to end.
+    */
+    struct SkinStream
+    {
+        void Clear();
+        size_t NumVertices() const
+        {
+            return offset.empty() ? 0 : offset.size() - 1;
+        }
+        size_t NumWeights() const { return bias.size(); }
+
+        std::vector<int>   offset;     //!< First weight of each vertex + end.
+        std::vector<JointMask> joints; //!< Joints each vertex depends on.
+        std::vector<int>   joint;      //!< Joint index of each weight.
+        std::vector<float> bias;       //!< Bias of each weight.
+        std::vector<float> x, y, z;    //!< Weight position in joint space.
+        std::vector<float> nx, ny, nz; //!< Bind-pose normal of the vertex
+                                       //!< in joint space, for each weight.
+
+        // Per-weight results of the first skinning pass.
+        std::vector<float> px, py, pz; //!< Weighted position.
+        std::vector<float> qx, qy, qz; //!< Weighted normal.
+    };
+
+    /** Joints of the skeleton packed for skinning kernels, 8 floats
+        per joint: position x, y, z, orientation w, x, y, z and padding.
+        Packing is done once per frame for all the meshes.
+    */
+    typedef std::vector<float> PackedSkeleton;
+    void PackSkeleton(const MD5Animation::Skeleton& skeleton,
+                      PackedSkeleton& packed);
+
+    /** Implementations of the first skinning pass. SIMD kernels process
+        4 (SSE4.1) or 8 (AVX2) weights at once. Results of SIMD kernels
+        may differ from the scalar one in the last bits.
+    */
+    enum SkinningKernel
+    {
+        SKINNING_KERNEL_SCALAR,
+        SKINNING_KERNEL_SSE41,
+        SKINNING_KERNEL_AVX2
+    };
+
+    /** The fastest kernel supported by the CPU. It's used by default. */
+    SkinningKernel GetBestSkinningKernel();
+    SkinningKernel GetSkinningKernel();
+    /** Returns false and keeps current kernel if CPU can't run 'kernel'. */
+    bool SetSkinningKernel(SkinningKernel kernel);
+
+    /** Skins vertices [first; last) of the stream by the packed skeleton.
+        The first pass computes contribution of every weight,
+        the second one sums them up for every vertex.
+    */
+    void SkinStreamRange(SkinStream& stream, const PackedSkeleton& skeleton,
+                         size_t first, size_t last,
+                         Math::Vector3D* positions, Math::Vector3D* normals);
+
+    /** Transformation of a joint as a 3x4 matrix [R | t] stored by rows.
+        Weight positions are given in the joint space, so the matrix
+        takes them straight to the object space.
+    */
+    struct JointMatrix
+    {
+        void Set(const Math::Vector3D& pos, const Math::Quaternion& orient);
+
+        Math::Vector3D Transform(const Math::Vector3D& v) const
+        {
+            return Math::Vector3D(m[0] * v[0] + m[1] * v[1] + m[2] * v[2] + m[3],
+                                  m[4] * v[0] + m[5] * v[1] + m[6] * v[2] + m[7],
+                                  m[8] * v[0] + m[9] * v[1] + m[10] * v[2] + m[11]);
+        }
+        Math::Vector3D Rotate(const Math::Vector3D& v) const
+        {
+            return Math::Vector3D(m[0] * v[0] + m[1] * v[1] + m[2] * v[2],
+                                  m[4] * v[0] + m[5] * v[1] + m[6] * v[2],
+                                  m[8] * v[0] + m[9] * v[1] + m[10] * v[2]);
+        }
+        /** Rotation is orthogonal, so the inverse is the transposition. */
+        Math::Vector3D InverseRotate(const Math::Vector3D& v) const
+        {
+            return Math::Vector3D(m[0] * v[0] + m[4] * v[1] + m[8] * v[2],
+                                  m[1] * v[0] + m[5] * v[1] + m[9] * v[2],
+                                  m[2] * v[0] + m[6] * v[1] + m[10] * v[2]);
+        }
+
+        float m[12];
+    };
+
+    /** One matrix per joint of the pose. The palette is built once
+        per frame and can be shared by every instance of the model
+        that plays the same pose.
+    */
+    typedef std::vector<JointMatrix> MatrixPalette;
+    void BuildMatrixPalette(const MD5Animation::Skeleton& skeleton,
+                            MatrixPalette& palette);
+
+    /** Skins vertices [first; last) of the stream by the matrix palette.
+        Results differ from SkinStreamRange() only by rounding.
+    */
+    void SkinPaletteRange(const SkinStream& stream, const MatrixPalette& palette,
+                          size_t first, size_t last,
+                          Math::Vector3D* positions, Math::Vector3D* normals);
+}
+
+#endif // SKINNING_H_INCLUDED
@@ -0,0 +1,19 @@
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include "../Shader.h"
+
+namespace ST
+{
+    // Benchmarks run by main(), each prints a table of its timings.
+    // Models upload their meshes, so they are loaded with the shader
+    // main() creates in its context.
+    void BenchSkinning(const Shader& shader);
+    void BenchLoad();
+    void BenchCache(const Shader& shader);
+    void BenchIKBatch(const Shader& shader);
+    void BenchIKBody(const Shader& shader);
+    void BenchKinematics();
+}
+
+#endif // BENCH_H_INCLUDED
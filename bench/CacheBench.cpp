@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <string>
+#include "Bench.h"
+#include "../Timer.h"
+#include "../MD5Model.h"
+
+using namespace std;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+
+        const int cold_loads = 20;
+        const int cached_loads = 200;
+
+        //-- Milliseconds of one load, the cache is removed before each --//
+        template <typename Load>
+        double timeLoads(const string& cacheName, bool cold, Load load)
+        {
+            int loads = cold ? cold_loads : cached_loads;
+            double elapsed = 0.0;
+            Timer timer;
+            for (int i = 0; i < loads; i++)
+            {
+                if (cold) remove(cacheName.c_str());
+                timer.Reset();
+                load();
+                elapsed += timer.ElapsedTime();
+            }
+            return elapsed * 1000.0 / loads;
+        }
+
+        template <typename Load>
+        void report(const char* name, const string& cacheName, Load load)
+        {
+            double cold = timeLoads(cacheName, true, load);
+            double cached = timeLoads(cacheName, false, load);
+            printf("%-16s  %8.3f  %9.3f  %7.1f\n", name, cold, cached,
+                   cold / cached);
+        }
+    }
+
+    /** Loads Bob from the text files, which writes the caches,
+        and from the caches written by the previous load.
+    */
+    void BenchCache(const Shader& shader)
+    {
+        printf("%d cold loads, %d cached loads\n", cold_loads, cached_loads);
+        printf("%-16s  %8s  %9s  %7s\n", "file", "cold ms", "cached ms",
+               "speedup");
+
+        report("md5mesh", GetCacheName(mesh_file), [&]
+        {
+            MD5Model model;
+            model.Load(mesh_file, shader);
+        });
+        report("md5anim", GetCacheName(anim_file), []
+        {
+            MD5Animation anim;
+            anim.LoadAnimation(anim_file);
+        });
+        report("md5anim, packed", GetCacheName(string(anim_file) + ".z"), []
+        {
+            MD5Animation anim;
+            anim.LoadAnimation(anim_file, true);
+        });
+    }
+}
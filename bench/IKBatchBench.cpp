@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include "Bench.h"
+#include "../Timer.h"
+#include "../IKBatch.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+
+        // Hands and feet of every model.
+        const char* const limbs[][2] =
+        {
+            { "upperarm.L", "wrist.L" },
+            { "upperarm.R", "wrist.R" },
+            { "thigh.L", "ankle.L" },
+            { "thigh.R", "ankle.R" }
+        };
+        const size_t num_limbs = sizeof(limbs) / sizeof(limbs[0]);
+
+        const size_t num_models = 32;
+        const int warmup_frames = 5;
+        const int timed_frames = 50;
+        const float frame_time = 1.0f / 60;
+
+        //-- Every end reaches a bit towards the root of its chain --//
+        void setTargets(IKBatch& batch, vector<unique_ptr<MD5Model> >& models,
+                        const vector<IKChain>& chains)
+        {
+            for (size_t job = 0; job < batch.GetNumJobs(); job++)
+            {
+                const MD5Model::JointList& pose =
+                    models[job / num_limbs]->GetPose();
+                Vector3D root = pose[chains[job].GetRoot()].pos;
+                Vector3D end = pose[chains[job].GetEnd()].pos;
+                batch.SetTarget(job, IKTarget(end + (root - end) * 0.2f));
+            }
+        }
+    }
+
+    /** Solves the hands and feet of a crowd of animated Bob models
+        every frame, with job pools of 1 up to a thread per hardware
+        core. Only the solves are timed.
+    */
+    void BenchIKBatch(const Shader& shader)
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+
+        // Chains aren't shared, so each one warm-starts on its own.
+        vector<unique_ptr<MD5Model> > models;
+        vector<IKChain> chains(num_models * num_limbs);
+        IKBatch batch;
+        for (size_t i = 0; i < num_models; i++)
+        {
+            models.push_back(unique_ptr<MD5Model>(new MD5Model()));
+            MD5Model& model = *models.back();
+            model.Load(mesh_file, shader);
+            model.SetAnimation(anim);
+            model.Update(i * frame_time);
+
+            for (size_t l = 0; l < num_limbs; l++)
+            {
+                IKChain& chain = chains[i * num_limbs + l];
+                chain = IKChain(model.GetSkeleton(), limbs[l][0], limbs[l][1]);
+                chain.SetWarmStart(true);
+                batch.Add(model, chain, IKTarget());
+            }
+        }
+
+        size_t maxThreads = max(thread::hardware_concurrency(), 1u);
+        printf("%u models, %u jobs, %d frames\n", unsigned(num_models),
+               unsigned(batch.GetNumJobs()), timed_frames);
+        printf("threads  solves/ms  reached  speedup\n");
+
+        double single = 0.0;
+        for (size_t threads = 1; threads <= maxThreads; threads++)
+        {
+            JobPool pool(threads);
+            batch.SetJobPool(&pool);
+
+            double elapsed = 0.0;
+            size_t reached = 0;
+            Timer timer;
+            for (int frame = 0; frame < warmup_frames + timed_frames; frame++)
+            {
+                for (size_t i = 0; i < models.size(); i++)
+                    models[i]->Animate(frame_time);
+                setTargets(batch, models, chains);
+
+                timer.Reset();
+                size_t solved = batch.Solve();
+                if (frame >= warmup_frames)
+                {
+                    elapsed += timer.ElapsedTime();
+                    reached += solved;
+                }
+
+                for (size_t i = 0; i < models.size(); i++)
+                    models[i]->Skin();
+            }
+
+            size_t solves = batch.GetNumJobs() * timed_frames;
+            double rate = solves / (elapsed * 1000.0);
+            if (threads == 1) single = rate;
+            printf("%7u  %9.1f  %6.1f%%  %7.2f\n", unsigned(threads), rate,
+                   100.0 * reached / solves, rate / single);
+
+            batch.SetJobPool(0);
+        }
+    }
+}
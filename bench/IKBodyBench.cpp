@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cmath>
+#include "Bench.h"
+#include "../Timer.h"
+#include "../IKBody.h"
+#include "../math/Utility.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+
+        const int num_solves = 500;
+        const float frame_time = 1.0f / 60;
+
+        struct Result
+        {
+            double ms;         // Of one solve.
+            double iterations; // Average of the solves.
+            double reached;    // Share of the solves that reached all.
+        };
+
+        /** Feet planted, the left hand circles in front of the chest
+            and the head looks at a point going round with it. Each solve
+            starts from the bind pose, or from the last solution if
+            'tracking' is set, as it would from frame to frame.
+        */
+        Result solveBody(IKBody& body, const MD5Model::JointList& bind,
+                         const IKChain& arm, size_t hand,
+                         const IKChain& head, size_t look, bool tracking)
+        {
+            Vector3D wrist = bind[arm.GetEnd()].pos;
+            Vector3D eyes = bind[head.GetEnd()].pos;
+
+            MD5Model::JointList joints = bind;
+            Result result = { 0.0, 0.0, 0.0 };
+            double elapsed = 0.0;
+            Timer timer;
+            for (int i = 0; i < num_solves; i++)
+            {
+                float angle = 2.0f * PI * i * frame_time;
+                Vector3D circle(5.0f * cos(angle), -5.0f, 5.0f * sin(angle));
+                body.SetTarget(hand, IKTarget(wrist + circle));
+                body.SetLookAt(look, eyes + circle * 4.0f +
+                                     Vector3D(0.0f, -40.0f, 0.0f));
+                if (!tracking) joints = bind;
+
+                timer.Reset();
+                bool reached = body.Solve(joints);
+                elapsed += timer.ElapsedTime();
+
+                result.iterations += body.GetIterations();
+                result.reached += reached ? 1.0 : 0.0;
+            }
+            result.ms = elapsed * 1000.0 / num_solves;
+            result.iterations /= num_solves;
+            result.reached *= 100.0 / num_solves;
+            return result;
+        }
+    }
+
+    /** Solves the whole Bob rig for both feet, a hand and the head,
+        the feet first and the others in their null space.
+    */
+    void BenchIKBody(const Shader& shader)
+    {
+        MD5Model model;
+        model.Load(mesh_file, shader);
+        const MD5Model::JointList& bind = model.GetSkeleton();
+
+        IKChain legL(bind, "pubis", "ankle.L");
+        IKChain legR(bind, "pubis", "ankle.R");
+        IKChain arm(bind, "pubis", "wrist.L");
+        IKChain head(bind, "pubis", "head");
+
+        IKBody body;
+        body.SetRootMotion(true);
+        body.AddTask(legL, IKTarget(bind[legL.GetEnd()].pos), 0);
+        body.AddTask(legR, IKTarget(bind[legR.GetEnd()].pos), 0);
+        size_t hand = body.AddTask(arm, IKTarget(), 1);
+        size_t look = body.AddLook(head, Vector3D(0.0f, -1.0f, 0.0f),
+                                   Vector3D(), 1);
+
+        printf("%u joints, %u tasks, %d solves\n", unsigned(bind.size()),
+               unsigned(body.GetNumTasks()), num_solves);
+        printf("%-10s  ms/solve  iterations  reached\n", "start");
+
+        const char* starts[] = { "bind pose", "last pose" };
+        for (int tracking = 0; tracking < 2; tracking++)
+        {
+            Result r = solveBody(body, bind, arm, hand, head, look,
+                                 tracking != 0);
+            printf("%-10s  %8.4f  %10.1f  %6.1f%%\n", starts[tracking],
+                   r.ms, r.iterations, r.reached);
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <vector>
+#include "Bench.h"
+#include "../Timer.h"
+#include "../ForwardKinematics.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        // A spine of 20 joints with 18 limbs of 10 joints hanging off it.
+        const int spine_joints = 20;
+        const int num_limbs = 18;
+        const int limb_joints = 10;
+        const int num_joints = spine_joints + num_limbs * limb_joints;
+
+        const int num_updates = 20000;
+
+        vector<int> makeRig()
+        {
+            vector<int> parents(num_joints);
+            for (int i = 0; i < spine_joints; i++)
+                parents[i] = i - 1;
+            for (int l = 0; l < num_limbs; l++)
+            {
+                int first = spine_joints + l * limb_joints;
+                parents[first] = 1 + l % (spine_joints - 1);
+                for (int j = 1; j < limb_joints; j++)
+                    parents[first + j] = first + j - 1;
+            }
+            return parents;
+        }
+
+        //-- Microseconds of one Update() after 'edited' turned --//
+        double timeUpdates(ForwardKinematics& fk, const vector<int>& edited,
+                           size_t& recomputed)
+        {
+            Timer timer;
+            timer.Reset();
+            for (int i = 0; i < num_updates; i++)
+            {
+                Quaternion turn(0.001f * (i % 100), Vector3D(0.0f, 0.0f, 1.0f));
+                for (size_t e = 0; e < edited.size(); e++)
+                    fk.SetLocalOrient(edited[e], turn);
+                recomputed = fk.Update();
+            }
+            return timer.ElapsedTime() * 1e6 / num_updates;
+        }
+    }
+
+    /** Updates the object-space transforms of a 200-joint rig after
+        edits of the root, of one limb, of a leaf and of a joint
+        in every limb.
+    */
+    void BenchKinematics()
+    {
+        vector<int> parents = makeRig();
+        ForwardKinematics fk;
+        fk.Build(parents);
+        for (int i = 0; i < num_joints; i++)
+            fk.SetLocal(i, Vector3D(0.0f, 1.0f, 0.0f),
+                        Quaternion(1.0f, 0.0f, 0.0f, 0.0f));
+        fk.Update();
+
+        vector<int> root(1, 0);
+        vector<int> limb(1, spine_joints);
+        vector<int> leaf(1, num_joints - 1);
+        vector<int> everyLimb;
+        for (int l = 0; l < num_limbs; l++)
+            everyLimb.push_back(spine_joints + l * limb_joints + 5);
+
+        struct Case
+        {
+            const char*        name;
+            const vector<int>* edited;
+        };
+        const Case cases[] =
+        {
+            { "root", &root },
+            { "one limb", &limb },
+            { "leaf", &leaf },
+            { "every limb", &everyLimb }
+        };
+
+        printf("%d joints, %d updates\n", num_joints, num_updates);
+        printf("%-10s  edited  joints  us/update  ns/joint\n", "edit");
+        for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+        {
+            size_t recomputed = 0;
+            double us = timeUpdates(fk, *cases[c].edited, recomputed);
+            printf("%-10s  %6u  %6u  %9.3f  %8.2f\n", cases[c].name,
+                   unsigned(cases[c].edited->size()), unsigned(recomputed),
+                   us, us * 1000.0 / recomputed);
+        }
+    }
+}
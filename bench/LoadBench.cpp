@@ -0,0 +1,218 @@
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include "Bench.h"
+#include "../Timer.h"
+#include "../MD5Parser.h"
+#include "../Log.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const char* const mesh_files[] =
+        {
+            "data/models/boblampclean.md5mesh",
+            "data/models/lamp.md5mesh"
+        };
+        const int num_loads = 200;
+
+        /** The text path MD5Parser had before the tokenizer: getline,
+            every skip string tried on every line, a stringstream and
+            a vector of strings per line, and stof/stoul. Kept only
+            as the reference of the benchmark.
+        */
+        class StreamParser
+        {
+        public:
+            StreamParser() : state(START), processed_line(0) {}
+
+            void Parse(const string& filename)
+            {
+                string line;
+                ifstream input(filename);
+                while (getline(input, line))
+                {
+                    processed_line++;
+                    bool skip_line = false;
+                    for (auto skip_str : skip_strings)
+                    {
+                        if (starts_with(line, skip_str))
+                        {
+                            skip_line = true;
+                            break;
+                        }
+                    }
+                    if (skip_line) continue;
+
+                    vector<string> tokens = tokenize(line);
+                    if (tokens.size() == 0) continue;
+                    if (state == START) process_start(tokens);
+                    else if (state == JOINTS) process_joints(tokens);
+                    else if (state == MESH) process_mesh(tokens);
+                    else process_unknown(tokens);
+                }
+                state = START;
+                processed_line = 0;
+            }
+
+            const vector<Mesh>& GetSkin() const { return skin; }
+            const vector<Joint>& GetSkeleton() const { return skeleton; }
+
+        private:
+            enum { START, JOINTS, MESH, UNKNOWN };
+            static const string skip_strings[12];
+
+            bool starts_with(const string& fullstring,
+                             const string& start) const
+            {
+                size_t i = fullstring.find_first_not_of(" \t");
+                if (i == string::npos) return false;
+                return fullstring.compare(i, start.length(), start) == 0;
+            }
+
+            vector<string> tokenize(const string& line) const
+            {
+                string token;
+                stringstream ss(line);
+                vector<string> tokens;
+                while (ss >> token)
+                {
+                    size_t i = token.find("//");
+                    if (i != string::npos)
+                    {
+                        if (i != 0) tokens.push_back(token.substr(0, i));
+                        break;
+                    }
+                    tokens.push_back(token);
+                }
+                return tokens;
+            }
+
+            void process_start(const vector<string>& tokens)
+            {
+                if (tokens[0] == "joints") state = JOINTS;
+                else if (tokens[0] == "mesh") state = MESH;
+                else state = UNKNOWN;
+            }
+
+            void process_joints(const vector<string>& tokens)
+            {
+                if (tokens.size() == 12)
+                {
+                    Joint joint;
+                    joint.name = tokens[0].substr(1, tokens[0].size() - 2);
+                    joint.parent = stoul(tokens[1]);
+                    joint.p = Vector3D(stof(tokens[3]), stof(tokens[4]),
+                                       stof(tokens[5]));
+                    joint.q = Quaternion(0, stof(tokens[8]), stof(tokens[9]),
+                                         stof(tokens[10]));
+                    joint.q.ComputeW();
+                    skeleton.push_back(joint);
+                }
+                else if (tokens[0] == "}") state = START;
+                else log_tokens("Malformed string: ", tokens);
+            }
+
+            void process_mesh(const vector<string>& tokens)
+            {
+                if (tokens[0] == "shader") mesh.texture_path = tokens[1];
+                else if (tokens[0] == "tri")
+                    for (size_t i = 2; i <= 4; i++)
+                        mesh.triangles.push_back(stoul(tokens[i]));
+                else if (tokens[0] == "vert")
+                {
+                    Vertex vertex;
+                    vertex.s = stof(tokens[3]); vertex.t = stof(tokens[4]);
+                    vertex.weight_index = stof(tokens[6]);
+                    vertex.weight_count = stof(tokens[7]);
+                    mesh.vertices.push_back(vertex);
+                }
+                else if (tokens[0] == "weight")
+                {
+                    Weight weight;
+                    weight.joint = stoul(tokens[2]);
+                    weight.bias = stof(tokens[3]);
+                    weight.p = Vector3D(stof(tokens[5]), stof(tokens[6]),
+                                        stof(tokens[7]));
+                    mesh.weights.push_back(weight);
+                }
+                else if (tokens[0] == "}")
+                {
+                    state = START;
+                    skin.push_back(mesh);
+                    mesh.Clear();
+                }
+            }
+
+            void process_unknown(const vector<string>& tokens)
+            {
+                state = START;
+                log_tokens("Malformed string: ", tokens);
+            }
+
+            void log_tokens(const string& prefix,
+                            const vector<string>& tokens) const
+            {
+                string line;
+                for (auto token : tokens) line += token;
+                log("(%d) %s%s", processed_line, prefix.c_str(), line.c_str());
+            }
+
+            Mesh mesh;
+            int state;
+            size_t processed_line;
+            vector<Mesh> skin;
+            vector<Joint> skeleton;
+        };
+
+        const string StreamParser::skip_strings[12] =
+        {
+            "//", "MD5Version", "commandline", "numJoints",
+            "numMeshes", "numverts", "numtris", "numweights",
+            "numFrames", "numJoints", "frameRate", "numAnimatedComponents"
+        };
+
+        //-- Milliseconds of one load, 'parsed' counts the vertices --//
+        template <typename Parser>
+        double timeLoads(const char* file, size_t& parsed)
+        {
+            Timer timer;
+            timer.Reset();
+            for (int i = 0; i < num_loads; i++)
+            {
+                Parser parser;
+                parser.Parse(file);
+
+                parsed = parser.GetSkeleton().size();
+                const vector<Mesh>& skin = parser.GetSkin();
+                for (size_t m = 0; m < skin.size(); m++)
+                    parsed += skin[m].vertices.size();
+            }
+            return timer.ElapsedTime() * 1000.0 / num_loads;
+        }
+    }
+
+    /** Parses the md5mesh files through the memory-mapped tokenizer
+        of MD5Parser and through the stringstream path it replaced.
+    */
+    void BenchLoad()
+    {
+        printf("%d loads of each file\n", num_loads);
+        printf("%-34s  stream ms  mapped ms  speedup\n", "file");
+        for (size_t f = 0; f < sizeof(mesh_files) / sizeof(mesh_files[0]);
+             f++)
+        {
+            size_t streamParsed = 0, mappedParsed = 0;
+            double stream = timeLoads<StreamParser>(mesh_files[f],
+                                                    streamParsed);
+            double mapped = timeLoads<MD5Parser>(mesh_files[f], mappedParsed);
+            printf("%-34s  %9.3f  %9.3f  %7.2f%s\n", mesh_files[f],
+                   stream, mapped, stream / mapped,
+                   streamParsed == mappedParsed ? "" : "  (mismatch)");
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include "Bench.h"
+#include "../Timer.h"
+#include "../JobPool.h"
+#include "../MD5Model.h"
+
+using namespace std;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+
+        const size_t num_models = 64;
+        const int warmup_frames = 20;
+        const int timed_frames = 200;
+        const float frame_time = 1.0f / 60;
+    }
+
+    /** Skins a crowd of Bob models playing the clip every frame,
+        with job pools of 1 up to a thread per hardware core.
+    */
+    void BenchSkinning(const Shader& shader)
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+
+        // Models start at other frames, like a crowd would.
+        vector<unique_ptr<MD5Model> > models;
+        for (size_t i = 0; i < num_models; i++)
+        {
+            models.push_back(unique_ptr<MD5Model>(new MD5Model()));
+            models.back()->Load(mesh_file, shader);
+            models.back()->SetAnimation(anim);
+            models.back()->Update(i * frame_time);
+        }
+
+        size_t maxThreads = max(thread::hardware_concurrency(), 1u);
+        printf("%u models, %d frames\n", unsigned(num_models), timed_frames);
+        printf("threads  ms/frame  speedup\n");
+
+        double single = 0.0;
+        for (size_t threads = 1; threads <= maxThreads; threads++)
+        {
+            JobPool pool(threads);
+            for (size_t i = 0; i < models.size(); i++)
+                models[i]->SetJobPool(&pool);
+
+            for (int frame = 0; frame < warmup_frames; frame++)
+            {
+                for (size_t i = 0; i < models.size(); i++)
+                    models[i]->Update(frame_time);
+            }
+
+            Timer timer;
+            timer.Reset();
+            for (int frame = 0; frame < timed_frames; frame++)
+            {
+                for (size_t i = 0; i < models.size(); i++)
+                    models[i]->Update(frame_time);
+            }
+            double ms = timer.ElapsedTime() * 1000.0 / timed_frames;
+            if (threads == 1) single = ms;
+            printf("%7u  %8.3f  %7.2f\n", unsigned(threads), ms, single / ms);
+
+            // The pool is gone after this iteration.
+            for (size_t i = 0; i < models.size(); i++)
+                models[i]->SetJobPool(0);
+        }
+    }
+}
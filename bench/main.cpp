@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "../Window.h"
+#include "../Graphics.h"
+#include "Bench.h"
+
+using namespace ST;
+using namespace std;
+
+namespace
+{
+    int numNames = 0;
+    char** names = 0;
+
+    //-- Runs the benchmark if it's named on the command line or none is --//
+    template <typename Bench>
+    void run(const char* name, Bench bench)
+    {
+        bool selected = numNames == 0;
+        for (int i = 0; i < numNames; i++)
+            selected = selected || strcmp(names[i], name) == 0;
+        if (!selected) return;
+
+        printf("== %s ==\n", name);
+        bench();
+        printf("\n");
+    }
+}
+
+/** Runs from the folder of SpaceTraveller.cbp, where the data is.
+    Benchmarks named on the command line run alone, e.g. "Bench skinning".
+*/
+int main(int argc, char* argv[])
+{
+    numNames = argc - 1;
+    names = argv + 1;
+
+    // Models print their joints to cout on every Load(),
+    // the tables are printed with printf.
+    cout.setstate(ios::failbit);
+
+    // Models need an OpenGL context, which needs a window.
+    // The window is never shown.
+    MainWindow = new Window(TEXT("Bench"), WS_OVERLAPPED);
+
+    try
+    {
+        Graphics graphics;
+        Shader shader;
+        shader.CreateShader(GL_VERTEX_SHADER, "data/shaders/main.vert");
+        shader.CreateShader(GL_FRAGMENT_SHADER, "data/shaders/main.frag");
+        shader.CreateProgram();
+        shader.Activate();
+
+        run("skinning", [&] { BenchSkinning(shader); });
+        run("load", [] { BenchLoad(); });
+        run("cache", [&] { BenchCache(shader); });
+        run("ikbatch", [&] { BenchIKBatch(shader); });
+        run("ikbody", [&] { BenchIKBody(shader); });
+        run("kinematics", [] { BenchKinematics(); });
+    }
+    catch (exception& ex)
+    {
+        printf("Benchmark failed: %s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -76,18 +76,25 @@ namespace Math
         return sqrt(w * w + x * x + y * y + z * z);
     }
 
+    //--------- Same as q * v * q^-1 for unit quaternion 'q' ---------//
+    // v' = v + 2w(q x v) + 2q x (q x v) is computed as
+    // t = 2(q x v), v' = v + wt + q x t, which is 18 mul and 12 add
+    // instead of 32 mul and 24 add of two full quaternion products.
     Vector3D Quaternion::Rotate(const Vector3D& v) const
     {
-        Quaternion q(0, v[0], v[1], v[2]);
-        Quaternion res = *this * q * this->Conjugate();
-        return Vector3D(res.x, res.y, res.z);
+        float tx = 2 * (y * v[2] - z * v[1]);
+        float ty = 2 * (z * v[0] - x * v[2]);
+        float tz = 2 * (x * v[1] - y * v[0]);
+
+        return Vector3D(v[0] + w * tx + (y * tz - z * ty),
+                        v[1] + w * ty + (z * tx - x * tz),
+                        v[2] + w * tz + (x * ty - y * tx));
     }
 
+    //--------- Same as q^-1 * v * q for unit quaternion 'q' ---------//
     Vector3D Quaternion::InverseRotate(const Vector3D& v) const
     {
-        Quaternion q(0, v[0], v[1], v[2]);
-        Quaternion res = this->Conjugate() * q * (*this);
-        return Vector3D(res.x, res.y, res.z);
+        return Conjugate().Rotate(v);
     }
 
     Quaternion Quaternion::Conjugate() const
@@ -0,0 +1,125 @@
+#include <cmath>
+#include "Tests.h"
+#include "../AnimGraph.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        // Short clip whose origin walks on and turns in every frame.
+        const char anim_file[] = "tests/data/walk.md5anim";
+
+        // Graphs mix local poses, clips blend poses of the model.
+        const float pose_tolerance = 1e-3f;
+        const float motion_tolerance = 1e-4f;
+
+        bool nearPos(const Vector3D& a, const Vector3D& b, float tolerance)
+        {
+            return fabs(a[0] - b[0]) <= tolerance &&
+                   fabs(a[1] - b[1]) <= tolerance &&
+                   fabs(a[2] - b[2]) <= tolerance;
+        }
+
+        bool nearMotion(const MD5Animation::Transform& a,
+                        const MD5Animation::Transform& b)
+        {
+            // q and -q are the same rotation.
+            float dot = a.orient.w * b.orient.w + a.orient.x * b.orient.x +
+                        a.orient.y * b.orient.y + a.orient.z * b.orient.z;
+            return nearPos(a.pos, b.pos, motion_tolerance) &&
+                   fabs(dot) >= 1.0f - motion_tolerance;
+        }
+
+        bool nearSkeleton(const MD5Animation::Skeleton& a,
+                          const MD5Animation::Skeleton& b)
+        {
+            if (a.size() != b.size()) return false;
+            for (size_t i = 0; i < a.size(); i++)
+            {
+                if (!nearPos(a[i].pos, b[i].pos, pose_tolerance))
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    /** Clip nodes step the clock of MD5Animation in whole ticks scaled
+        by their speed, and the graph gives the root motion of its clips.
+    */
+    void CheckGraphClock()
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+        anim.SetRootMotion(true);
+        CHECK(anim.GetNumFrames() > 0);
+
+        // A graph of a single clip plays it like the clip, over the loops.
+        AnimGraph graph;
+        AnimGraph::NodeID clip = graph.AddClip(anim);
+        graph.SetRootMotion(true);
+
+        const long long step = MD5Animation::TicksPerSecond / 60;
+        int steps = int(3 * anim.GetDuration() * 60) + 7;
+        bool moved = false;
+        for (int i = 0; i < steps; i++)
+        {
+            anim.Advance(step);
+            graph.Advance(step);
+            CHECK(graph.GetTicks(clip) == anim.GetTicks());
+            CHECK(nearMotion(graph.GetRootMotion(), anim.GetRootMotion()));
+            CHECK(nearSkeleton(graph.GetSkeleton(), anim.GetSkeleton()));
+            moved = moved || !nearPos(anim.GetRootMotion().pos, Vector3D(),
+                                      motion_tolerance);
+        }
+        CHECK(moved);
+
+        // The speed scales whole ticks, so the clock doesn't drift.
+        graph.SetSpeed(clip, 0.5f);
+        graph.SetTicks(clip, 0);
+        for (int i = 0; i < 100000; i++)
+            graph.Advance(step);
+        CHECK(graph.GetTicks(clip) == 100000 * step / 2);
+
+        graph.SetSpeed(clip, -1.0f);
+        graph.SetTicks(clip, 0);
+        for (int i = 0; i < 1000; i++)
+            graph.Advance(step);
+        CHECK(graph.GetTicks(clip) == -1000 * step);
+
+        // A blend mixes the motion of its inputs, and a blend that
+        // leaves out the root keeps the motion of its first input.
+        AnimGraph mixed;
+        AnimGraph::NodeID a = mixed.AddClip(anim);
+        AnimGraph::NodeID b = mixed.AddClip(anim);
+        AnimGraph::NodeID half = mixed.AddBlend(a, b);
+        AnimGraph::NodeID upper = mixed.AddBlend(half, b);
+        mixed.SetRootMotion(true);
+        mixed.SetWeight(half, 0.5f);
+        mixed.SetWeight(upper, 1.0f);
+        mixed.SetSpeed(b, 2.0f);
+
+        AnimGraph::JointMask mask;
+        int last = anim.GetNumJoints() - 1;
+        mixed.MaskSubtree(anim.GetJointInfo(last).name, mask);
+        CHECK(!mask[anim.GetRootJoint()]);
+        mixed.SetMask(upper, mask);
+
+        anim.SetTicks(0);
+        for (int i = 0; i < 60; i++)
+        {
+            MD5Animation::Transform a0 = anim.SampleRootMotion(
+                i * step, (i + 1) * step);
+            MD5Animation::Transform b0 = anim.SampleRootMotion(
+                2 * i * step, 2 * (i + 1) * step);
+            MD5Animation::Transform half0;
+            half0.pos = Vector3D::Lerp(a0.pos, b0.pos, 0.5f);
+            half0.orient = Quaternion::Slerp(a0.orient, b0.orient, 0.5f);
+
+            mixed.Advance(step);
+            CHECK(nearMotion(mixed.GetRootMotion(), half0));
+        }
+    }
+}
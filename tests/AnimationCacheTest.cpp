@@ -0,0 +1,57 @@
+#include <cstdio>
+#include "Tests.h"
+#include "../MD5Animation.h"
+
+using namespace std;
+
+namespace ST
+{
+    namespace
+    {
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+
+        //-- Copies of the clip are dropped, so the next load reads it --//
+        bool loadClip(bool compressed)
+        {
+            MD5Animation anim;
+            anim.LoadAnimation(anim_file, compressed);
+            return anim.IsCompressed() == compressed &&
+                   anim.GetNumFrames() > 0;
+        }
+
+        bool sameStamp(const FileStamp& a, const FileStamp& b)
+        {
+            return a.size == b.size && a.time == b.time;
+        }
+    }
+
+    /** Raw and compressed loads of one clip keep their caches,
+        instead of replacing the cache of each other.
+    */
+    void CheckClipCaches()
+    {
+        string rawCache = GetCacheName(anim_file);
+        string compressedCache = GetCacheName(string(anim_file) + ".z");
+        remove(rawCache.c_str());
+        remove(compressedCache.c_str());
+
+        CHECK(loadClip(false));
+        CHECK(loadClip(true));
+
+        FileStamp raw, compressed;
+        CHECK(GetFileStamp(rawCache, raw));
+        CHECK(GetFileStamp(compressedCache, compressed));
+
+        for (int i = 0; i < 2; i++)
+        {
+            CHECK(loadClip(false));
+            CHECK(loadClip(true));
+        }
+
+        FileStamp rawAfter, compressedAfter;
+        CHECK(GetFileStamp(rawCache, rawAfter));
+        CHECK(GetFileStamp(compressedCache, compressedAfter));
+        CHECK(sameStamp(raw, rawAfter));
+        CHECK(sameStamp(compressed, compressedAfter));
+    }
+}
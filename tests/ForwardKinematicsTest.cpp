@@ -0,0 +1,143 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "Tests.h"
+#include "../ForwardKinematics.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        // Two trees, joints 3 and 0 come after their children in order:
+        // 1 -> 3 -> 0 -> 2, 1 -> 4 -> 5 and 6 -> 7.
+        const int tree_parents[] = { 3, -1, 0, 1, 1, 4, -1, 6 };
+        const size_t num_joints = sizeof(tree_parents) / sizeof(int);
+
+        const float tolerance = 1e-4f;
+
+        //-- Object-space pose of the joint walked from its root --//
+        void referencePose(const ForwardKinematics& fk, int joint,
+                           Vector3D& pos, Quaternion& orient)
+        {
+            int p = tree_parents[joint];
+            if (p < 0)
+            {
+                pos = fk.GetLocalPos(joint);
+                orient = fk.GetLocalOrient(joint);
+                return;
+            }
+
+            Vector3D parentPos;
+            Quaternion parentOrient;
+            referencePose(fk, p, parentPos, parentOrient);
+            pos = parentPos + parentOrient.Rotate(fk.GetLocalPos(joint));
+            orient = parentOrient * fk.GetLocalOrient(joint);
+        }
+
+        bool matchesReference(const ForwardKinematics& fk)
+        {
+            for (size_t i = 0; i < num_joints; i++)
+            {
+                Vector3D pos;
+                Quaternion orient;
+                referencePose(fk, i, pos, orient);
+
+                // q and -q are the same rotation.
+                const Quaternion& q = fk.GetOrient(i);
+                float dot = q.w * orient.w + q.x * orient.x +
+                            q.y * orient.y + q.z * orient.z;
+                if ((fk.GetPos(i) - pos).Length() > tolerance ||
+                    fabs(dot) < 1.0f - tolerance)
+                    return false;
+            }
+            return true;
+        }
+
+        //-- Whether the last Update() recomputed exactly 'joints' --//
+        bool changedJoints(const ForwardKinematics& fk, vector<int> joints)
+        {
+            vector<int> changed = fk.GetChanged();
+            sort(changed.begin(), changed.end());
+            sort(joints.begin(), joints.end());
+            return changed == joints;
+        }
+
+        bool throwsOnBuild(const vector<int>& parents)
+        {
+            ForwardKinematics fk;
+            try
+            {
+                fk.Build(parents);
+            }
+            catch (runtime_error&)
+            {
+                return true;
+            }
+            return false;
+        }
+    }
+
+    /** Update() recomputes each dirty subtree once, a dirty joint inside
+        another one with it, and GetChanged() lists just those joints.
+    */
+    void CheckKinematicsSubtrees()
+    {
+        ForwardKinematics fk;
+        fk.Build(vector<int>(tree_parents, tree_parents + num_joints));
+        CHECK(fk.GetNumJoints() == num_joints);
+
+        for (size_t i = 0; i < num_joints; i++)
+        {
+            Quaternion turn(0.2f * (i + 1), Vector3D(0.0f, 0.0f, 1.0f));
+            fk.SetLocal(i, Vector3D(1.0f + i, 0.5f, 0.0f), turn);
+        }
+        CHECK(fk.Update() == num_joints);
+        CHECK(matchesReference(fk));
+
+        // Nothing edited, nothing recomputed.
+        CHECK(fk.Update() == 0);
+        CHECK(fk.GetChanged().empty());
+
+        // A dirty joint inside the dirty subtree of 3.
+        Quaternion turn(0.5f, Vector3D(1.0f, 0.0f, 0.0f));
+        fk.SetLocalOrient(0, turn);
+        fk.SetLocalOrient(3, turn);
+        CHECK(fk.Update() == 3);
+        CHECK(changedJoints(fk, { 3, 0, 2 }));
+        CHECK(matchesReference(fk));
+
+        // Sibling subtrees, and a root of the other tree.
+        fk.SetLocalOrient(4, turn);
+        fk.SetLocal(3, Vector3D(0.0f, 2.0f, 0.0f), turn);
+        fk.SetLocalOrient(6, turn);
+        CHECK(fk.Update() == 7);
+        CHECK(changedJoints(fk, { 3, 0, 2, 4, 5, 6, 7 }));
+        CHECK(matchesReference(fk));
+
+        // A pose set in object space keeps the joint there,
+        // its children follow it and its parent stays.
+        Vector3D pos(3.0f, -1.0f, 2.0f);
+        fk.SetPose(4, pos, turn);
+        CHECK(fk.Update() == 2);
+        CHECK(changedJoints(fk, { 4, 5 }));
+        CHECK((fk.GetPos(4) - pos).Length() < tolerance);
+        CHECK(matchesReference(fk));
+    }
+
+    /** Parents outside the skeleton and cycles are refused by Build(). */
+    void CheckKinematicsErrors()
+    {
+        CHECK(!throwsOnBuild({ -1, 0, 1 }));
+        CHECK(!throwsOnBuild({}));
+        CHECK(throwsOnBuild({ -1, 0, 3 }));
+        CHECK(throwsOnBuild({ -1, -2 }));
+        CHECK(throwsOnBuild({ -1, 2, 1 }));
+        CHECK(throwsOnBuild({ 0 }));
+
+        // A cycle below a root is left out of its tree as well.
+        CHECK(throwsOnBuild({ -1, 0, 3, 2 }));
+    }
+}
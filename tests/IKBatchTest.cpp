@@ -0,0 +1,101 @@
+#include <cmath>
+#include <algorithm>
+#include "Tests.h"
+#include "../IKBatch.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+
+        //-- Vertices of the two models skinned to other positions --//
+        size_t countMoved(const MD5Model& a, const MD5Model& b)
+        {
+            size_t moved = 0;
+            for (size_t m = 0; m < a.GetNumMeshes(); m++)
+            {
+                const vector<Vector3D>& pa = a.GetPositions(m);
+                const vector<Vector3D>& pb = b.GetPositions(m);
+                for (size_t i = 0; i < pa.size(); i++)
+                {
+                    if (pa[i][0] != pb[i][0] || pa[i][1] != pb[i][1] ||
+                        pa[i][2] != pb[i][2])
+                        moved++;
+                }
+            }
+            return moved;
+        }
+
+        size_t countVertices(const MD5Model& model)
+        {
+            size_t count = 0;
+            for (size_t m = 0; m < model.GetNumMeshes(); m++)
+                count += model.GetPositions(m).size();
+            return count;
+        }
+    }
+
+    /** IK of an animated model bends the played pose, which is skinned
+        with the solved arm, and the next frame plays the animation again.
+    */
+    void CheckAnimatedIK(const Shader& shader)
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+
+        MD5Model model, played;
+        model.Load(mesh_file, shader);
+        played.Load(mesh_file, shader);
+        model.SetAnimation(anim);
+        played.SetAnimation(anim);
+
+        IKChain arm(model.GetSkeleton(), "upperarm.L", "wrist.L");
+        IKBatch batch;
+        batch.Add(model, arm, IKTarget());
+
+        for (int frame = 0; frame < 8; frame++)
+        {
+            model.Animate(0.1f);
+            played.Update(0.1f);
+
+            // The hand reaches a bit towards the shoulder every other
+            // frame, the frames between play the clip alone.
+            if (frame % 2 == 0)
+            {
+                const MD5Model::JointList& pose = model.GetPose();
+                Vector3D shoulder = pose[arm.GetRoot()].pos;
+                Vector3D hand = pose[arm.GetEnd()].pos;
+                Vector3D target = hand + (shoulder - hand) * 0.2f;
+                batch.SetTarget(0, IKTarget(target));
+                CHECK(batch.Solve() == 1);
+
+                Vector3D reached = model.GetPose()[arm.GetEnd()].pos;
+                CHECK((reached - target).Length() < 0.1f);
+            }
+            model.Skin();
+
+            // Only the arm moves, and only while it's solved.
+            size_t moved = countMoved(model, played);
+            if (frame % 2 == 0)
+                CHECK(moved > 0 && moved < countVertices(model) / 2);
+            else
+                CHECK(moved == 0);
+        }
+
+        // The bind pose isn't touched by the solves.
+        MD5Model bind;
+        bind.Load(mesh_file, shader);
+        for (size_t i = 0; i < bind.GetSkeleton().size(); i++)
+        {
+            const MD5Model::Joint& a = bind.GetSkeleton()[i];
+            const MD5Model::Joint& b = model.GetSkeleton()[i];
+            CHECK(a.pos[0] == b.pos[0] && a.pos[1] == b.pos[1] &&
+                  a.pos[2] == b.pos[2]);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#include <cmath>
+#include "Tests.h"
+#include "../IKBody.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        //-- Straight arm of three bones of 10 along x --//
+        MD5Model::JointList makeArm()
+        {
+            const char* names[] = { "shoulder", "elbow", "wrist", "hand" };
+            MD5Model::JointList joints(4);
+            for (int i = 0; i < 4; i++)
+            {
+                joints[i].name = names[i];
+                joints[i].parentID = i - 1;
+                joints[i].pos = Vector3D(10.0f * i, 0.0f, 0.0f);
+                joints[i].orient = Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+            }
+            return joints;
+        }
+
+        //-- Hips with a leg down y and an arm along x from a spine --//
+        MD5Model::JointList makeBody()
+        {
+            const char* names[] = { "hips", "thigh", "shin", "foot",
+                                    "spine", "shoulder", "elbow", "hand" };
+            const int parents[] = { -1, 0, 1, 2, 0, 4, 5, 6 };
+            const Vector3D positions[] =
+            {
+                Vector3D(0.0f, 0.0f, 0.0f), Vector3D(0.0f, -10.0f, 0.0f),
+                Vector3D(0.0f, -20.0f, 0.0f), Vector3D(0.0f, -30.0f, 0.0f),
+                Vector3D(0.0f, 10.0f, 0.0f), Vector3D(10.0f, 10.0f, 0.0f),
+                Vector3D(20.0f, 10.0f, 0.0f), Vector3D(30.0f, 10.0f, 0.0f)
+            };
+            MD5Model::JointList joints(8);
+            for (int i = 0; i < 8; i++)
+            {
+                joints[i].name = names[i];
+                joints[i].parentID = parents[i];
+                joints[i].pos = positions[i];
+                joints[i].orient = Quaternion(1.0f, 0.0f, 0.0f, 0.0f);
+            }
+            return joints;
+        }
+
+        bool sameRotation(const Quaternion& a, const Quaternion& b)
+        {
+            // q and -q are the same rotation.
+            float dot = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+            return fabs(dot) >= 1.0f - 1e-4f;
+        }
+    }
+
+    /** Targets that gain or lose the orientation change the rows
+        of their task, the body solves them like targets added so.
+    */
+    void CheckIKBodyTargets()
+    {
+        MD5Model::JointList joints = makeArm();
+        IKChain arm(joints, "shoulder", "hand");
+        Vector3D pos(20.0f, 10.0f, 0.0f);
+        Quaternion orient(3.14159265f / 2, Vector3D(0.0f, 0.0f, 1.0f));
+
+        IKBody body;
+        size_t task = body.AddTask(arm, IKTarget(pos));
+        CHECK(body.Solve(joints));
+
+        body.SetTarget(task, IKTarget(pos, orient));
+        CHECK(body.Solve(joints));
+        CHECK(sameRotation(joints[arm.GetEnd()].orient, orient));
+
+        // Back to the position alone, from the straight arm again.
+        joints = makeArm();
+        Vector3D other(15.0f, -12.0f, 5.0f);
+        body.SetTarget(task, IKTarget(other));
+        CHECK(body.Solve(joints));
+        CHECK((joints[arm.GetEnd()].pos - other).Length() < 0.1f);
+    }
+
+    /** A task of lower priority moves the joints only in the null space
+        of a reached task above it, so a planted foot stays where it is
+        however hard the hand pulls. Tasks of one priority share the error.
+    */
+    void CheckIKBodyPriorities()
+    {
+        MD5Model::JointList start = makeBody();
+        IKChain leg(start, "hips", "foot");
+        IKChain arm(start, "hips", "hand");
+        Vector3D planted = start[leg.GetEnd()].pos;
+
+        // The hand can't reach that far without the hips and the leg.
+        Vector3D far(60.0f, 30.0f, 0.0f);
+        float before = (start[arm.GetEnd()].pos - far).Length();
+
+        MD5Model::JointList joints = start;
+        IKBody body;
+        body.SetRootMotion(true);
+        size_t foot = body.AddTask(leg, IKTarget(planted), 0);
+        size_t hand = body.AddTask(arm, IKTarget(far), 1);
+        CHECK(!body.Solve(joints));
+        CHECK(body.IsReached(foot));
+        CHECK(!body.IsReached(hand));
+        float kept = (joints[leg.GetEnd()].pos - planted).Length();
+        CHECK(kept < 0.1f);
+        CHECK((joints[arm.GetEnd()].pos - far).Length() < before);
+
+        // The same tasks of one priority give the foot away to the hand.
+        joints = start;
+        IKBody shared;
+        shared.SetRootMotion(true);
+        shared.AddTask(leg, IKTarget(planted), 0);
+        shared.AddTask(arm, IKTarget(far), 0);
+        shared.Solve(joints);
+        CHECK((joints[leg.GetEnd()].pos - planted).Length() > kept + 0.1f);
+    }
+}
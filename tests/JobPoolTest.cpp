@@ -0,0 +1,43 @@
+#include <atomic>
+#include <stdexcept>
+#include "Tests.h"
+#include "../JobPool.h"
+
+using namespace std;
+
+namespace ST
+{
+    /** A job that throws doesn't stop the others or hang the pool,
+        and Wait() passes its exception on once.
+    */
+    void CheckJobPoolErrors()
+    {
+        JobPool pool(4);
+        atomic<int> done(0);
+        for (int i = 0; i < 64; i++)
+        {
+            pool.Add([&done, i]
+            {
+                if (i % 16 == 3) throw runtime_error("Job failed");
+                done++;
+            });
+        }
+
+        bool thrown = false;
+        try
+        {
+            pool.Wait();
+        }
+        catch (runtime_error&)
+        {
+            thrown = true;
+        }
+        CHECK(thrown);
+        CHECK(done == 60);
+
+        // The exception is thrown only once and the pool still works.
+        pool.Add([&done] { done++; });
+        pool.Wait();
+        CHECK(done == 61);
+    }
+}
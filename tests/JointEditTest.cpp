@@ -0,0 +1,146 @@
+#include <cmath>
+#include "Tests.h"
+#include "../MD5Model.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+        const char edited_joint[] = "upperarm.L";
+
+        // Gathered normals sum the faces in the same order,
+        // only the rounding of the bind-pose normals may differ.
+        const float tolerance = 1e-4f;
+
+        size_t findJoint(MD5Model& model, const string& name)
+        {
+            const MD5Model::JointList& joints = model.GetSkeleton();
+            for (size_t i = 0; i < joints.size(); i++)
+            {
+                if (joints[i].name == name) return i;
+            }
+            return joints.size();
+        }
+
+        //-- Whether the vectors are at most 'tolerance' apart --//
+        bool nearBuffers(const vector<Vector3D>& a, const vector<Vector3D>& b)
+        {
+            if (a.size() != b.size()) return false;
+            for (size_t i = 0; i < a.size(); i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    if (fabs(a[i][c] - b[i][c]) > tolerance) return false;
+                }
+            }
+            return true;
+        }
+
+        bool nearModels(const MD5Model& a, const MD5Model& b)
+        {
+            if (a.GetNumMeshes() != b.GetNumMeshes()) return false;
+            for (size_t m = 0; m < a.GetNumMeshes(); m++)
+            {
+                if (!nearBuffers(a.GetPositions(m), b.GetPositions(m)) ||
+                    !nearBuffers(a.GetNormals(m), b.GetNormals(m)))
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    /** Joints edited while the model plays an animation update the
+        bind-pose normals around them like the full recompute does,
+        and the played vertices stay where they are until they are
+        skinned again.
+    */
+    void CheckAnimatedJointEdits(const Shader& shader)
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+        Quaternion rotation(3.14159265f / 4, Vector3D(0.0f, 0.0f, 1.0f));
+
+        // The edit of the still model, with all the normals gathered again.
+        MD5Model full;
+        full.Load(mesh_file, shader);
+        size_t joint = findJoint(full, edited_joint);
+        CHECK(joint < full.GetSkeleton().size());
+        full.RotateJoint(joint, rotation);
+        full.UpdateJoints();
+        full.SetNormalWeighting(MeshNormals::WEIGHT_AREA);
+        full.SetAnimation(anim);
+
+        MD5Model skinned, recomputed;
+        skinned.Load(mesh_file, shader);
+        recomputed.Load(mesh_file, shader);
+        skinned.SetAnimation(anim);
+        recomputed.SetAnimation(anim);
+        recomputed.SetNormalMode(MD5Model::NORMALS_RECOMPUTED);
+
+        for (int frame = 0; frame < 3; frame++)
+        {
+            full.Update(0.1f);
+            skinned.Update(0.1f);
+            recomputed.Update(0.1f);
+        }
+
+        MD5Model* edited[] = { &skinned, &recomputed };
+        for (int k = 0; k < 2; k++)
+        {
+            MD5Model& model = *edited[k];
+            vector<vector<Vector3D> > played;
+            for (size_t m = 0; m < model.GetNumMeshes(); m++)
+                played.push_back(model.GetPositions(m));
+
+            model.RotateJoint(joint, rotation);
+            model.UpdateJoints();
+            for (size_t m = 0; m < model.GetNumMeshes(); m++)
+                CHECK(nearBuffers(model.GetPositions(m), played[m]));
+
+            // Normals skinned from the bind pose show the edit
+            // once the same pose is played again.
+            model.SetNormalMode(MD5Model::NORMALS_SKINNED);
+            model.Update(0.0f);
+            CHECK(nearModels(model, full));
+        }
+    }
+
+    /** Weighting changed while the model plays gathers the bind-pose
+        normals from the bind pose, and leaves the played vertices
+        to the next skinning.
+    */
+    void CheckAnimatedWeighting(const Shader& shader)
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+
+        MD5Model still, played;
+        still.Load(mesh_file, shader);
+        played.Load(mesh_file, shader);
+        still.SetNormalWeighting(MeshNormals::WEIGHT_ANGLE);
+        still.SetAnimation(anim);
+        played.SetAnimation(anim);
+
+        for (int frame = 0; frame < 3; frame++)
+        {
+            still.Update(0.1f);
+            played.Update(0.1f);
+        }
+
+        vector<vector<Vector3D> > positions;
+        for (size_t m = 0; m < played.GetNumMeshes(); m++)
+            positions.push_back(played.GetPositions(m));
+
+        played.SetNormalWeighting(MeshNormals::WEIGHT_ANGLE);
+        for (size_t m = 0; m < played.GetNumMeshes(); m++)
+            CHECK(nearBuffers(played.GetPositions(m), positions[m]));
+
+        played.Update(0.0f);
+        CHECK(nearModels(played, still));
+    }
+}
@@ -0,0 +1,32 @@
+#include "Tests.h"
+#include "../MD5Parser.h"
+
+using namespace std;
+
+namespace ST
+{
+    namespace
+    {
+        // Joints named "origin", "", "a", b and a lone quote.
+        const char mesh_file[] = "tests/data/names.md5mesh";
+    }
+
+    /** Joint names lose their quotes, and names too short to be quoted
+        are read as they are.
+    */
+    void CheckParserNames()
+    {
+        MD5Parser parser;
+        parser.Parse(mesh_file);
+
+        const vector<Joint>& joints = parser.GetSkeleton();
+        const char* names[] = { "origin", "", "a", "b", "" };
+        CHECK(joints.size() == 5);
+        for (size_t i = 0; i < joints.size() && i < 5; i++)
+        {
+            CHECK(joints[i].name == names[i]);
+            CHECK(joints[i].parent == int(i) - 1);
+            CHECK(joints[i].p[0] == float(i));
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#include <cmath>
+#include <algorithm>
+#include "Tests.h"
+#include "../MD5Model.h"
+
+using namespace std;
+using namespace Math;
+
+namespace ST
+{
+    namespace
+    {
+        const char mesh_file[] = "data/models/boblampclean.md5mesh";
+        const char anim_file[] = "data/models/boblampclean.md5anim";
+
+        // SIMD kernels round some operations another way.
+        const float simd_tolerance = 1e-4f;
+
+        float maxDifference(const vector<Vector3D>& a,
+                            const vector<Vector3D>& b)
+        {
+            float diff = a.size() == b.size() ? 0.0f : INFINITY;
+            for (size_t i = 0; i < a.size() && i < b.size(); i++)
+            {
+                for (int c = 0; c < 3; c++)
+                    diff = max(diff, fabs(a[i][c] - b[i][c]));
+            }
+            return diff;
+        }
+    }
+
+    /** Weight list and stream layouts skin every frame of the clip
+        to the same positions and normals.
+    */
+    void CheckSkinningLayouts(const Shader& shader)
+    {
+        MD5Animation anim;
+        anim.LoadAnimation(anim_file);
+        CHECK(anim.GetNumFrames() > 0);
+
+        MD5Model list, stream;
+        list.Load(mesh_file, shader);
+        stream.Load(mesh_file, shader);
+        list.SetSkinningMode(MD5Model::SKINNING_WEIGHT_LIST);
+        stream.SetSkinningMode(MD5Model::SKINNING_STREAM);
+        CHECK(list.GetNumMeshes() == stream.GetNumMeshes());
+
+        long long frameTicks = MD5Animation::TicksPerSecond /
+                               anim.GetFrameRate();
+        SkinningKernel best = GetBestSkinningKernel();
+        const SkinningKernel kernels[] = { SKINNING_KERNEL_SCALAR,
+                                           SKINNING_KERNEL_SSE41,
+                                           SKINNING_KERNEL_AVX2 };
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            if (!SetSkinningKernel(kernels[k])) continue;
+
+            // The scalar kernel does the operations of the weight list.
+            float tolerance = kernels[k] == SKINNING_KERNEL_SCALAR ?
+                              0.0f : simd_tolerance;
+            for (int frame = 0; frame < anim.GetNumFrames(); frame++)
+            {
+                anim.SetTicks(frame * frameTicks);
+                list.SetAnimation(anim);
+                stream.SetAnimation(anim);
+                list.Update(0.0f);
+                stream.Update(0.0f);
+
+                for (size_t m = 0; m < list.GetNumMeshes(); m++)
+                {
+                    CHECK(maxDifference(list.GetPositions(m),
+                                        stream.GetPositions(m)) <= tolerance);
+                    CHECK(maxDifference(list.GetNormals(m),
+                                        stream.GetNormals(m)) <= tolerance);
+                }
+            }
+        }
+        SetSkinningKernel(best);
+    }
+}
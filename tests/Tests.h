@@ -0,0 +1,34 @@
+#ifndef TESTS_H_INCLUDED
+#define TESTS_H_INCLUDED
+
+#include "../Shader.h"
+
+namespace ST
+{
+    /** Counts the failed check and prints where it is. */
+    void CheckFailed(const char* condition, const char* file, int line);
+
+    // Checks run by main() one after another. Models upload their meshes,
+    // so they are loaded with the shader main() creates in its context.
+    void CheckJobPoolErrors();
+    void CheckClipCaches();
+    void CheckParserNames();
+    void CheckGraphClock();
+    void CheckIKBodyTargets();
+    void CheckIKBodyPriorities();
+    void CheckKinematicsSubtrees();
+    void CheckKinematicsErrors();
+    void CheckSkinningLayouts(const Shader& shader);
+    void CheckAnimatedIK(const Shader& shader);
+    void CheckAnimatedJointEdits(const Shader& shader);
+    void CheckAnimatedWeighting(const Shader& shader);
+}
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+            ST::CheckFailed(#condition, __FILE__, __LINE__); \
+    } while (0)
+
+#endif // TESTS_H_INCLUDED
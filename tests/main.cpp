@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <stdexcept>
+#include "../Window.h"
+#include "../Graphics.h"
+#include "Tests.h"
+
+using namespace ST;
+using namespace std;
+
+namespace
+{
+    int failures = 0;
+
+    //-- Runs one group of checks, an exception fails the group --//
+    template <typename Check>
+    void run(const char* name, Check check)
+    {
+        int before = failures;
+        try
+        {
+            check();
+        }
+        catch (exception& ex)
+        {
+            printf("%s threw: %s\n", name, ex.what());
+            failures++;
+        }
+        printf("%s: %s\n", name, failures == before ? "passed" : "FAILED");
+    }
+}
+
+namespace ST
+{
+    void CheckFailed(const char* condition, const char* file, int line)
+    {
+        printf("%s:%d: check failed: %s\n", file, line, condition);
+        failures++;
+    }
+}
+
+/** Runs from the folder of SpaceTraveller.cbp, where the data is. */
+int main()
+{
+    // Models need an OpenGL context, which needs a window.
+    // The window is never shown.
+    MainWindow = new Window(TEXT("Tests"), WS_OVERLAPPED);
+
+    try
+    {
+        Graphics graphics;
+        Shader shader;
+        shader.CreateShader(GL_VERTEX_SHADER, "data/shaders/main.vert");
+        shader.CreateShader(GL_FRAGMENT_SHADER, "data/shaders/main.frag");
+        shader.CreateProgram();
+        shader.Activate();
+
+        run("Job pool errors", [] { CheckJobPoolErrors(); });
+        run("Skinning layouts", [&] { CheckSkinningLayouts(shader); });
+        run("Clip caches", [] { CheckClipCaches(); });
+        run("Parser names", [] { CheckParserNames(); });
+        run("Graph clock", [] { CheckGraphClock(); });
+        run("Animated IK", [&] { CheckAnimatedIK(shader); });
+        run("Animated joint edits",
+            [&] { CheckAnimatedJointEdits(shader); });
+        run("Animated weighting", [&] { CheckAnimatedWeighting(shader); });
+        run("IK body targets", [] { CheckIKBodyTargets(); });
+        run("IK body priorities", [] { CheckIKBodyPriorities(); });
+        run("Kinematics subtrees", [] { CheckKinematicsSubtrees(); });
+        run("Kinematics errors", [] { CheckKinematicsErrors(); });
+    }
+    catch (exception& ex)
+    {
+        printf("Cannot start the tests: %s\n", ex.what());
+        return 1;
+    }
+
+    return failures > 0 ? 1 : 0;
+}